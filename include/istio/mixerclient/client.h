@@ -56,6 +56,9 @@ struct Statistics {
   uint64_t total_remote_check_calls;
   // Total number of remote check calls that blocking origin requests.
   uint64_t total_blocking_remote_check_calls;
+  // Total number of remote check calls to refresh cached results in
+  // background.
+  uint64_t total_refresh_check_calls;
 
   // Total number of quota calls.
   uint64_t total_quota_calls;
@@ -68,6 +71,39 @@ struct Statistics {
   uint64_t total_report_calls;
   // Total number of remote report calls.
   uint64_t total_remote_report_calls;
+  // Number of remote report calls by the number of batched reports.
+  uint64_t total_report_batch_size_1;
+  uint64_t total_report_batch_size_2_to_10;
+  uint64_t total_report_batch_size_11_to_100;
+  uint64_t total_report_batch_size_101_to_1000;
+  uint64_t total_report_batch_size_over_1000;
+  // Total number of reports dropped because the report backlog is full.
+  uint64_t total_dropped_reports;
+
+  // Check cache: total number of entries evicted for new ones and expired,
+  // the current number of entries and the idle time of the least recently
+  // used entry.
+  uint64_t total_check_cache_evictions;
+  uint64_t total_check_cache_expirations;
+  uint64_t check_cache_entries;
+  uint64_t check_cache_lru_age_ms;
+  // The same for quota cache.
+  uint64_t total_quota_cache_evictions;
+  uint64_t total_quota_cache_expirations;
+  uint64_t quota_cache_entries;
+  uint64_t quota_cache_lru_age_ms;
+
+  // Percentiles of recent remote call latencies in microseconds. Quota
+  // latencies are for the remote check calls with quotas.
+  uint64_t check_latency_p50_us;
+  uint64_t check_latency_p90_us;
+  uint64_t check_latency_p99_us;
+  uint64_t quota_latency_p50_us;
+  uint64_t quota_latency_p90_us;
+  uint64_t quota_latency_p99_us;
+  uint64_t report_latency_p50_us;
+  uint64_t report_latency_p90_us;
+  uint64_t report_latency_p99_us;
 };
 
 class MixerClient {
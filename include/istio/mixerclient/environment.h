@@ -49,6 +49,10 @@ using TransportReportFunc = std::function<CancelFunc(
 // Defines a function prototype to generate an UUID
 using UUIDGenerateFunc = std::function<std::string()>;
 
+// Defines a function prototype to record the latency of a remote call in
+// microseconds.
+using LatencyRecordFunc = std::function<void(int64_t latency_us)>;
+
 // Store functions provided by the Environments, such as
 // * transport function to make remote Check and Report calls
 // * timer function to create a timer
@@ -66,6 +70,13 @@ struct Environment {
   // UUID generating function
   UUIDGenerateFunc uuid_generate_func;
 
+  // Optional functions called with each latency sample recorded for the
+  // Check, quota and Report latency percentiles in Statistics. They are
+  // called by the thread completing the remote call.
+  LatencyRecordFunc check_latency_func;
+  LatencyRecordFunc quota_latency_func;
+  LatencyRecordFunc report_latency_func;
+
   // TODO: Add logging function here.
 };
 
@@ -23,6 +23,11 @@
 namespace istio {
 namespace mixerclient {
 
+// The control layer only sets the cache sizes, network_fail_open and the
+// batch limits from the TransportConfig. The other options are for library
+// users, neither the control layer nor the Envoy filter config set them.
+// Their defaults keep the behavior of a client without them.
+
 // Options controlling check behavior.
 struct CheckOptions {
   // Default constructor.
@@ -40,6 +45,51 @@ struct CheckOptions {
 
   // If true, Check is passed for any network failures.
   bool network_fail_open = true;
+
+  // Number of independent shards the cache entries are split into.
+  // Each shard has its own lock and holds num_entries / num_shards entries,
+  // so concurrent Check calls for different signatures don't contend on
+  // a single lock. Values <= 1 use a single shard.
+  int num_shards = 1;
+
+  // If true, a cached OK result close to expiration is still used while a
+  // single background Check is sent to refresh it, so frequently used
+  // entries don't cause blocking remote calls.
+  bool enable_background_refresh = false;
+
+  // With background refresh, an entry is refreshed when it expires within
+  // this many milliseconds,
+  int refresh_before_expire_ms = 1000;
+
+  // or when it has this many uses or fewer left.
+  int refresh_use_count = 1;
+
+  // If a refresh call is not done in this many milliseconds, for example
+  // it is cancelled, another refresh of the entry is allowed.
+  int refresh_timeout_ms = 1000;
+
+  // If true, concurrent cache misses without quotas share one remote Check
+  // call if all their attributes are identical. Each such request pays for
+  // a serialization and hash of its attributes.
+  bool coalesce_check_calls = false;
+
+  // If not 0, a remote Check call not done in this many milliseconds fails
+  // with DEADLINE_EXCEEDED, and network_fail_open applies. It needs
+  // timer_create_func in the environment.
+  int check_timeout_ms = 0;
+
+  // If true, the timeout adapts to adaptive_timeout_multiplier times the
+  // observed p99 Check latency, but it is at least min_check_timeout_ms and
+  // at most check_timeout_ms.
+  bool adaptive_check_timeout = false;
+  double adaptive_timeout_multiplier = 2.0;
+  int min_check_timeout_ms = 50;
+
+  // If not 0, a blocking Check call is sent again if it is not done within
+  // this percentile of the observed Check latency, and the first response
+  // is used. Both calls have the same deduplication id. It needs
+  // timer_create_func in the environment.
+  double hedge_check_percentile = 0;
 };
 
 // Options controlling report batch.
@@ -58,6 +108,48 @@ struct ReportOptions {
 
   // Maximum milliseconds a report item stayed in the buffer for batching.
   const int max_batch_time_ms;
+
+  // If not 0, a batch is flushed once its encoded size reaches this many
+  // bytes.
+  int max_batch_bytes = 0;
+
+  // If not 0, the batch time adapts to keep the report latency, the time
+  // a report stays in the buffer plus the Mixer Report latency, within
+  // this many milliseconds. It is at most max_batch_time_ms. If no other
+  // report is expected in time at the observed report rate, a report is
+  // sent right away.
+  int report_latency_slo_ms = 0;
+
+  // Maximum number of batches open at the same time. A batch is delta
+  // encoded and can't delete attributes, so a report missing attributes
+  // of the previous report goes to another open batch. If there are more,
+  // the oldest batch is flushed. By default, a batch is flushed whenever a
+  // report can't be added to it.
+  int max_open_batches = 1;
+
+  // If not 0, reports are pushed to a lock free queue of this size, and
+  // one thread at a time moves them to the batches. A thread doesn't wait
+  // for another one compressing reports. Reports are copied to the queue.
+  int report_queue_size = 0;
+
+  // If not 0, at most this many Report calls are in flight. Batches
+  // flushed meanwhile are held in a backlog, and sent as calls complete.
+  int max_inflight_reports = 0;
+
+  // Maximum encoded bytes of the held batches. Batches are dropped by
+  // backlog_drop_policy to stay within it.
+  int max_backlog_bytes = 16 * 1024 * 1024;
+
+  // Which held batches to drop when the backlog is full.
+  enum BacklogDropPolicy {
+    // Drop the oldest batches.
+    DROP_OLDEST = 0,
+    // Drop the newest batches.
+    DROP_NEWEST,
+    // Drop every other batch, keeping a sample spread over time.
+    SAMPLE,
+  };
+  BacklogDropPolicy backlog_drop_policy = DROP_OLDEST;
 };
 
 // Options controlling quota behavior.
@@ -78,6 +170,23 @@ struct QuotaOptions {
 
   // Maximum milliseconds before an idle cached quota should be deleted.
   const int expiration_ms;
+
+  // Number of independent shards the cache entries and the per quota data
+  // are split into. Cache entries are picked by signature and per quota data
+  // by quota name, each shard has its own lock. Values <= 1 use a single
+  // shard.
+  int num_shards = 1;
+
+  // Number of per worker sub-pools the prefetched tokens of a quota are
+  // split into, see QuotaPrefetch::Options::num_sub_pools. Usually the
+  // number of worker threads sharing the cache.
+  int num_sub_pools = 1;
+
+  // The weights of the rate forecast of the prefetch amount, see
+  // QuotaPrefetch::Options::rate_weight. The forecast is disabled when
+  // rate_weight <= 0.
+  double rate_weight = 0;
+  double trend_weight = 0;
 };
 
 }  // namespace mixerclient
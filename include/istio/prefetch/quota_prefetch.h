@@ -45,6 +45,20 @@ class QuotaPrefetch {
     // negative. (Its request amount is not granted).
     std::chrono::milliseconds close_wait_window;
 
+    // The number of sub-pools the tokens used without a lock are split
+    // into, usually the number of worker threads. Each thread uses its own
+    // sub-pool and steals from the others when it is empty.
+    int num_sub_pools;
+
+    // The weights of the newest sample in the moving averages of the
+    // passed amount and of its trend, sampled every predict_window / 20.
+    // If rate_weight > 0, the prefetch amount is at least the demand in
+    // predict_window at the rate forecast after the prefetch round trip,
+    // so prefetches keep up with a rising rate. By default, the prefetch
+    // amount is the passed amount in the last predict_window.
+    double rate_weight;
+    double trend_weight;
+
     // Constructor with default values.
     Options();
   };
@@ -67,6 +81,10 @@ class QuotaPrefetch {
 
   // Perform a quota check with the amount. Return true if granted.
   virtual bool Check(int amount, Tick t) = 0;
+
+  // Same as above, but a prefetch made by this check is sent with the
+  // transport instead of the one passed to Create().
+  virtual bool Check(int amount, const TransportFunc& transport, Tick t) = 0;
 };
 
 }  // namespace prefetch
@@ -0,0 +1,107 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_UTILS_HASH128_H_
+#define ISTIO_UTILS_HASH128_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+namespace istio {
+namespace utils {
+
+// A 128 bits hash value. It is a POD type, cheap to copy and compare,
+// can be used as a hash map key with Hash128Hasher.
+struct Hash128 {
+  uint64_t low;
+  uint64_t high;
+
+  bool operator==(const Hash128& other) const {
+    return low == other.low && high == other.high;
+  }
+  bool operator!=(const Hash128& other) const { return !(*this == other); }
+
+  // Converts to a printable string.
+  // It is for debugging and unit-test only.
+  std::string DebugString() const;
+};
+
+// A hash functor to use Hash128 as the key of hash maps.
+struct Hash128Hasher {
+  size_t operator()(const Hash128& h) const {
+    return static_cast<size_t>(h.low);
+  }
+};
+
+// A streaming 128 bits keyed hash, SipHash-2-4 with 128 bits output.
+// It is faster than MD5 and good for cache keys. By default, the key is
+// picked at random once per process, so colliding inputs can't be made
+// without knowing it.
+class SipHash128 {
+ public:
+  // Uses the per process random key.
+  SipHash128();
+
+  // Uses the key k0, k1. It is for unit-test only.
+  SipHash128(uint64_t k0, uint64_t k1);
+
+  // Updates the context with data.
+  SipHash128& Update(const void* data, size_t size);
+
+  // A helper function for const char*
+  SipHash128& Update(const char* str) { return Update(str, strlen(str)); }
+
+  // A helper function for const string
+  SipHash128& Update(const std::string& str) {
+    return Update(str.data(), str.size());
+  }
+
+  // A helper function for int
+  SipHash128& Update(int d) { return Update(&d, sizeof(d)); }
+
+  // Returns the digest. Update() should not be called after it.
+  Hash128 Digest();
+
+  // A short form of generating the hash for a string
+  Hash128 operator()(const void* data, size_t size);
+
+ private:
+  // The block size of the hash, 8 bytes.
+  static const int kBlockSize = 8;
+
+  // Process a full block.
+  void ProcessBlock(uint64_t m);
+
+  uint64_t v0_;
+  uint64_t v1_;
+  uint64_t v2_;
+  uint64_t v3_;
+  // Total length of the data.
+  uint64_t length_;
+  // The partial block not processed yet.
+  unsigned char tail_[kBlockSize];
+  int tail_size_;
+  // A flag to indicate if Digest is called or not.
+  bool finalized_;
+  // The final digest.
+  Hash128 digest_;
+};
+
+}  // namespace utils
+}  // namespace istio
+
+#endif  // ISTIO_UTILS_HASH128_H_
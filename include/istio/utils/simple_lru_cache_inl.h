@@ -431,6 +431,13 @@ class SimpleLRUCacheBase {
   // Return maximum size of cache
   int64_t MaxSize() const { return max_units_; }
 
+  // Return the number of entries discarded to meet space constraints.
+  int64_t Evictions() const { return evictions_; }
+
+  // Return the number of entries discarded for exceeding their max idle
+  // time or age.
+  int64_t Expirations() const { return expirations_; }
+
   // Return the age (in microseconds) of the least recently used element in
   // the cache.  If the cache is empty, zero (0) is returned.
   int64_t AgeOfLRUItemInMicroseconds() const;
@@ -539,6 +546,8 @@ class SimpleLRUCacheBase {
   Elem head_;             // Dummy head of LRU list (next is mru elem)
   int64_t max_idle_;      // Maximum number of idle cycles
   bool lru_;              // LRU or age-based eviction?
+  int64_t evictions_;     // Entries discarded by GarbageCollect()
+  int64_t expirations_;   // Entries discarded by DiscardIdle()
 
   // Representation invariants:
   // . LRU list is circular doubly-linked list
@@ -588,6 +597,8 @@ SimpleLRUCacheBase<Key, Value, MapType, EQ>::SimpleLRUCacheBase(
   head_.prev = &head_;
   max_idle_ = -1;  // Stands for "no expiration"
   lru_ = true;     // default to LRU, not age-based
+  evictions_ = 0;
+  expirations_ = 0;
 }
 
 template <class Key, class Value, class MapType, class EQ>
@@ -879,6 +890,7 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::GarbageCollect() {
       table_.erase(iter);
       e->Unlink();
       Discard(e);
+      ++evictions_;
     }
     e = prev;
   }
@@ -924,6 +936,7 @@ void SimpleLRUCacheBase<Key, Value, MapType, EQ>::DiscardIdle(
     // age-based mode we push them out of the main table regardless of pinning.
     assert(e->pin == 0 || !lru_);
     Remove(e->key);
+    ++expirations_;
     e = prev;
   }
 }
@@ -35,15 +35,20 @@ Control::Control(const Config& config, Upstream::ClusterManager& cm,
                  }) {
   ::istio::control::http::Controller::Options options(config_.config_pb());
 
-  Utils::CreateEnvironment(dispatcher, random, *check_client_factory_,
-                           *report_client_factory_, &options.env);
+  check_client_.reset(
+      new Utils::SharedAsyncClient(check_client_factory_->create()));
+  report_channel_.reset(
+      new Utils::ReportChannel(*report_client_factory_, dispatcher));
+  Utils::CreateEnvironment(dispatcher, random, *check_client_,
+                           *report_channel_, &options.env);
+  stats_obj_.SetLatencyRecordFuncs(&options.env);
 
   controller_ = ::istio::control::http::Controller::Create(options);
 }
 
 Utils::CheckTransport::Func Control::GetCheckTransport(
     Tracing::Span& parent_span) {
-  return Utils::CheckTransport::GetFunc(*check_client_factory_, parent_span);
+  return Utils::CheckTransport::GetFunc(*check_client_, parent_span);
 }
 
 // Call controller to get statistics.
@@ -49,6 +49,11 @@ class Control final : public ThreadLocal::ThreadLocalObject {
 
   // The mixer config.
   const Config& config_;
+  // The async client shared by Check calls of this worker, and the Report
+  // channel. They have to outlive controller_, and cancel the calls still
+  // in flight when they are destroyed.
+  std::unique_ptr<Utils::SharedAsyncClient> check_client_;
+  std::unique_ptr<Utils::ReportChannel> report_channel_;
   // The mixer control
   std::unique_ptr<::istio::control::http::Controller> controller_;
   // async client factories
@@ -38,7 +38,9 @@ class ControlFactory : public Logger::Loggable<Logger::Id::config> {
       : config_(std::move(config)),
         tls_(context.threadLocal().allocateSlot()),
         stats_{ALL_MIXER_FILTER_STATS(
-            POOL_COUNTER_PREFIX(context.scope(), kHttpStatsPrefix))} {
+            POOL_COUNTER_PREFIX(context.scope(), kHttpStatsPrefix),
+            POOL_GAUGE_PREFIX(context.scope(), kHttpStatsPrefix),
+            POOL_HISTOGRAM_PREFIX(context.scope(), kHttpStatsPrefix))} {
     Upstream::ClusterManager& cm = context.clusterManager();
     Runtime::RandomGenerator& random = context.random();
     Stats::Scope& scope = context.scope();
@@ -38,8 +38,13 @@ Control::Control(const Config& config, Upstream::ClusterManager& cm,
       uuid_(uuid) {
   ::istio::control::tcp::Controller::Options options(config_.config_pb());
 
-  Utils::CreateEnvironment(dispatcher, random, *check_client_factory_,
-                           *report_client_factory_, &options.env);
+  check_client_.reset(
+      new Utils::SharedAsyncClient(check_client_factory_->create()));
+  report_channel_.reset(
+      new Utils::ReportChannel(*report_client_factory_, dispatcher));
+  Utils::CreateEnvironment(dispatcher, random, *check_client_,
+                           *report_channel_, &options.env);
+  stats_obj_.SetLatencyRecordFuncs(&options.env);
 
   controller_ = ::istio::control::tcp::Controller::Create(options);
 }
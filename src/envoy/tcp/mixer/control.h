@@ -21,6 +21,7 @@
 #include "envoy/upstream/cluster_manager.h"
 #include "include/istio/control/tcp/controller.h"
 #include "src/envoy/tcp/mixer/config.h"
+#include "src/envoy/utils/report_channel.h"
 #include "src/envoy/utils/stats.h"
 
 namespace Envoy {
@@ -49,6 +50,11 @@ class Control final : public ThreadLocal::ThreadLocalObject {
 
   // The mixer config.
   const Config& config_;
+  // The async client shared by Check calls of this worker, and the Report
+  // channel. They have to outlive controller_, and cancel the calls still
+  // in flight when they are destroyed.
+  std::unique_ptr<Utils::SharedAsyncClient> check_client_;
+  std::unique_ptr<Utils::ReportChannel> report_channel_;
   // The mixer control
   std::unique_ptr<::istio::control::tcp::Controller> controller_;
 
@@ -52,7 +52,9 @@ class ControlFactory : public Logger::Loggable<Logger::Id::filter> {
   // Generates stats struct.
   static Utils::MixerFilterStats generateStats(const std::string& name,
                                                Stats::Scope& scope) {
-    return {ALL_MIXER_FILTER_STATS(POOL_COUNTER_PREFIX(scope, name))};
+    return {ALL_MIXER_FILTER_STATS(POOL_COUNTER_PREFIX(scope, name),
+                                   POOL_GAUGE_PREFIX(scope, name),
+                                   POOL_HISTOGRAM_PREFIX(scope, name))};
   }
 
   // The config object
@@ -27,6 +27,38 @@ const std::chrono::milliseconds kGrpcRequestTimeoutMs(5000);
 
 }  // namespace
 
+SharedAsyncClient::SharedAsyncClient(Grpc::AsyncClientPtr async_client)
+    : async_client_(std::move(async_client)) {}
+
+SharedAsyncClient::~SharedAsyncClient() {
+  alive_.reset();
+  // Cancelling a call deletes it, and removes it from calls_.
+  while (!calls_.empty()) {
+    calls_.begin()->second->Cancel();
+  }
+}
+
+uint64_t SharedAsyncClient::Add(PendingCall *call) {
+  uint64_t id = next_id_++;
+  calls_[id] = call;
+  return id;
+}
+
+void SharedAsyncClient::Remove(uint64_t id) { calls_.erase(id); }
+
+istio::mixerclient::CancelFunc SharedAsyncClient::GetCancelFunc(uint64_t id) {
+  std::weak_ptr<bool> alive = alive_;
+  return [this, alive, id]() {
+    if (alive.expired()) {
+      return;
+    }
+    auto it = calls_.find(id);
+    if (it != calls_.end()) {
+      it->second->Cancel();
+    }
+  };
+}
+
 template <class RequestType, class ResponseType>
 GrpcTransport<RequestType, ResponseType>::GrpcTransport(
     Grpc::AsyncClientPtr async_client, const RequestType &request,
@@ -35,11 +67,33 @@ GrpcTransport<RequestType, ResponseType>::GrpcTransport(
     : async_client_(std::move(async_client)),
       response_(response),
       on_done_(on_done),
-      request_(async_client_->send(
-          descriptor(), request, *this, parent_span,
-          absl::optional<std::chrono::milliseconds>(kGrpcRequestTimeoutMs))) {
+      request_(Send(*async_client_, request, parent_span)) {}
+
+template <class RequestType, class ResponseType>
+GrpcTransport<RequestType, ResponseType>::GrpcTransport(
+    SharedAsyncClient &shared_client, ResponseType *response,
+    istio::mixerclient::DoneFunc on_done)
+    : shared_client_(&shared_client),
+      id_(shared_client.Add(this)),
+      response_(response),
+      on_done_(on_done) {}
+
+template <class RequestType, class ResponseType>
+GrpcTransport<RequestType, ResponseType>::~GrpcTransport() {
+  if (shared_client_) {
+    shared_client_->Remove(id_);
+  }
+}
+
+template <class RequestType, class ResponseType>
+Grpc::AsyncRequest *GrpcTransport<RequestType, ResponseType>::Send(
+    Grpc::AsyncClient &async_client, const RequestType &request,
+    Tracing::Span &parent_span) {
   ENVOY_LOG(debug, "Sending {} request: {}", descriptor().name(),
             request.DebugString());
+  return async_client.send(
+      descriptor(), request, *this, parent_span,
+      absl::optional<std::chrono::milliseconds>(kGrpcRequestTimeoutMs));
 }
 
 template <class RequestType, class ResponseType>
@@ -65,6 +119,9 @@ void GrpcTransport<RequestType, ResponseType>::onFailure(
 template <class RequestType, class ResponseType>
 void GrpcTransport<RequestType, ResponseType>::Cancel() {
   ENVOY_LOG(debug, "Cancel gRPC request {}", descriptor().name());
+  if (request_) {
+    request_->cancel();
+  }
   delete this;
 }
 
@@ -82,6 +139,28 @@ GrpcTransport<RequestType, ResponseType>::GetFunc(
   };
 }
 
+template <class RequestType, class ResponseType>
+typename GrpcTransport<RequestType, ResponseType>::Func
+GrpcTransport<RequestType, ResponseType>::GetFunc(
+    SharedAsyncClient &shared_client, Tracing::Span &parent_span) {
+  return [&shared_client, &parent_span](const RequestType &request,
+                                        ResponseType *response,
+                                        istio::mixerclient::DoneFunc on_done)
+             -> istio::mixerclient::CancelFunc {
+    auto transport = new GrpcTransport<RequestType, ResponseType>(
+        shared_client, response, on_done);
+    istio::mixerclient::CancelFunc cancel =
+        shared_client.GetCancelFunc(transport->id_);
+    Grpc::AsyncRequest *async_request =
+        transport->Send(shared_client.async_client(), request, parent_span);
+    // If the call failed inline, the transport is already deleted.
+    if (async_request != nullptr) {
+      transport->request_ = async_request;
+    }
+    return cancel;
+  };
+}
+
 template <>
 const google::protobuf::MethodDescriptor &CheckTransport::descriptor() {
   static const google::protobuf::MethodDescriptor *check_descriptor =
@@ -105,6 +184,10 @@ template CheckTransport::Func CheckTransport::GetFunc(
     Grpc::AsyncClientFactory &factory, Tracing::Span &parent_span);
 template ReportTransport::Func ReportTransport::GetFunc(
     Grpc::AsyncClientFactory &factory, Tracing::Span &parent_span);
+template CheckTransport::Func CheckTransport::GetFunc(
+    SharedAsyncClient &shared_client, Tracing::Span &parent_span);
+template ReportTransport::Func ReportTransport::GetFunc(
+    SharedAsyncClient &shared_client, Tracing::Span &parent_span);
 
 }  // namespace Utils
 }  // namespace Envoy
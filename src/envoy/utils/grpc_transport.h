@@ -17,6 +17,7 @@
 
 #include <common/grpc/async_client_impl.h>
 #include <memory>
+#include <unordered_map>
 
 #include "common/common/logger.h"
 #include "envoy/event/dispatcher.h"
@@ -29,9 +30,50 @@
 namespace Envoy {
 namespace Utils {
 
+// A gRPC call in flight.
+class PendingCall {
+ public:
+  virtual ~PendingCall() {}
+
+  // Cancel the call, its done function is not called.
+  virtual void Cancel() = 0;
+};
+
+// An async client shared by the calls of one worker. The calls still in
+// flight when it is destroyed are cancelled, so none of them is left with
+// a destroyed client. Not thread safe, it is used by one worker thread.
+class SharedAsyncClient {
+ public:
+  explicit SharedAsyncClient(Grpc::AsyncClientPtr async_client);
+
+  // Cancel all calls in flight.
+  ~SharedAsyncClient();
+
+  Grpc::AsyncClient& async_client() { return *async_client_; }
+
+  // Track a call in flight, return its id.
+  uint64_t Add(PendingCall* call);
+
+  // Stop tracking a call, when it is done or cancelled.
+  void Remove(uint64_t id);
+
+  // Return a function to cancel the call with id. It does nothing if the
+  // call is done, or if the client is destroyed.
+  istio::mixerclient::CancelFunc GetCancelFunc(uint64_t id);
+
+ private:
+  Grpc::AsyncClientPtr async_client_;
+  // The calls in flight by id.
+  std::unordered_map<uint64_t, PendingCall*> calls_;
+  uint64_t next_id_{0};
+  // Released by the destructor, cancel functions hold a weak reference.
+  std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
+};
+
 // An object to use Envoy::Grpc::AsyncClient to make grpc call.
 template <class RequestType, class ResponseType>
 class GrpcTransport : public Grpc::TypedAsyncRequestCallbacks<ResponseType>,
+                      public PendingCall,
                       public Logger::Loggable<Logger::Id::grpc> {
  public:
   using Func = std::function<istio::mixerclient::CancelFunc(
@@ -41,10 +83,21 @@ class GrpcTransport : public Grpc::TypedAsyncRequestCallbacks<ResponseType>,
   static Func GetFunc(Grpc::AsyncClientFactory& factory,
                       Tracing::Span& parent_span);
 
+  // Send requests with a shared async client, instead of creating one per
+  // request. The shared client has to outlive the function.
+  static Func GetFunc(SharedAsyncClient& shared_client,
+                      Tracing::Span& parent_span);
+
   GrpcTransport(Grpc::AsyncClientPtr async_client, const RequestType& request,
                 ResponseType* response, Tracing::Span& parent_span,
                 istio::mixerclient::DoneFunc on_done);
 
+  // A transport tracked by a shared client. GetFunc() sends its request.
+  GrpcTransport(SharedAsyncClient& shared_client, ResponseType* response,
+                istio::mixerclient::DoneFunc on_done);
+
+  ~GrpcTransport();
+
   void onCreateInitialMetadata(Http::HeaderMap& metadata) override {
     // We generate cluster name contains invalid characters, so override the
     // authority header temorarily until it can be specified via CDS.
@@ -58,12 +111,21 @@ class GrpcTransport : public Grpc::TypedAsyncRequestCallbacks<ResponseType>,
   void onFailure(Grpc::Status::GrpcStatus status, const std::string& message,
                  Tracing::Span& span) override;
 
-  void Cancel();
+  void Cancel() override;
 
  private:
   static const google::protobuf::MethodDescriptor& descriptor();
 
+  // Send the request with the async client.
+  Grpc::AsyncRequest* Send(Grpc::AsyncClient& async_client,
+                           const RequestType& request,
+                           Tracing::Span& parent_span);
+
+  // The async client owned by the transport, if not shared.
   Grpc::AsyncClientPtr async_client_;
+  // The shared client tracking the transport, and its id there.
+  SharedAsyncClient* shared_client_{};
+  uint64_t id_{};
   ResponseType* response_;
   ::istio::mixerclient::DoneFunc on_done_;
   Grpc::AsyncRequest* request_{};
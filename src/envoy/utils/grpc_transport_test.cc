@@ -0,0 +1,203 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/utils/grpc_transport.h"
+#include "test/mocks/grpc/mocks.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::_;
+
+namespace Envoy {
+namespace Utils {
+namespace {
+
+// A mocked async client. It serializes each request as the gRPC client
+// does, and saves the callbacks of the last request to complete it.
+class CheckAsyncClient : public NiceMock<Grpc::MockAsyncClient> {
+ public:
+  CheckAsyncClient(Grpc::AsyncRequestCallbacks** pending) {
+    ON_CALL(*this, send(_, _, _, _, _))
+        .WillByDefault(Invoke(
+            [this, pending](const Protobuf::MethodDescriptor&,
+                            const Protobuf::Message& request,
+                            Grpc::AsyncRequestCallbacks& callbacks,
+                            Tracing::Span&,
+                            const absl::optional<std::chrono::milliseconds>&)
+                -> Grpc::AsyncRequest* {
+              request_data_ = request.SerializeAsString();
+              *pending = &callbacks;
+              return &request_;
+            }));
+  }
+
+ private:
+  std::string request_data_;
+  NiceMock<Grpc::MockAsyncRequest> request_;
+};
+
+// Send Checks with the transport function, each one is completed with an
+// OK response after it is sent. Return the nanoseconds per Check.
+int64_t SendChecks(const CheckTransport::Func& func,
+                   Grpc::AsyncRequestCallbacks** pending) {
+  const int kChecks = 100000;
+  CheckRequest request;
+  request.set_global_word_count(200);
+  request.set_deduplication_id("deduplication-id-1");
+  auto* attributes = request.mutable_attributes();
+  attributes->add_words("reviews.default.svc.cluster.local");
+  (*attributes->mutable_strings())[10] = -1;
+  (*attributes->mutable_int64s())[20] = 8080;
+
+  int done_calls = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kChecks; ++i) {
+    CheckResponse response;
+    func(request, &response,
+         [&done_calls, &response](const Status& status) {
+           EXPECT_TRUE(status.ok());
+           EXPECT_EQ(response.precondition().valid_use_count(), 1000);
+           ++done_calls;
+         });
+    Grpc::AsyncRequestCallbacks* callbacks = *pending;
+    *pending = nullptr;
+    if (callbacks == nullptr) {
+      ADD_FAILURE() << "Check is not sent";
+      break;
+    }
+    std::unique_ptr<CheckResponse> server_response(new CheckResponse);
+    server_response->mutable_precondition()->set_valid_use_count(1000);
+    callbacks->onSuccessUntyped(std::move(server_response),
+                                Tracing::NullSpan::instance());
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+  EXPECT_EQ(done_calls, kChecks);
+  return elapsed / kChecks;
+}
+
+// Measure the per-check cost of sending a Check with an async client
+// created by the factory, which GetFunc(factory) did for each Check,
+// against sharing one client. The clients are mocked, so creating one
+// costs a mock object instead of a Grpc::AsyncClientImpl.
+TEST(GrpcTransportTest, AsyncClientReusePerfTest) {
+  Grpc::AsyncRequestCallbacks* pending = nullptr;
+  NiceMock<Grpc::MockAsyncClientFactory> factory;
+  ON_CALL(factory, create())
+      .WillByDefault(Invoke([&pending]() -> Grpc::AsyncClientPtr {
+        return Grpc::AsyncClientPtr{new CheckAsyncClient(&pending)};
+      }));
+  int64_t create_ns = SendChecks(
+      CheckTransport::GetFunc(factory, Tracing::NullSpan::instance()),
+      &pending);
+
+  SharedAsyncClient shared_client(
+      Grpc::AsyncClientPtr{new CheckAsyncClient(&pending)});
+  int64_t reuse_ns = SendChecks(
+      CheckTransport::GetFunc(shared_client, Tracing::NullSpan::instance()),
+      &pending);
+
+  std::cerr << "===Check transport, create async client: " << create_ns
+            << " ns, reuse: " << reuse_ns << " ns per check" << std::endl;
+}
+
+// A mocked async client keeping the callbacks of all requests.
+class PendingAsyncClient : public NiceMock<Grpc::MockAsyncClient> {
+ public:
+  PendingAsyncClient(std::vector<Grpc::AsyncRequestCallbacks*>* pending,
+                     Grpc::MockAsyncRequest* request) {
+    ON_CALL(*this, send(_, _, _, _, _))
+        .WillByDefault(Invoke(
+            [pending, request](
+                const Protobuf::MethodDescriptor&, const Protobuf::Message&,
+                Grpc::AsyncRequestCallbacks& callbacks, Tracing::Span&,
+                const absl::optional<std::chrono::milliseconds>&)
+                -> Grpc::AsyncRequest* {
+              pending->push_back(&callbacks);
+              return request;
+            }));
+  }
+};
+
+TEST(GrpcTransportTest, CancelSharedClientCall) {
+  std::vector<Grpc::AsyncRequestCallbacks*> pending;
+  Grpc::MockAsyncRequest request;
+  SharedAsyncClient shared_client(
+      Grpc::AsyncClientPtr{new PendingAsyncClient(&pending, &request)});
+  auto func =
+      CheckTransport::GetFunc(shared_client, Tracing::NullSpan::instance());
+
+  CheckRequest check_request;
+  CheckResponse response;
+  int done_calls = 0;
+  auto on_done = [&done_calls](const Status&) { ++done_calls; };
+  auto cancel1 = func(check_request, &response, on_done);
+  auto cancel2 = func(check_request, &response, on_done);
+  ASSERT_EQ(pending.size(), 2);
+
+  // Cancel a call in flight.
+  EXPECT_CALL(request, cancel()).Times(1);
+  cancel1();
+  ::testing::Mock::VerifyAndClearExpectations(&request);
+
+  // Cancel a done call, or cancel twice, does nothing.
+  std::unique_ptr<CheckResponse> check_response(new CheckResponse);
+  pending[1]->onSuccessUntyped(std::move(check_response),
+                               Tracing::NullSpan::instance());
+  EXPECT_EQ(done_calls, 1);
+  EXPECT_CALL(request, cancel()).Times(0);
+  cancel1();
+  cancel2();
+}
+
+TEST(GrpcTransportTest, DestroySharedClientCancelsCalls) {
+  std::vector<Grpc::AsyncRequestCallbacks*> pending;
+  Grpc::MockAsyncRequest request;
+  std::unique_ptr<SharedAsyncClient> shared_client(new SharedAsyncClient(
+      Grpc::AsyncClientPtr{new PendingAsyncClient(&pending, &request)}));
+  auto func =
+      CheckTransport::GetFunc(*shared_client, Tracing::NullSpan::instance());
+
+  CheckRequest check_request;
+  CheckResponse response;
+  int done_calls = 0;
+  auto on_done = [&done_calls](const Status&) { ++done_calls; };
+  auto cancel = func(check_request, &response, on_done);
+  func(check_request, &response, on_done);
+  ASSERT_EQ(pending.size(), 2);
+
+  // The calls in flight are cancelled, without calling their done
+  // functions.
+  EXPECT_CALL(request, cancel()).Times(2);
+  shared_client.reset();
+  ::testing::Mock::VerifyAndClearExpectations(&request);
+  EXPECT_EQ(done_calls, 0);
+
+  // Cancel after the client is destroyed does nothing.
+  EXPECT_CALL(request, cancel()).Times(0);
+  cancel();
+}
+
+}  // namespace
+}  // namespace Utils
+}  // namespace Envoy
@@ -58,13 +58,12 @@ class EnvoyGrpcAsyncClientFactory : public Grpc::AsyncClientFactory {
 // Create all environment functions for mixerclient
 void CreateEnvironment(Event::Dispatcher &dispatcher,
                        Runtime::RandomGenerator &random,
-                       Grpc::AsyncClientFactory &check_client_factory,
-                       Grpc::AsyncClientFactory &report_client_factory,
+                       SharedAsyncClient &check_client,
+                       ReportChannel &report_channel,
                        ::istio::mixerclient::Environment *env) {
-  env->check_transport = CheckTransport::GetFunc(check_client_factory,
-                                                 Tracing::NullSpan::instance());
-  env->report_transport = ReportTransport::GetFunc(
-      report_client_factory, Tracing::NullSpan::instance());
+  env->check_transport =
+      CheckTransport::GetFunc(check_client, Tracing::NullSpan::instance());
+  env->report_transport = report_channel.GetFunc();
 
   env->timer_create_func = [&dispatcher](std::function<void()> timer_cb)
       -> std::unique_ptr<::istio::mixerclient::Timer> {
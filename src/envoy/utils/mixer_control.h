@@ -20,6 +20,7 @@
 #include "envoy/upstream/cluster_manager.h"
 #include "include/istio/mixerclient/client.h"
 #include "src/envoy/utils/config.h"
+#include "src/envoy/utils/report_channel.h"
 
 namespace Envoy {
 namespace Utils {
@@ -27,8 +28,8 @@ namespace Utils {
 // Create all environment functions for mixerclient
 void CreateEnvironment(Event::Dispatcher &dispatcher,
                        Runtime::RandomGenerator &random,
-                       Grpc::AsyncClientFactory &check_client_factory,
-                       Grpc::AsyncClientFactory &report_client_factory,
+                       SharedAsyncClient &check_client,
+                       ReportChannel &report_channel,
                        ::istio::mixerclient::Environment *env);
 
 Grpc::AsyncClientFactoryPtr GrpcClientFactoryForCluster(
@@ -0,0 +1,132 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/utils/report_channel.h"
+
+#include <algorithm>
+
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::ReportRequest;
+using ::istio::mixer::v1::ReportResponse;
+using StatusCode = ::google::protobuf::util::error::Code;
+
+namespace Envoy {
+namespace Utils {
+namespace {
+
+// The backoff after the first failure, doubled on each failure.
+const std::chrono::milliseconds kInitialBackoff(100);
+const std::chrono::milliseconds kMaxBackoff(10000);
+
+// Maximum bytes of requests held while backing off, same as the default
+// Report backlog. More calls fail right away.
+const size_t kMaxHeldBytes = 16 * 1024 * 1024;
+
+// Return true if the call failed because Mixer is not reachable.
+bool IsConnectionError(const Status &status) {
+  return status.error_code() == StatusCode::UNAVAILABLE ||
+         status.error_code() == StatusCode::DEADLINE_EXCEEDED;
+}
+
+}  // namespace
+
+ReportChannel::ReportChannel(Grpc::AsyncClientFactory &factory,
+                             Event::Dispatcher &dispatcher)
+    : async_client_(factory.create()),
+      send_func_(ReportTransport::GetFunc(async_client_,
+                                          Tracing::NullSpan::instance())),
+      retry_timer_(dispatcher.createTimer([this]() { OnRetryTimer(); })) {}
+
+ReportTransport::Func ReportChannel::GetFunc() {
+  return [this](const ReportRequest &request, ReportResponse *response,
+                istio::mixerclient::DoneFunc on_done)
+             -> istio::mixerclient::CancelFunc {
+    return Send(request, response, on_done);
+  };
+}
+
+istio::mixerclient::CancelFunc ReportChannel::Send(
+    const ReportRequest &request, ReportResponse *response,
+    istio::mixerclient::DoneFunc on_done) {
+  if (!backing_off_) {
+    return SendNow(request, response, on_done);
+  }
+  size_t byte_size = request.ByteSizeLong();
+  if (held_bytes_ + byte_size > kMaxHeldBytes) {
+    on_done(Status(StatusCode::UNAVAILABLE, "Mixer Report is backing off"));
+    return nullptr;
+  }
+  uint64_t id = next_held_id_++;
+  auto sent_cancel = std::make_shared<istio::mixerclient::CancelFunc>();
+  held_bytes_ += byte_size;
+  held_calls_.push_back(
+      {id, byte_size, request, response, on_done, sent_cancel});
+  std::weak_ptr<bool> alive = alive_;
+  return [this, alive, id, sent_cancel]() {
+    if (*sent_cancel) {
+      (*sent_cancel)();
+    } else if (!alive.expired()) {
+      CancelHeld(id);
+    }
+  };
+}
+
+istio::mixerclient::CancelFunc ReportChannel::SendNow(
+    const ReportRequest &request, ReportResponse *response,
+    istio::mixerclient::DoneFunc on_done) {
+  // Calls still in flight are cancelled when the channel is destroyed.
+  return send_func_(request, response, [this, on_done](const Status &status) {
+    OnDone(status);
+    on_done(status);
+  });
+}
+
+void ReportChannel::OnDone(const Status &status) {
+  if (!IsConnectionError(status)) {
+    backoff_ = std::chrono::milliseconds(0);
+    return;
+  }
+  if (backing_off_) {
+    return;
+  }
+  backoff_ = backoff_.count() == 0 ? kInitialBackoff
+                                   : std::min(backoff_ * 2, kMaxBackoff);
+  ENVOY_LOG(debug, "Report failed, backing off for {} ms", backoff_.count());
+  backing_off_ = true;
+  retry_timer_->enableTimer(backoff_);
+}
+
+void ReportChannel::OnRetryTimer() {
+  backing_off_ = false;
+  // Stop if a call fails right away, the rest stay held.
+  while (!held_calls_.empty() && !backing_off_) {
+    HeldCall held = std::move(held_calls_.front());
+    held_calls_.pop_front();
+    held_bytes_ -= held.byte_size;
+    *held.sent_cancel = SendNow(held.request, held.response, held.on_done);
+  }
+}
+
+void ReportChannel::CancelHeld(uint64_t id) {
+  auto it = std::find_if(held_calls_.begin(), held_calls_.end(),
+                         [id](const HeldCall &held) { return held.id == id; });
+  if (it != held_calls_.end()) {
+    held_bytes_ -= it->byte_size;
+    held_calls_.erase(it);
+  }
+}
+
+}  // namespace Utils
+}  // namespace Envoy
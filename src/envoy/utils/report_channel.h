@@ -0,0 +1,107 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <memory>
+
+#include "common/common/logger.h"
+#include "envoy/event/dispatcher.h"
+#include "envoy/event/timer.h"
+#include "envoy/grpc/async_client.h"
+#include "src/envoy/utils/grpc_transport.h"
+
+namespace Envoy {
+namespace Utils {
+
+// A long-lived Report channel per worker thread. All Report calls share
+// one async client instead of creating one per flush, and are pipelined
+// on the cluster connection. After a call fails because Mixer is not
+// reachable, new calls are held and sent after an exponential backoff.
+// When the channel is destroyed, held calls are dropped and calls in
+// flight are cancelled, without calling their done functions.
+class ReportChannel : public Logger::Loggable<Logger::Id::grpc> {
+ public:
+  ReportChannel(Grpc::AsyncClientFactory& factory,
+                Event::Dispatcher& dispatcher);
+
+  // Get the report transport function sending calls to this channel.
+  // The channel has to outlive the function.
+  ReportTransport::Func GetFunc();
+
+ private:
+  // Send a call, or hold it while backing off.
+  istio::mixerclient::CancelFunc Send(
+      const istio::mixer::v1::ReportRequest& request,
+      istio::mixer::v1::ReportResponse* response,
+      istio::mixerclient::DoneFunc on_done);
+
+  // Send a call with the async client.
+  istio::mixerclient::CancelFunc SendNow(
+      const istio::mixer::v1::ReportRequest& request,
+      istio::mixer::v1::ReportResponse* response,
+      istio::mixerclient::DoneFunc on_done);
+
+  // Update the backoff with the status of a call.
+  void OnDone(const ::google::protobuf::util::Status& status);
+
+  // Send the held calls when the backoff expires.
+  void OnRetryTimer();
+
+  // Drop a held call.
+  void CancelHeld(uint64_t id);
+
+  // The async client shared by all calls.
+  SharedAsyncClient async_client_;
+
+  // Sends calls with async_client_.
+  ReportTransport::Func send_func_;
+
+  // The timer to end the backoff.
+  Event::TimerPtr retry_timer_;
+
+  // The current backoff, 0 if Mixer is reachable.
+  std::chrono::milliseconds backoff_{0};
+
+  // True while held calls wait for the retry timer.
+  bool backing_off_{false};
+
+  // A call held while backing off.
+  struct HeldCall {
+    uint64_t id;
+    size_t byte_size;
+    istio::mixer::v1::ReportRequest request;
+    istio::mixer::v1::ReportResponse* response;
+    istio::mixerclient::DoneFunc on_done;
+    // Set to the call cancel function once the call is sent.
+    std::shared_ptr<istio::mixerclient::CancelFunc> sent_cancel;
+  };
+  std::deque<HeldCall> held_calls_;
+
+  // The total request size of the held calls.
+  size_t held_bytes_{0};
+
+  // The id of the next held call.
+  uint64_t next_held_id_{0};
+
+  // Released when the channel is destroyed. Cancel functions of held calls
+  // hold a weak reference so they don't touch the channel after that.
+  std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
+};
+
+}  // namespace Utils
+}  // namespace Envoy
@@ -0,0 +1,184 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/envoy/utils/report_channel.h"
+#include "test/mocks/event/mocks.h"
+#include "test/mocks/grpc/mocks.h"
+
+#include <vector>
+
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::ReportRequest;
+using ::istio::mixer::v1::ReportResponse;
+using ::testing::Invoke;
+using ::testing::NiceMock;
+using ::testing::_;
+using StatusCode = ::google::protobuf::util::error::Code;
+
+namespace Envoy {
+namespace Utils {
+namespace {
+
+// A mocked async client keeping the callbacks of all requests.
+class PendingAsyncClient : public NiceMock<Grpc::MockAsyncClient> {
+ public:
+  PendingAsyncClient(std::vector<Grpc::AsyncRequestCallbacks*>* pending,
+                     Grpc::MockAsyncRequest* request) {
+    ON_CALL(*this, send(_, _, _, _, _))
+        .WillByDefault(Invoke(
+            [pending, request](
+                const Protobuf::MethodDescriptor&, const Protobuf::Message&,
+                Grpc::AsyncRequestCallbacks& callbacks, Tracing::Span&,
+                const absl::optional<std::chrono::milliseconds>&)
+                -> Grpc::AsyncRequest* {
+              pending->push_back(&callbacks);
+              return request;
+            }));
+  }
+};
+
+class ReportChannelTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    timer_ = new Event::MockTimer(&dispatcher_);
+    EXPECT_CALL(factory_, create()).WillOnce(Invoke([this]() {
+      return Grpc::AsyncClientPtr{
+          new PendingAsyncClient(&pending_, &request_)};
+    }));
+    channel_.reset(new ReportChannel(factory_, dispatcher_));
+    func_ = channel_->GetFunc();
+  }
+
+  istio::mixerclient::CancelFunc Send(const ReportRequest& request) {
+    return func_(request, &response_, [this](const Status& status) {
+      statuses_.push_back(static_cast<StatusCode>(status.error_code()));
+    });
+  }
+
+  void Succeed(size_t index) {
+    std::unique_ptr<ReportResponse> response(new ReportResponse);
+    pending_[index]->onSuccessUntyped(std::move(response),
+                                      Tracing::NullSpan::instance());
+  }
+
+  void Fail(size_t index) {
+    pending_[index]->onFailure(Grpc::Status::GrpcStatus::Unavailable,
+                               "unavailable", Tracing::NullSpan::instance());
+  }
+
+  // Fail a call to start backing off for the initial 100 ms.
+  void StartBackoff() {
+    Send(request_data_);
+    EXPECT_CALL(*timer_, enableTimer(std::chrono::milliseconds(100)));
+    Fail(pending_.size() - 1);
+  }
+
+  Event::MockDispatcher dispatcher_;
+  Event::MockTimer* timer_;
+  Grpc::MockAsyncClientFactory factory_;
+  NiceMock<Grpc::MockAsyncRequest> request_;
+  std::vector<Grpc::AsyncRequestCallbacks*> pending_;
+  std::unique_ptr<ReportChannel> channel_;
+  ReportTransport::Func func_;
+  ReportRequest request_data_;
+  ReportResponse response_;
+  std::vector<StatusCode> statuses_;
+};
+
+TEST_F(ReportChannelTest, TestBackoff) {
+  StartBackoff();
+
+  // Calls are held while backing off.
+  Send(request_data_);
+  Send(request_data_);
+  EXPECT_EQ(pending_.size(), 1);
+
+  // The held calls are sent when the backoff expires.
+  timer_->callback_();
+  ASSERT_EQ(pending_.size(), 3);
+
+  // The backoff doubles on the next failure, only once for both calls.
+  EXPECT_CALL(*timer_, enableTimer(std::chrono::milliseconds(200)));
+  Fail(1);
+  Fail(2);
+  ::testing::Mock::VerifyAndClearExpectations(timer_);
+
+  // A call sent after the backoff resets it.
+  timer_->callback_();
+  Send(request_data_);
+  Succeed(3);
+  StartBackoff();
+
+  EXPECT_EQ(statuses_,
+            std::vector<StatusCode>({StatusCode::UNAVAILABLE,
+                                     StatusCode::UNAVAILABLE,
+                                     StatusCode::UNAVAILABLE, StatusCode::OK,
+                                     StatusCode::UNAVAILABLE}));
+}
+
+TEST_F(ReportChannelTest, TestCancelHeldCall) {
+  StartBackoff();
+  auto cancel1 = Send(request_data_);
+  auto cancel2 = Send(request_data_);
+  ASSERT_TRUE(cancel1 != nullptr);
+
+  // A cancelled held call is never sent nor done.
+  cancel1();
+  timer_->callback_();
+  ASSERT_EQ(pending_.size(), 2);
+
+  // Cancelling a held call after it is sent cancels the request.
+  EXPECT_CALL(request_, cancel());
+  cancel2();
+  EXPECT_EQ(statuses_, std::vector<StatusCode>({StatusCode::UNAVAILABLE}));
+}
+
+TEST_F(ReportChannelTest, TestMaxHeldBytes) {
+  StartBackoff();
+  Send(request_data_);
+
+  // A call making the held calls larger than 16 MB fails right away.
+  ReportRequest large_request;
+  large_request.add_default_words(std::string(16 * 1024 * 1024, 'a'));
+  Send(large_request);
+  EXPECT_EQ(pending_.size(), 1);
+  EXPECT_EQ(statuses_, std::vector<StatusCode>({StatusCode::UNAVAILABLE,
+                                                StatusCode::UNAVAILABLE}));
+
+  // The held call is still sent.
+  timer_->callback_();
+  EXPECT_EQ(pending_.size(), 2);
+}
+
+TEST_F(ReportChannelTest, TestDestroyChannel) {
+  Send(request_data_);
+  StartBackoff();
+  auto cancel_held = Send(request_data_);
+  ASSERT_EQ(pending_.size(), 2);
+
+  // The call in flight is cancelled and the held call is dropped, neither
+  // is done.
+  EXPECT_CALL(request_, cancel());
+  channel_.reset();
+  ::testing::Mock::VerifyAndClearExpectations(&request_);
+  EXPECT_EQ(statuses_, std::vector<StatusCode>({StatusCode::UNAVAILABLE}));
+
+  // Cancel after the channel is destroyed does nothing.
+  cancel_held();
+}
+
+}  // namespace
+}  // namespace Utils
+}  // namespace Envoy
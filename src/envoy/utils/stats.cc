@@ -24,6 +24,16 @@ namespace {
 // The time interval for envoy stats update.
 const int kStatsUpdateIntervalInMs = 10000;
 
+// Changes a gauge shared by all workers by the change of the value of one
+// worker.
+void UpdateGauge(Stats::Gauge& gauge, uint64_t old_value, uint64_t new_value) {
+  if (new_value > old_value) {
+    gauge.add(new_value - old_value);
+  } else if (new_value < old_value) {
+    gauge.sub(old_value - new_value);
+  }
+}
+
 }  // namespace
 
 MixerStatsObject::MixerStatsObject(Event::Dispatcher& dispatcher,
@@ -44,6 +54,25 @@ MixerStatsObject::MixerStatsObject(Event::Dispatcher& dispatcher,
   }
 }
 
+MixerStatsObject::~MixerStatsObject() {
+  UpdateGauge(stats_.check_cache_entries_, old_stats_.check_cache_entries, 0);
+  UpdateGauge(stats_.quota_cache_entries_, old_stats_.quota_cache_entries, 0);
+}
+
+void MixerStatsObject::SetLatencyRecordFuncs(
+    ::istio::mixerclient::Environment* env) {
+  MixerFilterStats& stats = stats_;
+  env->check_latency_func = [&stats](int64_t latency_us) {
+    stats.check_latency_us_.recordValue(latency_us);
+  };
+  env->quota_latency_func = [&stats](int64_t latency_us) {
+    stats.quota_latency_us_.recordValue(latency_us);
+  };
+  env->report_latency_func = [&stats](int64_t latency_us) {
+    stats.report_latency_us_.recordValue(latency_us);
+  };
+}
+
 void MixerStatsObject::OnTimer() {
   ::istio::mixerclient::Statistics new_stats;
   bool get_stats = get_stats_func_(&new_stats);
@@ -70,6 +99,11 @@ void MixerStatsObject::CheckAndUpdateStats(
         new_stats.total_blocking_remote_check_calls -
         old_stats_.total_blocking_remote_check_calls);
   }
+  if (new_stats.total_refresh_check_calls >
+      old_stats_.total_refresh_check_calls) {
+    stats_.total_refresh_check_calls_.add(new_stats.total_refresh_check_calls -
+                                          old_stats_.total_refresh_check_calls);
+  }
   if (new_stats.total_quota_calls > old_stats_.total_quota_calls) {
     stats_.total_quota_calls_.add(new_stats.total_quota_calls -
                                   old_stats_.total_quota_calls);
@@ -94,10 +128,85 @@ void MixerStatsObject::CheckAndUpdateStats(
     stats_.total_remote_report_calls_.add(new_stats.total_remote_report_calls -
                                           old_stats_.total_remote_report_calls);
   }
+  if (new_stats.total_report_batch_size_1 >
+      old_stats_.total_report_batch_size_1) {
+    stats_.total_report_batch_size_1_.add(new_stats.total_report_batch_size_1 -
+                                          old_stats_.total_report_batch_size_1);
+  }
+  if (new_stats.total_report_batch_size_2_to_10 >
+      old_stats_.total_report_batch_size_2_to_10) {
+    stats_.total_report_batch_size_2_to_10_.add(
+        new_stats.total_report_batch_size_2_to_10 -
+        old_stats_.total_report_batch_size_2_to_10);
+  }
+  if (new_stats.total_report_batch_size_11_to_100 >
+      old_stats_.total_report_batch_size_11_to_100) {
+    stats_.total_report_batch_size_11_to_100_.add(
+        new_stats.total_report_batch_size_11_to_100 -
+        old_stats_.total_report_batch_size_11_to_100);
+  }
+  if (new_stats.total_report_batch_size_101_to_1000 >
+      old_stats_.total_report_batch_size_101_to_1000) {
+    stats_.total_report_batch_size_101_to_1000_.add(
+        new_stats.total_report_batch_size_101_to_1000 -
+        old_stats_.total_report_batch_size_101_to_1000);
+  }
+  if (new_stats.total_report_batch_size_over_1000 >
+      old_stats_.total_report_batch_size_over_1000) {
+    stats_.total_report_batch_size_over_1000_.add(
+        new_stats.total_report_batch_size_over_1000 -
+        old_stats_.total_report_batch_size_over_1000);
+  }
+  if (new_stats.total_dropped_reports > old_stats_.total_dropped_reports) {
+    stats_.total_dropped_reports_.add(new_stats.total_dropped_reports -
+                                      old_stats_.total_dropped_reports);
+  }
+  if (new_stats.total_check_cache_evictions >
+      old_stats_.total_check_cache_evictions) {
+    stats_.total_check_cache_evictions_.add(
+        new_stats.total_check_cache_evictions -
+        old_stats_.total_check_cache_evictions);
+  }
+  if (new_stats.total_check_cache_expirations >
+      old_stats_.total_check_cache_expirations) {
+    stats_.total_check_cache_expirations_.add(
+        new_stats.total_check_cache_expirations -
+        old_stats_.total_check_cache_expirations);
+  }
+  if (new_stats.total_quota_cache_evictions >
+      old_stats_.total_quota_cache_evictions) {
+    stats_.total_quota_cache_evictions_.add(
+        new_stats.total_quota_cache_evictions -
+        old_stats_.total_quota_cache_evictions);
+  }
+  if (new_stats.total_quota_cache_expirations >
+      old_stats_.total_quota_cache_expirations) {
+    stats_.total_quota_cache_expirations_.add(
+        new_stats.total_quota_cache_expirations -
+        old_stats_.total_quota_cache_expirations);
+  }
+  UpdateGauges(new_stats);
 
   // Copy new_stats to old_stats_ for next stats update.
   old_stats_ = new_stats;
 }
 
+void MixerStatsObject::UpdateGauges(
+    const ::istio::mixerclient::Statistics& new_stats) {
+  UpdateGauge(stats_.check_cache_entries_, old_stats_.check_cache_entries,
+              new_stats.check_cache_entries);
+  UpdateGauge(stats_.quota_cache_entries_, old_stats_.quota_cache_entries,
+              new_stats.quota_cache_entries);
+  // The LRU ages of the workers can't be added, each one is a sample.
+  if (new_stats.check_cache_entries > 0) {
+    stats_.check_cache_lru_age_ms_.recordValue(
+        new_stats.check_cache_lru_age_ms);
+  }
+  if (new_stats.quota_cache_entries > 0) {
+    stats_.quota_cache_lru_age_ms_.recordValue(
+        new_stats.quota_cache_lru_age_ms);
+  }
+}
+
 }  // namespace Utils
 }  // namespace Envoy
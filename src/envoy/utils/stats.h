@@ -27,34 +27,63 @@ namespace Utils {
  * All mixer filter stats. @see stats_macros.h
  */
 // clang-format off
-#define ALL_MIXER_FILTER_STATS(COUNTER)                                       \
+#define ALL_MIXER_FILTER_STATS(COUNTER, GAUGE, HISTOGRAM)                     \
   COUNTER(total_check_calls)                                                  \
   COUNTER(total_remote_check_calls)                                           \
   COUNTER(total_blocking_remote_check_calls)                                  \
+  COUNTER(total_refresh_check_calls)                                          \
   COUNTER(total_quota_calls)                                                  \
   COUNTER(total_remote_quota_calls)                                           \
   COUNTER(total_blocking_remote_quota_calls)                                  \
   COUNTER(total_report_calls)                                                 \
-  COUNTER(total_remote_report_calls)
+  COUNTER(total_remote_report_calls)                                          \
+  COUNTER(total_report_batch_size_1)                                          \
+  COUNTER(total_report_batch_size_2_to_10)                                    \
+  COUNTER(total_report_batch_size_11_to_100)                                  \
+  COUNTER(total_report_batch_size_101_to_1000)                                \
+  COUNTER(total_report_batch_size_over_1000)                                  \
+  COUNTER(total_dropped_reports)                                              \
+  COUNTER(total_check_cache_evictions)                                        \
+  COUNTER(total_check_cache_expirations)                                      \
+  COUNTER(total_quota_cache_evictions)                                        \
+  COUNTER(total_quota_cache_expirations)                                      \
+  GAUGE(check_cache_entries)                                                  \
+  GAUGE(quota_cache_entries)                                                  \
+  HISTOGRAM(check_cache_lru_age_ms)                                           \
+  HISTOGRAM(quota_cache_lru_age_ms)                                           \
+  HISTOGRAM(check_latency_us)                                                 \
+  HISTOGRAM(quota_latency_us)                                                 \
+  HISTOGRAM(report_latency_us)
 // clang-format on
 
 /**
  * Struct definition for all mixer filter stats. @see stats_macros.h
  */
 struct MixerFilterStats {
-  ALL_MIXER_FILTER_STATS(GENERATE_COUNTER_STRUCT)
+  ALL_MIXER_FILTER_STATS(GENERATE_COUNTER_STRUCT, GENERATE_GAUGE_STRUCT,
+                         GENERATE_HISTOGRAM_STRUCT)
 };
 
 typedef std::function<bool(::istio::mixerclient::Statistics* s)> GetStatsFunc;
 
 // MixerStatsObject maintains statistics for number of check, quota and report
-// calls issued by a mixer filter.
+// calls issued by a mixer filter, their latencies and the cache counters.
+// There is one per worker, all updating the same MixerFilterStats: counters
+// and gauges are changed by the deltas of this worker, and histograms get
+// the samples of this worker.
 class MixerStatsObject {
  public:
   MixerStatsObject(Event::Dispatcher& dispatcher, MixerFilterStats& stats,
                    ::google::protobuf::Duration update_interval,
                    GetStatsFunc func);
 
+  // Removes the cache entries of this worker from the gauges.
+  ~MixerStatsObject();
+
+  // Sets the environment functions recording the latency of each Mixer call
+  // into the latency histograms.
+  void SetLatencyRecordFuncs(::istio::mixerclient::Environment* env);
+
  private:
   // This function is invoked when timer event fires.
   void OnTimer();
@@ -62,6 +91,9 @@ class MixerStatsObject {
   // Compares old stats with new stats and updates envoy stats.
   void CheckAndUpdateStats(const ::istio::mixerclient::Statistics& new_stats);
 
+  // Updates the gauges and histograms from new stats.
+  void UpdateGauges(const ::istio::mixerclient::Statistics& new_stats);
+
   // A set of Envoy stats for the number of check, quota and report calls.
   MixerFilterStats& stats_;
   // Stores a function which gets statistics from mixer controller.
@@ -18,9 +18,14 @@
 #include "src/istio/mixerclient/delta_update.h"
 #include "src/istio/mixerclient/global_dictionary.h"
 
+#include "google/protobuf/io/coded_stream.h"
+
+#include <unordered_map>
+
 using ::istio::mixer::v1::Attributes;
 using ::istio::mixer::v1::Attributes_AttributeValue;
 using ::istio::mixer::v1::Attributes_StringMap;
+using ::google::protobuf::io::CodedOutputStream;
 using ::istio::mixer::v1::CompressedAttributes;
 
 namespace istio {
@@ -34,6 +39,11 @@ const int kGlobalDictionaryBaseSize = 111;
 // Return per message dictionary index.
 int MessageDictIndex(int idx) { return -(idx + 1); }
 
+// Return the encoded size of a length delimited field with a one byte tag.
+size_t FieldByteSize(size_t size) {
+  return 1 + CodedOutputStream::VarintSize64(size) + size;
+}
+
 // Per message dictionary.
 class MessageDictionary {
  public:
@@ -57,6 +67,19 @@ class MessageDictionary {
     return MessageDictIndex(index);
   }
 
+  // Lookup the index without adding the name, return true if found.
+  bool FindIndex(const std::string& name, int* index) const {
+    if (global_dict_.GetIndex(name, index)) {
+      return true;
+    }
+    const auto& message_it = message_dict_.find(name);
+    if (message_it != message_dict_.end()) {
+      *index = MessageDictIndex(message_it->second);
+      return true;
+    }
+    return false;
+  }
+
   const std::vector<std::string>& GetWords() const { return message_words_; }
 
  private:
@@ -67,14 +90,13 @@ class MessageDictionary {
   std::unordered_map<std::string, int> message_dict_;
 };
 
-::istio::mixer::v1::StringMap CreateStringMap(
-    const Attributes_StringMap& raw_map, MessageDictionary& dict) {
-  ::istio::mixer::v1::StringMap compressed_map;
-  auto* map_pb = compressed_map.mutable_entries();
+void FillStringMap(const Attributes_StringMap& raw_map,
+                   MessageDictionary& dict,
+                   ::istio::mixer::v1::StringMap* compressed_map) {
+  auto* map_pb = compressed_map->mutable_entries();
   for (const auto& it : raw_map.entries()) {
     (*map_pb)[dict.GetIndex(it.first)] = dict.GetIndex(it.second);
   }
-  return compressed_map;
 }
 
 bool CompressByDict(const Attributes& attributes, MessageDictionary& dict,
@@ -117,8 +139,8 @@ bool CompressByDict(const Attributes& attributes, MessageDictionary& dict,
         (*pb->mutable_durations())[index] = value.duration_value();
         break;
       case Attributes_AttributeValue::kStringMapValue:
-        (*pb->mutable_string_maps())[index] =
-            CreateStringMap(value.string_map_value(), dict);
+        FillStringMap(value.string_map_value(), dict,
+                      &(*pb->mutable_string_maps())[index]);
         break;
       case Attributes_AttributeValue::VALUE_NOT_SET:
         break;
@@ -135,19 +157,42 @@ class BatchCompressorImpl : public BatchCompressor {
         delta_update_(DeltaUpdate::Create()),
         report_(new ::istio::mixer::v1::ReportRequest) {
     report_->set_global_word_count(global_dict.size());
+    byte_size_ = report_->ByteSizeLong();
   }
 
   bool Add(const Attributes& attributes) override {
+    size_t word_count = dict_.GetWords().size();
     CompressedAttributes pb;
-    if (!CompressByDict(attributes, dict_, *delta_update_, &pb)) {
+    bool ok = CompressByDict(attributes, dict_, *delta_update_, &pb);
+    // New words are in the request even if the attributes are not added.
+    const auto& words = dict_.GetWords();
+    for (size_t i = word_count; i < words.size(); ++i) {
+      byte_size_ += FieldByteSize(words[i].size());
+    }
+    if (!ok) {
       return false;
     }
+    byte_size_ += FieldByteSize(pb.ByteSizeLong());
     pb.GetReflection()->Swap(report_->add_attributes(), &pb);
     return true;
   }
 
+  bool CanAdd(const Attributes& attributes) const override {
+    size_t count = 0;
+    for (const auto& it : attributes.attributes()) {
+      int index;
+      if (dict_.FindIndex(it.first, &index) &&
+          delta_update_->Contains(index)) {
+        ++count;
+      }
+    }
+    return count == delta_update_->size();
+  }
+
   int size() const override { return report_->attributes_size(); }
 
+  size_t byte_size() const override { return byte_size_; }
+
   std::unique_ptr<::istio::mixer::v1::ReportRequest> Finish() override {
     for (const std::string& word : dict_.GetWords()) {
       report_->add_default_words(word);
@@ -159,24 +204,21 @@ class BatchCompressorImpl : public BatchCompressor {
   MessageDictionary dict_;
   std::unique_ptr<DeltaUpdate> delta_update_;
   std::unique_ptr<::istio::mixer::v1::ReportRequest> report_;
+
+  // The encoded size of the request Finish() will return.
+  size_t byte_size_;
 };
 
 }  // namespace
 
-GlobalDictionary::GlobalDictionary() {
-  const std::vector<std::string>& global_words = GetGlobalWords();
-  for (unsigned int i = 0; i < global_words.size(); i++) {
-    global_dict_[global_words[i]] = i;
-  }
-  top_index_ = global_words.size();
-}
+GlobalDictionary::GlobalDictionary() : top_index_(GetGlobalWords().size()) {}
 
 // Lookup the index, return true if found.
-bool GlobalDictionary::GetIndex(const std::string name, int* index) const {
-  const auto& it = global_dict_.find(name);
-  if (it != global_dict_.end() && it->second < top_index_) {
+bool GlobalDictionary::GetIndex(const std::string& name, int* index) const {
+  int global_index = FindGlobalWord(name);
+  if (global_index >= 0 && global_index < top_index_) {
     // Return global dictionary index.
-    *index = it->second;
+    *index = global_index;
     return true;
   }
   return false;
@@ -194,9 +236,11 @@ void AttributeCompressor::Compress(
     const Attributes& attributes,
     ::istio::mixer::v1::CompressedAttributes* pb) const {
   MessageDictionary dict(global_dict_);
-  std::unique_ptr<DeltaUpdate> delta_update = DeltaUpdate::CreateNoOp();
+  // The no-op delta update is stateless, share one instance.
+  static DeltaUpdate* no_op_delta_update =
+      DeltaUpdate::CreateNoOp().release();
 
-  CompressByDict(attributes, dict, *delta_update, pb);
+  CompressByDict(attributes, dict, *no_op_delta_update, pb);
 
   for (const std::string& word : dict.GetWords()) {
     pb->add_words(word);
@@ -16,8 +16,6 @@
 #ifndef ISTIO_MIXERCLIENT_ATTRIBUTE_COMPRESSOR_H
 #define ISTIO_MIXERCLIENT_ATTRIBUTE_COMPRESSOR_H
 
-#include <unordered_map>
-
 #include "mixer/v1/attributes.pb.h"
 #include "mixer/v1/report.pb.h"
 
@@ -30,7 +28,7 @@ class GlobalDictionary {
   GlobalDictionary();
 
   // Lookup the index, return true if found.
-  bool GetIndex(const std::string word, int* index) const;
+  bool GetIndex(const std::string& word, int* index) const;
 
   // Shrink the global dictioanry
   void ShrinkToBase();
@@ -38,7 +36,6 @@ class GlobalDictionary {
   int size() const { return top_index_; }
 
  private:
-  std::unordered_map<std::string, int> global_dict_;
   // the last index of the global dictionary.
   // If mis-matched with server, it will set to base
   int top_index_;
@@ -53,9 +50,18 @@ class BatchCompressor {
   // Return false if it could not be added for delta update.
   virtual bool Add(const ::istio::mixer::v1::Attributes& attributes) = 0;
 
+  // Return true if the attribute set can be added. A delta encoded batch
+  // can't delete attributes, so it needs all attributes of the previous one.
+  virtual bool CanAdd(
+      const ::istio::mixer::v1::Attributes& attributes) const = 0;
+
   // Get the batched size.
   virtual int size() const = 0;
 
+  // Get the encoded size of the batched report request, tracked as
+  // attributes are added.
+  virtual size_t byte_size() const = 0;
+
   // Finish the batch and create the batched report request.
   virtual std::unique_ptr<::istio::mixer::v1::ReportRequest> Finish() = 0;
 };
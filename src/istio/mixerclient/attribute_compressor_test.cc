@@ -15,6 +15,7 @@
 
 #include "src/istio/mixerclient/attribute_compressor.h"
 #include "include/istio/utils/attributes_builder.h"
+#include "src/istio/mixerclient/global_dictionary.h"
 
 #include <time.h>
 #include "google/protobuf/text_format.h"
@@ -212,6 +213,28 @@ class AttributeCompressorTest : public ::testing::Test {
   Attributes attributes_;
 };
 
+TEST(GlobalDictionaryTest, GetIndexTest) {
+  const std::vector<std::string>& global_words = GetGlobalWords();
+  GlobalDictionary dict;
+  for (unsigned int i = 0; i < global_words.size(); i++) {
+    int index = -1;
+    EXPECT_TRUE(dict.GetIndex(global_words[i], &index));
+    EXPECT_EQ(index, i);
+  }
+
+  int index;
+  EXPECT_FALSE(dict.GetIndex("", &index));
+  EXPECT_FALSE(dict.GetIndex("not-a-global-word", &index));
+  EXPECT_FALSE(dict.GetIndex(global_words[0] + "x", &index));
+
+  // Words beyond the base size are not used after shrinking.
+  dict.ShrinkToBase();
+  EXPECT_TRUE(dict.GetIndex(global_words[0], &index));
+  if (global_words.size() > static_cast<size_t>(dict.size())) {
+    EXPECT_FALSE(dict.GetIndex(global_words.back(), &index));
+  }
+}
+
 TEST_F(AttributeCompressorTest, CompressTest) {
   // A compressor with an empty global dictionary.
   AttributeCompressor compressor;
@@ -266,6 +289,30 @@ TEST_F(AttributeCompressorTest, BatchCompressTest) {
   EXPECT_TRUE(MessageDifferencer::Equals(*report_pb, expected_report_pb));
 }
 
+TEST_F(AttributeCompressorTest, BatchByteSizeTest) {
+  AttributeCompressor compressor;
+  auto batch_compressor = compressor.CreateBatchCompressor();
+  size_t empty_size = batch_compressor->byte_size();
+
+  EXPECT_TRUE(batch_compressor->Add(attributes_));
+  size_t first_size = batch_compressor->byte_size();
+  EXPECT_GT(first_size, empty_size);
+
+  // Only the changed attributes and the new words are added.
+  utils::AttributesBuilder builder(&attributes_);
+  builder.AddInt64("response.size", 111);
+  builder.AddString("new.attribute", "new.value");
+  EXPECT_TRUE(batch_compressor->Add(attributes_));
+  EXPECT_LT(batch_compressor->byte_size() - first_size, first_size);
+
+  attributes_.mutable_attributes()->erase("response.size");
+  EXPECT_FALSE(batch_compressor->Add(attributes_));
+
+  size_t byte_size = batch_compressor->byte_size();
+  auto report_pb = batch_compressor->Finish();
+  EXPECT_EQ(byte_size, report_pb->ByteSizeLong());
+}
+
 }  // namespace
 }  // namespace mixerclient
 }  // namespace istio
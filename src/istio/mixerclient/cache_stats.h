@@ -0,0 +1,52 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_CACHE_STATS_H_
+#define ISTIO_MIXERCLIENT_CACHE_STATS_H_
+
+#include <stdint.h>
+#include <algorithm>
+
+namespace istio {
+namespace mixerclient {
+
+// The counters to show the effectiveness of a cache.
+struct CacheStats {
+  // The number of entries in the cache.
+  int64_t entries = 0;
+  // The number of entries removed to make room for new ones.
+  int64_t evictions = 0;
+  // The number of entries removed after they are expired.
+  int64_t expirations = 0;
+  // The idle time of the least recently used entry.
+  int64_t lru_age_ms = 0;
+  // The number of lookups found in the cache, if the cache counts them.
+  int64_t hits = 0;
+
+  // Add the counters of a SimpleLRUCache, the caller should hold its lock.
+  template <class LRUCache>
+  void Add(const LRUCache& cache) {
+    entries += cache.Entries();
+    evictions += cache.Evictions();
+    expirations += cache.Expirations();
+    lru_age_ms =
+        std::max(lru_age_ms, cache.AgeOfLRUItemInMicroseconds() / 1000);
+  }
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_CACHE_STATS_H_
@@ -0,0 +1,116 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Counts heap allocations of MixerClient::Check calls. The global operator
+// new is replaced in this binary, so it is a separate test target.
+
+#include "gtest/gtest.h"
+#include "include/istio/mixerclient/client.h"
+#include "include/istio/utils/attributes_builder.h"
+
+#include <stdlib.h>
+#include <atomic>
+#include <iostream>
+#include <new>
+
+using ::google::protobuf::util::Status;
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+using ::istio::quota_config::Requirement;
+
+namespace {
+
+std::atomic<uint64_t> allocations(0);
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++allocations;
+  void* p = malloc(size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+class CheckAllocationTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    utils::AttributesBuilder builder(&attributes_);
+    builder.AddString("source.uid", "kubernetes://client-84469dc8d7-jbbxt");
+    builder.AddString("destination.service", "server.default.svc");
+    builder.AddStringMap("request.headers", {{":method", "GET"},
+                                             {":path", "/echo"},
+                                             {"x-request-id", "d1a2b3c4"}});
+  }
+
+  // Create a client with a transport completing Check calls inline.
+  void CreateClient(int cache_entries) {
+    MixerClientOptions options(CheckOptions(cache_entries),
+                               ReportOptions(1, 1000), QuotaOptions(0, 1000));
+    options.env.check_transport = [](const CheckRequest& request,
+                                     CheckResponse* response,
+                                     DoneFunc on_done) -> CancelFunc {
+      response->mutable_precondition()->set_valid_use_count(-1);
+      on_done(Status::OK);
+      return nullptr;
+    };
+    client_ = CreateMixerClient(options);
+  }
+
+  // Return the number of allocations per Check call.
+  double MeasureAllocations(int loops) {
+    std::vector<Requirement> quotas;
+    TransportCheckFunc transport;
+    // Warm up.
+    for (int i = 0; i < 10; ++i) {
+      client_->Check(attributes_, quotas, transport,
+                     [](const CheckResponseInfo&) {});
+    }
+    uint64_t start = allocations;
+    for (int i = 0; i < loops; ++i) {
+      client_->Check(attributes_, quotas, transport,
+                     [](const CheckResponseInfo&) {});
+    }
+    return double(allocations - start) / loops;
+  }
+
+  Attributes attributes_;
+  std::unique_ptr<MixerClient> client_;
+};
+
+TEST_F(CheckAllocationTest, TestRemoteCheck) {
+  // Cache is disabled, every Check is a remote call.
+  CreateClient(0);
+  double count = MeasureAllocations(1000);
+  std::cerr << "===Remote Check allocations/op: " << count << std::endl;
+}
+
+TEST_F(CheckAllocationTest, TestCacheHitCheck) {
+  CreateClient(1000);
+  double count = MeasureAllocations(1000);
+  std::cerr << "===Cache hit Check allocations/op: " << count << std::endl;
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
@@ -16,6 +16,8 @@
 #include "src/istio/mixerclient/check_cache.h"
 #include "include/istio/utils/protobuf.h"
 
+#include <algorithm>
+
 using namespace std::chrono;
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
@@ -24,9 +26,25 @@ using ::istio::mixer::v1::CheckResponse;
 
 namespace istio {
 namespace mixerclient {
+namespace {
+
+// The minimum interval between re-orders of the referenced.
+const int kReorderIntervalMs = 1000;
+
+template <class List>
+std::vector<const Referenced *> GetReferenced(const List &list) {
+  std::vector<const Referenced *> referenced;
+  for (const auto &entry : list) {
+    referenced.push_back(&entry->referenced);
+  }
+  return referenced;
+}
+
+}  // namespace
 
 void CheckCache::CacheElem::CacheElem::SetResponse(
     const CheckResponse &response, Tick time_now) {
+  refresh_deadline_ = Tick();
   if (response.has_precondition()) {
     status_ = parent_.ConvertRpcStatus(response.precondition().status());
 
@@ -57,15 +75,39 @@ bool CheckCache::CacheElem::CacheElem::IsExpired(Tick time_now) {
   return false;
 }
 
-CheckCache::CheckResult::CheckResult() : status_(Code::UNAVAILABLE, "") {}
+bool CheckCache::CacheElem::StartRefresh(Tick time_now) {
+  const CheckOptions &options = parent_.options_;
+  // The in-flight refresh call may be cancelled and never done, so it is
+  // only waited for until its deadline.
+  if (!options.enable_background_refresh || time_now < refresh_deadline_ ||
+      !status_.ok()) {
+    return false;
+  }
+  if (expire_time_ - time_now <
+          milliseconds(options.refresh_before_expire_ms) ||
+      (use_count_ >= 0 && use_count_ <= options.refresh_use_count)) {
+    refresh_deadline_ = time_now + milliseconds(options.refresh_timeout_ms);
+    return true;
+  }
+  return false;
+}
+
+CheckCache::CheckResult::CheckResult()
+    : status_(Code::UNAVAILABLE, ""), need_refresh_(false) {}
 
 bool CheckCache::CheckResult::IsCacheHit() const {
   return status_.error_code() != Code::UNAVAILABLE;
 }
 
-CheckCache::CheckCache(const CheckOptions &options) : options_(options) {
+CheckCache::CheckCache(const CheckOptions &options)
+    : options_(options),
+      referenced_snapshot_(new ReferencedSnapshot(ReferencedList())) {
   if (options.num_entries > 0) {
-    cache_.reset(new CheckLRUCache(options.num_entries));
+    int num_shards = std::max(options.num_shards, 1);
+    int shard_entries = (options.num_entries + num_shards - 1) / num_shards;
+    for (int i = 0; i < num_shards; ++i) {
+      shards_.emplace_back(new CacheShard(shard_entries));
+    }
   }
 }
 
@@ -75,47 +117,79 @@ CheckCache::~CheckCache() {
 }
 
 void CheckCache::Check(const Attributes &attributes, CheckResult *result) {
-  Status status = Check(attributes, system_clock::now());
+  Status status = Check(attributes, system_clock::now(), result);
   if (status.error_code() != Code::NOT_FOUND) {
     result->status_ = status;
   }
 
-  result->on_response_ = [this](const Status &status,
-                                const Attributes &attributes,
-                                const CheckResponse &response) -> Status {
+  bool need_refresh = result->need_refresh_;
+  utils::Hash128 signature = result->refresh_signature_;
+  result->on_response_ = [this, need_refresh, signature](
+                             const Status &status,
+                             const Attributes &attributes,
+                             const CheckResponse &response) -> Status {
+    Status result_status;
     if (!status.ok()) {
       if (options_.network_fail_open) {
-        return Status::OK;
+        result_status = Status::OK;
       } else {
-        return status;
+        result_status = status;
       }
     } else {
-      return CacheResponse(attributes, response, system_clock::now());
+      result_status = CacheResponse(attributes, response, system_clock::now());
     }
+    if (need_refresh) {
+      EndRefresh(signature);
+    }
+    return result_status;
   };
 }
 
-Status CheckCache::Check(const Attributes &attributes, Tick time_now) {
-  if (!cache_) {
+CheckCache::CacheShard *CheckCache::GetShard(
+    const utils::Hash128 &signature) const {
+  if (shards_.size() == 1) {
+    return shards_[0].get();
+  }
+  // The low half is used by the LRU hash table, pick shard by the high half.
+  return shards_[signature.high % shards_.size()].get();
+}
+
+Status CheckCache::Check(const Attributes &attributes, Tick time_now,
+                         CheckResult *result) {
+  if (shards_.empty()) {
     // By returning NOT_FOUND, caller will send request to server.
     return Status(Code::NOT_FOUND, "");
   }
 
-  for (const auto &it : referenced_map_) {
-    const Referenced &reference = it.second;
-    std::string signature;
-    if (!reference.Signature(attributes, "", &signature)) {
+  std::shared_ptr<const ReferencedSnapshot> snapshot = GetReferencedSnapshot();
+  SignaturePlan::Context context(snapshot->plan, attributes);
+  for (size_t i = 0; i < snapshot->list.size(); ++i) {
+    utils::Hash128 signature;
+    if (!context.Signature(i, "", &signature)) {
       continue;
     }
 
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    CheckLRUCache::ScopedLookup lookup(cache_.get(), signature);
+    CacheShard *shard = GetShard(signature);
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    CheckLRUCache::ScopedLookup lookup(&shard->cache, signature);
     if (lookup.Found()) {
       CacheElem *elem = lookup.value();
       if (elem->IsExpired(time_now)) {
-        cache_->Remove(signature);
+        shard->cache.Remove(signature);
+        ++shard->expirations;
         return Status(Code::NOT_FOUND, "");
       }
+      ++shard->hits;
+      // Counted under the shard lock, no cache line is shared by shards.
+      size_t index = snapshot->list[i]->index;
+      if (index >= shard->referenced_hits.size()) {
+        shard->referenced_hits.resize(index + 1);
+      }
+      ++shard->referenced_hits[index];
+      if (result != nullptr && elem->StartRefresh(time_now)) {
+        result->need_refresh_ = true;
+        result->refresh_signature_ = signature;
+      }
       return elem->status();
     }
   }
@@ -125,7 +199,7 @@ Status CheckCache::Check(const Attributes &attributes, Tick time_now) {
 
 Status CheckCache::CacheResponse(const Attributes &attributes,
                                  const CheckResponse &response, Tick time_now) {
-  if (!cache_ || !response.has_precondition()) {
+  if (shards_.empty() || !response.has_precondition()) {
     if (response.has_precondition()) {
       return ConvertRpcStatus(response.precondition().status());
     } else {
@@ -140,7 +214,7 @@ Status CheckCache::CacheResponse(const Attributes &attributes,
     // Failed to decode referenced_attributes, not to cache this result.
     return ConvertRpcStatus(response.precondition().status());
   }
-  std::string signature;
+  utils::Hash128 signature;
   if (!referenced.Signature(attributes, "", &signature)) {
     GOOGLE_LOG(ERROR) << "Response referenced mismatchs with request";
     GOOGLE_LOG(ERROR) << "Request attributes: " << attributes.DebugString();
@@ -148,31 +222,124 @@ Status CheckCache::CacheResponse(const Attributes &attributes,
     return ConvertRpcStatus(response.precondition().status());
   }
 
-  std::lock_guard<std::mutex> lock(cache_mutex_);
-  std::string hash = referenced.Hash();
-  if (referenced_map_.find(hash) == referenced_map_.end()) {
-    referenced_map_[hash] = referenced;
-    GOOGLE_LOG(INFO) << "Add a new Referenced for check cache: "
-                     << referenced.DebugString();
-  }
+  AddReferenced(referenced.Hash(), referenced);
+  ReorderReferenced(time_now);
 
-  CheckLRUCache::ScopedLookup lookup(cache_.get(), signature);
+  CacheShard *shard = GetShard(signature);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  CheckLRUCache::ScopedLookup lookup(&shard->cache, signature);
   if (lookup.Found()) {
     lookup.value()->SetResponse(response, time_now);
     return lookup.value()->status();
   }
 
   CacheElem *cache_elem = new CacheElem(*this, response, time_now);
-  cache_->Insert(signature, cache_elem, 1);
+  shard->cache.Insert(signature, cache_elem, 1);
   return cache_elem->status();
 }
 
+CheckCache::ReferencedSnapshot::ReferencedSnapshot(ReferencedList entries)
+    : list(std::move(entries)), plan(GetReferenced(list)) {}
+
+std::shared_ptr<const CheckCache::ReferencedSnapshot>
+CheckCache::GetReferencedSnapshot() const {
+  return std::atomic_load(&referenced_snapshot_);
+}
+
+void CheckCache::AddReferenced(const utils::Hash128 &hash,
+                               const Referenced &referenced) {
+  // Referenced are rarely added, check the snapshot first without lock.
+  auto has_hash = [&hash](const ReferencedList &list) -> bool {
+    for (const auto &entry : list) {
+      if (entry->hash == hash) {
+        return true;
+      }
+    }
+    return false;
+  };
+  if (has_hash(GetReferencedSnapshot()->list)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(referenced_mutex_);
+  ReferencedList list = GetReferencedSnapshot()->list;
+  if (has_hash(list)) {
+    return;
+  }
+  list.emplace_back(new ReferencedEntry(hash, referenced, list.size()));
+  PublishReferencedWithLock(std::move(list));
+  GOOGLE_LOG(INFO) << "Add a new Referenced for check cache: "
+                   << referenced.DebugString();
+}
+
+void CheckCache::ReorderReferenced(Tick time_now) {
+  // Never wait for the lock; skip if another thread is publishing.
+  std::unique_lock<std::mutex> lock(referenced_mutex_, std::try_to_lock);
+  if (!lock.owns_lock() || time_now < next_reorder_time_) {
+    return;
+  }
+  next_reorder_time_ = time_now + milliseconds(kReorderIntervalMs);
+
+  std::shared_ptr<const ReferencedSnapshot> snapshot = GetReferencedSnapshot();
+  const ReferencedList &list = snapshot->list;
+  std::vector<uint64_t> hits(list.size());
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> shard_lock(shard->mutex);
+    for (size_t i = 0; i < list.size(); ++i) {
+      if (list[i]->index < shard->referenced_hits.size()) {
+        hits[i] += shard->referenced_hits[list[i]->index];
+      }
+    }
+  }
+
+  std::vector<size_t> order(list.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&hits](size_t a, size_t b) {
+    return hits[a] > hits[b];
+  });
+  if (std::is_sorted(order.begin(), order.end())) {
+    // The order is not changed.
+    return;
+  }
+  ReferencedList sorted;
+  for (size_t i : order) {
+    sorted.push_back(list[i]);
+  }
+  PublishReferencedWithLock(std::move(sorted));
+}
+
+void CheckCache::PublishReferencedWithLock(ReferencedList list) {
+  std::shared_ptr<const ReferencedSnapshot> snapshot(
+      new ReferencedSnapshot(std::move(list)));
+  std::atomic_store(&referenced_snapshot_, snapshot);
+}
+
+void CheckCache::EndRefresh(const utils::Hash128 &signature) {
+  CacheShard *shard = GetShard(signature);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  CheckLRUCache::ScopedLookup lookup(&shard->cache, signature);
+  if (lookup.Found()) {
+    lookup.value()->EndRefresh();
+  }
+}
+
+void CheckCache::GetStats(CacheStats *stats) const {
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats->Add(shard->cache);
+    stats->expirations += shard->expirations;
+    stats->hits += shard->hits;
+  }
+}
+
 // Flush out aggregated check requests, clear all cache items.
 // Usually called at destructor.
 Status CheckCache::FlushAll() {
-  if (cache_) {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    cache_->RemoveAll();
+  for (const auto &shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->cache.RemoveAll();
   }
 
   return Status::OK;
@@ -18,18 +18,22 @@
 #ifndef ISTIO_MIXERCLIENT_CHECK_CACHE_H
 #define ISTIO_MIXERCLIENT_CHECK_CACHE_H
 
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <mutex>
 #include <string>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "google/protobuf/stubs/status.h"
 #include "include/istio/mixerclient/client.h"
 #include "include/istio/mixerclient/options.h"
 #include "include/istio/utils/simple_lru_cache.h"
 #include "include/istio/utils/simple_lru_cache_inl.h"
+#include "src/istio/mixerclient/cache_stats.h"
 #include "src/istio/mixerclient/referenced.h"
+#include "src/istio/mixerclient/signature_plan.h"
 
 namespace istio {
 namespace mixerclient {
@@ -54,6 +58,10 @@ class CheckCache {
 
     bool IsCacheHit() const;
 
+    // Return true if the cache hit entry should be refreshed by a remote
+    // call. Only one CheckResult is asked to refresh an entry at a time.
+    bool NeedRefresh() const { return need_refresh_; }
+
     ::google::protobuf::util::Status status() const { return status_; }
 
     void SetResponse(const ::google::protobuf::util::Status& status,
@@ -66,9 +74,15 @@ class CheckCache {
 
    private:
     friend class CheckCache;
+    friend class CheckCacheTest;
     // Check status.
     ::google::protobuf::util::Status status_;
 
+    // If true, the cache hit entry needs a refresh.
+    bool need_refresh_;
+    // The signature of the entry to refresh.
+    utils::Hash128 refresh_signature_;
+
     // The function to set check response.
     using OnResponseFunc = std::function<::google::protobuf::util::Status(
         const ::google::protobuf::util::Status&,
@@ -80,14 +94,19 @@ class CheckCache {
   void Check(const ::istio::mixer::v1::Attributes& attributes,
              CheckResult* result);
 
+  // Get the cache counters summed over all shards.
+  void GetStats(CacheStats* stats) const;
+
  private:
   friend class CheckCacheTest;
   using Tick = std::chrono::time_point<std::chrono::system_clock>;
 
   // If the check could not be handled by the cache, returns NOT_FOUND,
   // caller has to send the request to mixer.
+  // If result is not nullptr, it is marked if the entry needs a refresh.
   ::google::protobuf::util::Status Check(
-      const ::istio::mixer::v1::Attributes& request, Tick time_now);
+      const ::istio::mixer::v1::Attributes& request, Tick time_now,
+      CheckResult* result = nullptr);
 
   // Caches a response from a remote mixer call.
   // Return the converted status from response.
@@ -95,6 +114,9 @@ class CheckCache {
       const ::istio::mixer::v1::Attributes& attributes,
       const ::istio::mixer::v1::CheckResponse& response, Tick time_now);
 
+  // Called when the refresh call for the entry is done.
+  void EndRefresh(const utils::Hash128& signature);
+
   // Flushes out all cached check responses; clears all cache items.
   // Usually called at destructor.
   ::google::protobuf::util::Status FlushAll();
@@ -118,6 +140,13 @@ class CheckCache {
     // Check if the item is expired.
     bool IsExpired(Tick time_now);
 
+    // Return true if the item should be refreshed now. It only returns true
+    // once until the refresh is done or times out.
+    bool StartRefresh(Tick time_now);
+
+    // Called when the refresh is done.
+    void EndRefresh() { refresh_deadline_ = Tick(); }
+
     // getter for converted status from response.
     ::google::protobuf::util::Status status() const { return status_; }
 
@@ -132,27 +161,103 @@ class CheckCache {
     // if 0, cache item should not be used.
     // use_cound is decreased by 1 for each request,
     int use_count_;
+    // A refresh call is in flight until this time.
+    Tick refresh_deadline_;
   };
 
   // Key is the signature of the Attributes. Value is the CacheElem.
   // It is a LRU cache with maximum size.
   // When the maximum size is reached, oldest idle items will be removed.
-  using CheckLRUCache = utils::SimpleLRUCache<std::string, CacheElem>;
+  using CheckLRUCache =
+      utils::SimpleLRUCache<utils::Hash128, CacheElem, utils::Hash128Hasher>;
+
+  // A cache shard: an independent LRU cache guarded by its own mutex.
+  struct CacheShard {
+    CacheShard(int num_entries)
+        : cache(num_entries), expirations(0), hits(0) {}
+
+    // Mutex guarding the access of cache.
+    std::mutex mutex;
+
+    // The cache that maps from operation signature to an operation.
+    // We don't calculate fine grained cost for cache entries, assign each
+    // entry 1 cost unit.
+    CheckLRUCache cache;
+
+    // The number of expired responses removed on lookup.
+    int64_t expirations;
+
+    // The number of cache hits in this shard.
+    int64_t hits;
+
+    // The cache hits in this shard for each referenced, indexed by
+    // ReferencedEntry::index.
+    std::vector<uint64_t> referenced_hits;
+  };
+
+  // Get the shard owning the signature.
+  CacheShard* GetShard(const utils::Hash128& signature) const;
+
+  // A Referenced pattern.
+  struct ReferencedEntry {
+    ReferencedEntry(const utils::Hash128& hash, const Referenced& referenced,
+                    size_t index)
+        : hash(hash), referenced(referenced), index(index) {}
+
+    // The hash of the referenced.
+    utils::Hash128 hash;
+    // The referenced attributes used to calculate signatures.
+    Referenced referenced;
+    // The index of its hit counts in CacheShard::referenced_hits, in the
+    // order referenced are added.
+    size_t index;
+  };
+
+  // All referenced, ordered by hits.
+  // Entries are shared between snapshots.
+  using ReferencedList = std::vector<std::shared_ptr<ReferencedEntry>>;
+
+  // An immutable snapshot of all referenced.
+  struct ReferencedSnapshot {
+    explicit ReferencedSnapshot(ReferencedList entries);
+
+    ReferencedList list;
+    // The signature plan compiled from list, in the same order.
+    SignaturePlan plan;
+  };
+
+  // Get the current referenced snapshot.
+  std::shared_ptr<const ReferencedSnapshot> GetReferencedSnapshot() const;
+
+  // Add a referenced if it is not in the list yet.
+  void AddReferenced(const utils::Hash128& hash,
+                     const Referenced& referenced);
+
+  // Re-order the referenced by their hits summed over all shards, so the
+  // hottest referenced is probed first. Called on the cache miss path, it
+  // does nothing if the last re-order was within kReorderIntervalMs.
+  void ReorderReferenced(Tick time_now);
+
+  // Publish a new snapshot. Called with referenced_mutex_.
+  void PublishReferencedWithLock(ReferencedList list);
 
   // The check options.
   CheckOptions options_;
 
-  // Referenced map keyed with their hashes
-  std::unordered_map<std::string, Referenced> referenced_map_;
+  // The current referenced snapshot. It is replaced, never modified, so
+  // Check can iterate it without holding any lock.
+  // Use std::atomic_load/atomic_store to access it.
+  std::shared_ptr<const ReferencedSnapshot> referenced_snapshot_;
+
+  // Mutex serializing writers of referenced_snapshot_.
+  std::mutex referenced_mutex_;
 
-  // Mutex guarding the access of cache_;
-  std::mutex cache_mutex_;
+  // The earliest time of the next re-order, guarded by referenced_mutex_.
+  Tick next_reorder_time_;
 
-  // The cache that maps from operation signature to an operation.
-  // We don't calculate fine grained cost for cache entries, assign each
-  // entry 1 cost unit.
-  // Guarded by mutex_, except when compare against NULL.
-  std::unique_ptr<CheckLRUCache> cache_;
+  // The cache shards, selected by signature. Empty if cache is disabled.
+  // The vector itself is not changed after construction.
+  std::vector<std::unique_ptr<CacheShard>> shards_;
 
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(CheckCache);
 };
@@ -20,6 +20,10 @@
 #include "include/istio/utils/protobuf.h"
 #include "src/istio/mixerclient/status_test_util.h"
 
+#include <iostream>
+#include <thread>
+#include <vector>
+
 using namespace std::chrono;
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
@@ -60,12 +64,105 @@ class CheckCacheTest : public ::testing::Test {
   Status Check(const Attributes& request, time_point<system_clock> time_now) {
     return cache_->Check(request, time_now);
   }
+  Status Check(const Attributes& request, time_point<system_clock> time_now,
+               CheckCache::CheckResult* result) {
+    return cache_->Check(request, time_now, result);
+  }
+  void ReorderReferenced(time_point<system_clock> time_now) {
+    cache_->ReorderReferenced(time_now);
+  }
+  void EndRefresh(const CheckCache::CheckResult& result) {
+    cache_->EndRefresh(result.refresh_signature_);
+  }
   Status CacheResponse(const Attributes& attributes,
                        const ::istio::mixer::v1::CheckResponse& response,
                        time_point<system_clock> time_now) {
     return cache_->CacheResponse(attributes, response, time_now);
   }
 
+  // Cache a response with the code for "target.service" = value, return
+  // the attributes.
+  Attributes CacheTargetService(const std::string& value,
+                                Code code = Code::OK) {
+    Attributes attributes;
+    utils::AttributesBuilder(&attributes).AddString("target.service", value);
+
+    CheckResponse ok_response;
+    ok_response.mutable_precondition()->set_valid_use_count(-1);
+    ok_response.mutable_precondition()->mutable_status()->set_code(code);
+    auto match = ok_response.mutable_precondition()
+                     ->mutable_referenced_attributes()
+                     ->add_attribute_matches();
+    match->set_condition(ReferencedAttributes::EXACT);
+    match->set_name(9);  // target.service is used.
+    EXPECT_ERROR_CODE(code,
+                      CacheResponse(attributes, ok_response, FakeTime(0)));
+    return attributes;
+  }
+
+  // The cached code of the key k, alternates between OK and rejected.
+  static Code KeyCode(int k) {
+    return k % 2 == 0 ? Code::OK : Code::PERMISSION_DENIED;
+  }
+
+  // Run Check calls from num_threads threads, each thread checks its own
+  // set of cached attributes. Every check should hit the cached status.
+  // Return the number of checks per second.
+  double RunConcurrentChecks(int num_threads, int checks_per_thread) {
+    const int kKeysPerThread = 16;
+    std::vector<std::vector<Attributes>> thread_attributes(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+      for (int k = 0; k < kKeysPerThread; ++k) {
+        thread_attributes[i].push_back(CacheTargetService(
+            "service-" + std::to_string(i) + "-" + std::to_string(k),
+            KeyCode(k)));
+      }
+    }
+
+    std::atomic<int> failures(0);
+    auto start = system_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&, i]() {
+        const auto& attributes = thread_attributes[i];
+        for (int n = 0; n < checks_per_thread; ++n) {
+          int k = n % kKeysPerThread;
+          if (Check(attributes[k], FakeTime(1)).error_code() != KeyCode(k)) {
+            ++failures;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto elapsed = duration_cast<microseconds>(system_clock::now() - start);
+    EXPECT_EQ(failures, 0);
+
+    // Every check is a hit counted by one shard.
+    int64_t total = int64_t(num_threads) * checks_per_thread;
+    int64_t shard_hits = 0;
+    for (const auto& shard : cache_->shards_) {
+      shard_hits += shard->hits;
+    }
+    EXPECT_EQ(shard_hits, total);
+    CacheStats stats;
+    cache_->GetStats(&stats);
+    EXPECT_EQ(stats.hits, total);
+    EXPECT_EQ(stats.entries, num_threads * kKeysPerThread);
+    return num_threads * checks_per_thread * 1000000.0 /
+           std::max<int64_t>(elapsed.count(), 1);
+  }
+
+  // The debug string of the referenced probed first by Check.
+  std::string FirstReferenced() {
+    const auto& list = cache_->GetReferencedSnapshot()->list;
+    if (list.empty()) {
+      return "";
+    }
+    return list[0]->referenced.DebugString();
+  }
+
   Attributes attributes_;
   std::unique_ptr<CheckCache> cache_;
 };
@@ -122,6 +219,12 @@ TEST_F(CheckCacheTest, TestExpiredByDuration) {
 
   // Not found in 11 milliseconds.
   EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(11)));
+
+  CacheStats stats;
+  cache_->GetStats(&stats);
+  EXPECT_EQ(stats.entries, 0);
+  EXPECT_EQ(stats.expirations, 1);
+  EXPECT_EQ(stats.evictions, 0);
 }
 
 TEST_F(CheckCacheTest, TestCheckResult) {
@@ -317,5 +420,244 @@ TEST_F(CheckCacheTest, TestTwoReferenced) {
   EXPECT_TRUE(result3.IsCacheHit());
 }
 
+TEST_F(CheckCacheTest, TestReferencedOrderedByHits) {
+  // Cache with target.service referenced.
+  CacheTargetService("this-is-a-string-value");
+
+  // Cache with target.name referenced.
+  Attributes attributes1;
+  utils::AttributesBuilder(&attributes1)
+      .AddString("target.name", "target name");
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(-1);
+  auto match = ok_response.mutable_precondition()
+                   ->mutable_referenced_attributes()
+                   ->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(10);  // target.name is used.
+  EXPECT_OK(CacheResponse(attributes1, ok_response, FakeTime(0)));
+
+  const std::string kTargetService =
+      "Absence-keys: Exact-keys: target.service, ";
+  const std::string kTargetName = "Absence-keys: Exact-keys: target.name, ";
+  EXPECT_EQ(FirstReferenced(), kTargetService);
+
+  // Hits don't re-order the list in Check.
+  EXPECT_OK(Check(attributes1, FakeTime(1)));
+  EXPECT_EQ(FirstReferenced(), kTargetService);
+
+  // A re-order moves target.name with more hits to the front.
+  ReorderReferenced(FakeTime(1000));
+  EXPECT_EQ(FirstReferenced(), kTargetName);
+
+  // target.service has more hits, but re-orders are rate limited.
+  EXPECT_OK(Check(attributes_, FakeTime(1001)));
+  EXPECT_OK(Check(attributes_, FakeTime(1001)));
+  ReorderReferenced(FakeTime(1500));
+  EXPECT_EQ(FirstReferenced(), kTargetName);
+
+  // The next re-order is on the cache miss path.
+  EXPECT_OK(CacheResponse(attributes1, ok_response, FakeTime(2000)));
+  EXPECT_EQ(FirstReferenced(), kTargetService);
+}
+
+TEST_F(CheckCacheTest, TestConcurrentAddReferenced) {
+  CacheTargetService("this-is-a-string-value");
+
+  // Keep adding new referenced while other threads are checking.
+  std::thread writer([this]() {
+    for (int i = 0; i < 100; ++i) {
+      Attributes attributes;
+      utils::AttributesBuilder builder(&attributes);
+      builder.AddString("target.service", "this-is-a-string-value");
+      builder.AddInt64("target.port", i);
+      CheckResponse ok_response;
+      ok_response.mutable_precondition()->set_valid_use_count(-1);
+      auto referenced =
+          ok_response.mutable_precondition()->mutable_referenced_attributes();
+      referenced->add_attribute_matches()->set_name(9);  // target.service
+      referenced->add_attribute_matches()->set_name(8);  // target.port
+      // Alternates between a new referenced and an existing one.
+      if (i % 2 == 0) {
+        referenced->mutable_attribute_matches(0)->set_condition(
+            ReferencedAttributes::EXACT);
+        referenced->mutable_attribute_matches(1)->set_condition(
+            ReferencedAttributes::EXACT);
+      } else {
+        referenced->mutable_attribute_matches(0)->set_condition(
+            ReferencedAttributes::EXACT);
+        referenced->mutable_attribute_matches(1)->set_condition(
+            ReferencedAttributes::ABSENCE);
+        attributes.mutable_attributes()->erase("target.port");
+      }
+      EXPECT_OK(CacheResponse(attributes, ok_response, FakeTime(0)));
+    }
+  });
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 4; ++i) {
+    readers.emplace_back([this]() {
+      for (int n = 0; n < 1000; ++n) {
+        EXPECT_OK(Check(attributes_, FakeTime(1)));
+      }
+    });
+  }
+  writer.join();
+  for (auto& reader : readers) {
+    reader.join();
+  }
+}
+
+TEST_F(CheckCacheTest, TestBackgroundRefreshByTime) {
+  CheckOptions options;
+  options.enable_background_refresh = true;
+  options.refresh_before_expire_ms = 1000;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(-1);
+  ok_response.mutable_precondition()->mutable_valid_duration()->set_seconds(
+      10);
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+
+  CheckCache::CheckResult result1;
+  EXPECT_OK(Check(attributes_, FakeTime(1000), &result1));
+  EXPECT_FALSE(result1.NeedRefresh());
+
+  // Close to expiration, only the first one is asked to refresh.
+  CheckCache::CheckResult result2;
+  EXPECT_OK(Check(attributes_, FakeTime(9500), &result2));
+  EXPECT_TRUE(result2.NeedRefresh());
+  CheckCache::CheckResult result3;
+  EXPECT_OK(Check(attributes_, FakeTime(9600), &result3));
+  EXPECT_FALSE(result3.NeedRefresh());
+
+  // The refresh response extends the entry.
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(9700)));
+  EndRefresh(result2);
+  CheckCache::CheckResult result4;
+  EXPECT_OK(Check(attributes_, FakeTime(10500), &result4));
+  EXPECT_FALSE(result4.NeedRefresh());
+
+  // A failed refresh allows another refresh.
+  CheckCache::CheckResult result5;
+  EXPECT_OK(Check(attributes_, FakeTime(19000), &result5));
+  EXPECT_TRUE(result5.NeedRefresh());
+  EndRefresh(result5);
+  CheckCache::CheckResult result6;
+  EXPECT_OK(Check(attributes_, FakeTime(19100), &result6));
+  EXPECT_TRUE(result6.NeedRefresh());
+
+  // Expired entry is still removed.
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(attributes_, FakeTime(20000)));
+}
+
+TEST_F(CheckCacheTest, TestBackgroundRefreshTimeout) {
+  CheckOptions options;
+  options.enable_background_refresh = true;
+  options.refresh_before_expire_ms = 5000;
+  options.refresh_timeout_ms = 1000;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(-1);
+  ok_response.mutable_precondition()->mutable_valid_duration()->set_seconds(
+      10);
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+
+  CheckCache::CheckResult result1;
+  EXPECT_OK(Check(attributes_, FakeTime(6000), &result1));
+  EXPECT_TRUE(result1.NeedRefresh());
+  CheckCache::CheckResult result2;
+  EXPECT_OK(Check(attributes_, FakeTime(6999), &result2));
+  EXPECT_FALSE(result2.NeedRefresh());
+
+  // The first refresh is never done, another one is started after its
+  // deadline.
+  CheckCache::CheckResult result3;
+  EXPECT_OK(Check(attributes_, FakeTime(7000), &result3));
+  EXPECT_TRUE(result3.NeedRefresh());
+}
+
+TEST_F(CheckCacheTest, TestBackgroundRefreshByUseCount) {
+  CheckOptions options;
+  options.enable_background_refresh = true;
+  options.refresh_use_count = 1;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse ok_response;
+  ok_response.mutable_precondition()->set_valid_use_count(3);
+  EXPECT_OK(CacheResponse(attributes_, ok_response, FakeTime(0)));
+
+  CheckCache::CheckResult result1;
+  EXPECT_OK(Check(attributes_, FakeTime(0), &result1));
+  EXPECT_FALSE(result1.NeedRefresh());
+  CheckCache::CheckResult result2;
+  EXPECT_OK(Check(attributes_, FakeTime(0), &result2));
+  EXPECT_TRUE(result2.NeedRefresh());
+}
+
+TEST_F(CheckCacheTest, TestNoRefreshForRejected) {
+  CheckOptions options;
+  options.enable_background_refresh = true;
+  options.refresh_use_count = 1;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  CheckResponse response;
+  response.mutable_precondition()->set_valid_use_count(2);
+  response.mutable_precondition()->mutable_status()->set_code(
+      Code::PERMISSION_DENIED);
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                    CacheResponse(attributes_, response, FakeTime(0)));
+
+  CheckCache::CheckResult result;
+  EXPECT_ERROR_CODE(Code::PERMISSION_DENIED,
+                    Check(attributes_, FakeTime(0), &result));
+  EXPECT_FALSE(result.NeedRefresh());
+}
+
+TEST_F(CheckCacheTest, TestShardedCache) {
+  CheckOptions options;
+  options.num_shards = 8;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  std::vector<Attributes> cached;
+  for (int i = 0; i < 100; ++i) {
+    cached.push_back(CacheTargetService("service-" + std::to_string(i)));
+  }
+  for (const auto& attributes : cached) {
+    EXPECT_OK(Check(attributes, FakeTime(1)));
+  }
+
+  Attributes missing;
+  utils::AttributesBuilder(&missing).AddString("target.service", "missing");
+  EXPECT_ERROR_CODE(Code::NOT_FOUND, Check(missing, FakeTime(1)));
+}
+
+TEST_F(CheckCacheTest, TestDisableShardedCacheFromZeroCacheSize) {
+  CheckOptions options(0);
+  options.num_shards = 8;
+  cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+
+  ASSERT_TRUE((bool)(cache_));
+  VerifyDisabledCache();
+}
+
+TEST_F(CheckCacheTest, TestShardedCacheContention) {
+  const int kChecksPerThread = 20000;
+  for (int num_shards : {1, 16}) {
+    for (int num_threads : {1, 2, 4, 8}) {
+      CheckOptions options;
+      options.num_shards = num_shards;
+      cache_ = std::unique_ptr<CheckCache>(new CheckCache(options));
+      double rate = RunConcurrentChecks(num_threads, kChecksPerThread);
+      std::cerr << "===Contention shards: " << num_shards
+                << ", threads: " << num_threads
+                << ", checks/second: " << static_cast<int64_t>(rate)
+                << std::endl;
+    }
+  }
+}
+
 }  // namespace mixerclient
 }  // namespace istio
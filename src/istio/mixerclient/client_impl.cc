@@ -16,6 +16,9 @@
 #include "include/istio/mixerclient/check_response.h"
 #include "include/istio/utils/protobuf.h"
 
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/io/zero_copy_stream_impl_lite.h"
+
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
 using ::istio::mixer::v1::Attributes;
@@ -26,16 +29,44 @@ using ::istio::mixer::v1::ReportResponse;
 
 namespace istio {
 namespace mixerclient {
+namespace {
+
+// The maximum number of free CheckContexts kept for reuse.
+const size_t kMaxFreeCheckContexts = 64;
+
+// The latency histogram is decayed after this many samples.
+const int64_t kMaxLatencySamples = 10000;
+
+// Hash all attributes, identical attributes have the same hash.
+utils::Hash128 HashAttributes(const Attributes &attributes) {
+  std::string data;
+  {
+    ::google::protobuf::io::StringOutputStream output(&data);
+    ::google::protobuf::io::CodedOutputStream coded(&output);
+    // Sort map entries so the result doesn't depend on map order.
+    coded.SetSerializationDeterministic(true);
+    attributes.SerializeToCodedStream(&coded);
+  }
+  return utils::SipHash128()(data.data(), data.size());
+}
+
+}  // namespace
 
 MixerClientImpl::MixerClientImpl(const MixerClientOptions &options)
-    : options_(options) {
+    : options_(options),
+      quota_latency_(kMaxLatencySamples, options.env.quota_latency_func) {
   check_cache_ =
       std::unique_ptr<CheckCache>(new CheckCache(options.check_options));
   report_batch_ = std::unique_ptr<ReportBatch>(
       new ReportBatch(options.report_options, options_.env.report_transport,
-                      options.env.timer_create_func, compressor_));
+                      options.env.timer_create_func, compressor_,
+                      options.env.report_latency_func));
   quota_cache_ =
       std::unique_ptr<QuotaCache>(new QuotaCache(options.quota_options));
+  timed_check_transport_ =
+      std::unique_ptr<TimedCheckTransport>(new TimedCheckTransport(
+          options.check_options, options.env.timer_create_func,
+          options.env.check_latency_func));
 
   if (options_.env.uuid_generate_func) {
     deduplication_id_base_ = options_.env.uuid_generate_func();
@@ -44,6 +75,7 @@ MixerClientImpl::MixerClientImpl(const MixerClientOptions &options)
   total_check_calls_ = 0;
   total_remote_check_calls_ = 0;
   total_blocking_remote_check_calls_ = 0;
+  total_refresh_check_calls_ = 0;
   total_quota_calls_ = 0;
   total_remote_quota_calls_ = 0;
   total_blocking_remote_quota_calls_ = 0;
@@ -51,15 +83,55 @@ MixerClientImpl::MixerClientImpl(const MixerClientOptions &options)
 
 MixerClientImpl::~MixerClientImpl() {}
 
+void MixerClientImpl::CheckContext::Reset() {
+  check_result = CheckCache::CheckResult();
+  quota_result = QuotaCache::CheckResult();
+  // Clear() keeps allocated strings and repeated fields for reuse.
+  request.Clear();
+  response.Clear();
+  referenced_attributes.Clear();
+  on_done = nullptr;
+}
+
+void MixerClientImpl::CheckContextReleaser::operator()(
+    CheckContext *context) const {
+  client_->ReleaseCheckContext(context);
+}
+
+MixerClientImpl::CheckContextPtr MixerClientImpl::AcquireCheckContext() {
+  CheckContext *context = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(check_context_mutex_);
+    if (!free_check_contexts_.empty()) {
+      context = free_check_contexts_.back().release();
+      free_check_contexts_.pop_back();
+    }
+  }
+  if (context == nullptr) {
+    context = new CheckContext;
+  }
+  return CheckContextPtr(context, CheckContextReleaser(this));
+}
+
+void MixerClientImpl::ReleaseCheckContext(CheckContext *context) {
+  context->Reset();
+  std::lock_guard<std::mutex> lock(check_context_mutex_);
+  if (free_check_contexts_.size() < kMaxFreeCheckContexts) {
+    free_check_contexts_.emplace_back(context);
+  } else {
+    delete context;
+  }
+}
+
 CancelFunc MixerClientImpl::Check(
     const Attributes &attributes,
     const std::vector<::istio::quota_config::Requirement> &quotas,
     TransportCheckFunc transport, CheckDoneFunc on_done) {
   ++total_check_calls_;
 
-  std::unique_ptr<CheckCache::CheckResult> check_result(
-      new CheckCache::CheckResult);
-  check_cache_->Check(attributes, check_result.get());
+  CheckContextPtr context = AcquireCheckContext();
+  CheckCache::CheckResult *check_result = &context->check_result;
+  check_cache_->Check(attributes, check_result);
 
   CheckResponseInfo check_response_info;
   check_response_info.is_check_cache_hit = check_result->IsCacheHit();
@@ -73,37 +145,59 @@ CancelFunc MixerClientImpl::Check(
   if (!quotas.empty()) {
     ++total_quota_calls_;
   }
-  std::unique_ptr<QuotaCache::CheckResult> quota_result(
-      new QuotaCache::CheckResult);
+  QuotaCache::CheckResult *quota_result = &context->quota_result;
   // Only use quota cache if Check is using cache with OK status.
   // Otherwise, a remote Check call may be rejected, but quota amounts were
   // substracted from quota cache already.
   quota_cache_->Check(attributes, quotas, check_result->IsCacheHit(),
-                      quota_result.get());
+                      quota_result);
 
-  CheckRequest request;
+  CheckRequest &request = context->request;
   bool quota_call = quota_result->BuildRequest(&request);
   check_response_info.is_quota_cache_hit = quota_result->IsCacheHit();
   check_response_info.response_status = quota_result->status();
   if (check_result->IsCacheHit() && quota_result->IsCacheHit()) {
     on_done(check_response_info);
     on_done = nullptr;
-    if (!quota_call) {
+    if (!quota_call && !check_result->NeedRefresh()) {
       return nullptr;
     }
   }
 
+  // A blocking Check without quotas only depends on attributes, identical
+  // concurrent requests can share one remote call. Only the full attributes
+  // are compared: the referenced of a response may depend on values of
+  // other attributes, so a cache signature can't tell two requests get the
+  // same result.
+  utils::Hash128 flight_key;
+  std::shared_ptr<InFlightCheck> flight;
+  CancelFunc flight_cancel;
+  if (on_done && quotas.empty() &&
+      options_.check_options.coalesce_check_calls) {
+    flight_key = HashAttributes(attributes);
+    std::lock_guard<std::mutex> lock(coalesce_mutex_);
+    auto it = in_flight_checks_.find(flight_key);
+    if (it != in_flight_checks_.end()) {
+      return AddWaiterWithLock(flight_key, it->second, on_done);
+    }
+    flight = std::make_shared<InFlightCheck>();
+    in_flight_checks_[flight_key] = flight;
+    flight_cancel = AddWaiterWithLock(flight_key, flight, on_done);
+  }
+  if (flight) {
+    on_done = [this, flight_key, flight](const CheckResponseInfo &info) {
+      CompleteInFlight(flight_key, flight, info);
+    };
+  }
+
   compressor_.Compress(attributes, request.mutable_attributes());
   request.set_global_word_count(compressor_.global_word_count());
-  request.set_deduplication_id(deduplication_id_base_ +
-                               std::to_string(deduplication_id_.fetch_add(1)));
+  std::string *deduplication_id = request.mutable_deduplication_id();
+  deduplication_id->assign(deduplication_id_base_);
+  deduplication_id->append(std::to_string(deduplication_id_.fetch_add(1)));
 
-  // Need to make a copy for processing the response for check cache.
-  Attributes *request_copy = new Attributes(attributes);
-  auto response = new CheckResponse;
-  // Lambda capture could not pass unique_ptr, use raw pointer.
-  CheckCache::CheckResult *raw_check_result = check_result.release();
-  QuotaCache::CheckResult *raw_quota_result = quota_result.release();
+  context->on_done = std::move(on_done);
+  bool check_result_refresh = check_result->NeedRefresh();
   if (!transport) {
     transport = options_.env.check_transport;
   }
@@ -112,37 +206,129 @@ CancelFunc MixerClientImpl::Check(
   if (!quotas.empty()) {
     ++total_remote_quota_calls_;
   }
-  if (on_done) {
+  if (context->on_done) {
     ++total_blocking_remote_check_calls_;
     if (!quotas.empty()) {
       ++total_blocking_remote_quota_calls_;
     }
   }
+  if (check_result_refresh) {
+    ++total_refresh_check_calls_;
+  }
 
-  return transport(
-      request, response,
-      [this, request_copy, response, raw_check_result, raw_quota_result,
-       on_done](const Status &status) {
-        raw_check_result->SetResponse(status, *request_copy, *response);
-        raw_quota_result->SetResponse(status, *request_copy, *response);
+  // Lambda capture could not pass unique_ptr, use raw pointer.
+  CheckContext *raw_context = context.release();
+  raw_context->start_time = std::chrono::steady_clock::now();
+  bool blocking = raw_context->on_done != nullptr;
+  CancelFunc cancel = timed_check_transport_->Call(
+      transport, raw_context->request, &raw_context->response, blocking,
+      [this, raw_context](const Status &status) {
+        CheckContextPtr context(raw_context, CheckContextReleaser(this));
+        if (!context->request.quotas().empty()) {
+          quota_latency_.Record(
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - context->start_time)
+                  .count());
+        }
+        const Attributes &attributes = context->referenced_attributes;
+        if (status.ok()) {
+          ExtractReferencedAttributes(context.get());
+        }
+        context->check_result.SetResponse(status, attributes,
+                                          context->response);
+        context->quota_result.SetResponse(status, attributes,
+                                          context->response);
         CheckResponseInfo check_response_info;
-        if (on_done) {
-          if (!raw_check_result->status().ok()) {
-            check_response_info.response_status = raw_check_result->status();
+        if (context->on_done) {
+          if (!context->check_result.status().ok()) {
+            check_response_info.response_status =
+                context->check_result.status();
           } else {
-            check_response_info.response_status = raw_quota_result->status();
+            check_response_info.response_status =
+                context->quota_result.status();
           }
-          on_done(check_response_info);
+          context->on_done(check_response_info);
         }
-        delete raw_check_result;
-        delete raw_quota_result;
-        delete request_copy;
-        delete response;
 
         if (utils::InvalidDictionaryStatus(status)) {
           compressor_.ShrinkGlobalDictionary();
         }
       });
+  if (!flight) {
+    return cancel;
+  }
+  std::lock_guard<std::mutex> lock(coalesce_mutex_);
+  // The call may be already done by the transport.
+  if (!flight->done) {
+    flight->cancel = cancel;
+  }
+  return flight_cancel;
+}
+
+void MixerClientImpl::ExtractReferencedAttributes(CheckContext *context) {
+  // Only the referenced attributes are used to cache the response.
+  const auto &compressed = context->request.attributes();
+  const CheckResponse &response = context->response;
+  Referenced::ExtractAttributes(
+      compressed, response.precondition().referenced_attributes(),
+      &context->referenced_attributes);
+  for (const auto &it : response.quotas()) {
+    Referenced::ExtractAttributes(compressed, it.second.referenced_attributes(),
+                                  &context->referenced_attributes);
+  }
+}
+
+CancelFunc MixerClientImpl::AddWaiterWithLock(
+    const utils::Hash128 &key, std::shared_ptr<InFlightCheck> flight,
+    CheckDoneFunc on_done) {
+  uint64_t id = flight->next_waiter_id++;
+  flight->waiters[id] = on_done;
+  return [this, key, flight, id]() {
+    CancelFunc cancel;
+    {
+      std::lock_guard<std::mutex> lock(coalesce_mutex_);
+      if (flight->done) {
+        return;
+      }
+      flight->waiters.erase(id);
+      if (!flight->waiters.empty()) {
+        return;
+      }
+      // The last waiter is gone, cancel the remote call.
+      cancel = flight->cancel;
+      RemoveInFlightWithLock(key, flight);
+    }
+    if (cancel) {
+      cancel();
+    }
+  };
+}
+
+void MixerClientImpl::CompleteInFlight(
+    const utils::Hash128 &key, std::shared_ptr<InFlightCheck> flight,
+    const CheckResponseInfo &info) {
+  std::map<uint64_t, CheckDoneFunc> waiters;
+  {
+    std::lock_guard<std::mutex> lock(coalesce_mutex_);
+    if (flight->done) {
+      return;
+    }
+    RemoveInFlightWithLock(key, flight);
+    waiters.swap(flight->waiters);
+  }
+  for (const auto &it : waiters) {
+    it.second(info);
+  }
+}
+
+void MixerClientImpl::RemoveInFlightWithLock(
+    const utils::Hash128 &key, const std::shared_ptr<InFlightCheck> &flight) {
+  flight->done = true;
+  flight->cancel = nullptr;
+  auto it = in_flight_checks_.find(key);
+  if (it != in_flight_checks_.end() && it->second == flight) {
+    in_flight_checks_.erase(it);
+  }
 }
 
 void MixerClientImpl::Report(const Attributes &attributes) {
@@ -153,11 +339,46 @@ void MixerClientImpl::GetStatistics(Statistics *stat) const {
   stat->total_check_calls = total_check_calls_;
   stat->total_remote_check_calls = total_remote_check_calls_;
   stat->total_blocking_remote_check_calls = total_blocking_remote_check_calls_;
+  stat->total_refresh_check_calls = total_refresh_check_calls_;
   stat->total_quota_calls = total_quota_calls_;
   stat->total_remote_quota_calls = total_remote_quota_calls_;
   stat->total_blocking_remote_quota_calls = total_blocking_remote_quota_calls_;
   stat->total_report_calls = report_batch_->total_report_calls();
   stat->total_remote_report_calls = report_batch_->total_remote_report_calls();
+  stat->total_report_batch_size_1 = report_batch_->batch_size_count(0);
+  stat->total_report_batch_size_2_to_10 = report_batch_->batch_size_count(1);
+  stat->total_report_batch_size_11_to_100 =
+      report_batch_->batch_size_count(2);
+  stat->total_report_batch_size_101_to_1000 =
+      report_batch_->batch_size_count(3);
+  stat->total_report_batch_size_over_1000 =
+      report_batch_->batch_size_count(4);
+  stat->total_dropped_reports = report_batch_->total_dropped_reports();
+
+  CacheStats check_cache_stats;
+  check_cache_->GetStats(&check_cache_stats);
+  stat->total_check_cache_evictions = check_cache_stats.evictions;
+  stat->total_check_cache_expirations = check_cache_stats.expirations;
+  stat->check_cache_entries = check_cache_stats.entries;
+  stat->check_cache_lru_age_ms = check_cache_stats.lru_age_ms;
+  CacheStats quota_cache_stats;
+  quota_cache_->GetStats(&quota_cache_stats);
+  stat->total_quota_cache_evictions = quota_cache_stats.evictions;
+  stat->total_quota_cache_expirations = quota_cache_stats.expirations;
+  stat->quota_cache_entries = quota_cache_stats.entries;
+  stat->quota_cache_lru_age_ms = quota_cache_stats.lru_age_ms;
+
+  const LatencyHistogram &check_latency = timed_check_transport_->latency();
+  stat->check_latency_p50_us = check_latency.Percentile(50);
+  stat->check_latency_p90_us = check_latency.Percentile(90);
+  stat->check_latency_p99_us = check_latency.Percentile(99);
+  stat->quota_latency_p50_us = quota_latency_.Percentile(50);
+  stat->quota_latency_p90_us = quota_latency_.Percentile(90);
+  stat->quota_latency_p99_us = quota_latency_.Percentile(99);
+  const LatencyHistogram &report_latency = report_batch_->latency();
+  stat->report_latency_p50_us = report_latency.Percentile(50);
+  stat->report_latency_p90_us = report_latency.Percentile(90);
+  stat->report_latency_p99_us = report_latency.Percentile(99);
 }
 
 // Creates a MixerClient object.
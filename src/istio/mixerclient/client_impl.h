@@ -17,12 +17,20 @@
 #define ISTIO_MIXERCLIENT_CLIENT_IMPL_H
 
 #include "include/istio/mixerclient/client.h"
+#include "include/istio/utils/hash128.h"
 #include "src/istio/mixerclient/attribute_compressor.h"
 #include "src/istio/mixerclient/check_cache.h"
+#include "src/istio/mixerclient/latency_histogram.h"
 #include "src/istio/mixerclient/quota_cache.h"
 #include "src/istio/mixerclient/report_batch.h"
+#include "src/istio/mixerclient/timed_check_transport.h"
 
 #include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace istio {
 namespace mixerclient {
@@ -44,6 +52,72 @@ class MixerClientImpl : public MixerClient {
   void GetStatistics(Statistics* stat) const override;
 
  private:
+  // The per call state of a Check. It holds everything needed by a remote
+  // Check call, so the call needs no other allocations. Contexts are pooled
+  // and reused.
+  struct CheckContext {
+    // Clear the state for a new call.
+    void Reset();
+
+    CheckCache::CheckResult check_result;
+    QuotaCache::CheckResult quota_result;
+    ::istio::mixer::v1::CheckRequest request;
+    ::istio::mixer::v1::CheckResponse response;
+    // The referenced attributes decoded from the request for processing
+    // the response.
+    ::istio::mixer::v1::Attributes referenced_attributes;
+    CheckDoneFunc on_done;
+    // When the remote call is made.
+    std::chrono::steady_clock::time_point start_time;
+  };
+
+  // Decode the attributes referenced by the response from the request.
+  void ExtractReferencedAttributes(CheckContext* context);
+
+  // Return a CheckContext to the pool when it is deleted.
+  class CheckContextReleaser {
+   public:
+    CheckContextReleaser(MixerClientImpl* client = nullptr)
+        : client_(client) {}
+    void operator()(CheckContext* context) const;
+
+   private:
+    MixerClientImpl* client_;
+  };
+  using CheckContextPtr = std::unique_ptr<CheckContext, CheckContextReleaser>;
+
+  // Get a reset CheckContext from the pool.
+  CheckContextPtr AcquireCheckContext();
+
+  // Return the context to the pool, or delete it if the pool is full.
+  void ReleaseCheckContext(CheckContext* context);
+
+  // A remote Check call shared by concurrent identical requests.
+  struct InFlightCheck {
+    // The requests waiting for the response, keyed by waiter id.
+    std::map<uint64_t, CheckDoneFunc> waiters;
+    uint64_t next_waiter_id = 0;
+    // To cancel the remote call.
+    CancelFunc cancel;
+    // True if the call is completed or cancelled.
+    bool done = false;
+  };
+
+  // Add on_done as a waiter of the in-flight call, return its cancel
+  // function. Called with coalesce_mutex_.
+  CancelFunc AddWaiterWithLock(const utils::Hash128& key,
+                               std::shared_ptr<InFlightCheck> flight,
+                               CheckDoneFunc on_done);
+
+  // Complete all waiters of the in-flight call.
+  void CompleteInFlight(const utils::Hash128& key,
+                        std::shared_ptr<InFlightCheck> flight,
+                        const CheckResponseInfo& info);
+
+  // Remove the in-flight call from the map. Called with coalesce_mutex_.
+  void RemoveInFlightWithLock(const utils::Hash128& key,
+                              const std::shared_ptr<InFlightCheck>& flight);
+
   // Store the options
   MixerClientOptions options_;
 
@@ -56,6 +130,22 @@ class MixerClientImpl : public MixerClient {
   std::unique_ptr<ReportBatch> report_batch_;
   // Cache for Quota call.
   std::unique_ptr<QuotaCache> quota_cache_;
+  // Timeout and hedging of remote Check calls.
+  std::unique_ptr<TimedCheckTransport> timed_check_transport_;
+  // The latency of remote Check calls with quotas.
+  LatencyHistogram quota_latency_;
+
+  // The in-flight remote Check calls keyed by the hash of attributes.
+  std::unordered_map<utils::Hash128, std::shared_ptr<InFlightCheck>,
+                     utils::Hash128Hasher>
+      in_flight_checks_;
+  // Mutex guarding in_flight_checks_ and their waiters.
+  std::mutex coalesce_mutex_;
+
+  // The free CheckContexts.
+  std::vector<std::unique_ptr<CheckContext>> free_check_contexts_;
+  // Mutex guarding free_check_contexts_.
+  std::mutex check_context_mutex_;
 
   // for deduplication_id
   std::string deduplication_id_base_;
@@ -69,6 +159,7 @@ class MixerClientImpl : public MixerClient {
   std::atomic_int_fast64_t total_check_calls_;
   std::atomic_int_fast64_t total_remote_check_calls_;
   std::atomic_int_fast64_t total_blocking_remote_check_calls_;
+  std::atomic_int_fast64_t total_refresh_check_calls_;
   std::atomic_int_fast64_t total_quota_calls_;
   std::atomic_int_fast64_t total_remote_quota_calls_;
   std::atomic_int_fast64_t total_blocking_remote_quota_calls_;
@@ -25,6 +25,7 @@ using ::google::protobuf::util::error::Code;
 using ::istio::mixer::v1::Attributes;
 using ::istio::mixer::v1::CheckRequest;
 using ::istio::mixer::v1::CheckResponse;
+using ::istio::mixer::v1::ReferencedAttributes;
 using ::istio::mixerclient::CheckResponseInfo;
 using ::istio::quota_config::Requirement;
 using ::testing::Invoke;
@@ -66,6 +67,28 @@ class MixerClientImplTest : public ::testing::Test {
     client_ = CreateMixerClient(options);
   }
 
+  // Create a client coalescing Check calls, without quota cache.
+  void CreateCoalescingClient() {
+    MixerClientOptions options(CheckOptions(10 /* entries */),
+                               ReportOptions(1, 1000),
+                               QuotaOptions(0 /* entries */, 600000));
+    options.check_options.network_fail_open = false;
+    options.check_options.coalesce_check_calls = true;
+    options.env.check_transport = mock_check_transport_.GetFunc();
+    client_ = CreateMixerClient(options);
+  }
+
+  // Set an OK response referencing target.service. Its cache entry is
+  // never used, so later requests are still cache misses.
+  static void SetReferencedResponse(CheckResponse* response) {
+    response->mutable_precondition()->set_valid_use_count(0);
+    auto match = response->mutable_precondition()
+                     ->mutable_referenced_attributes()
+                     ->add_attribute_matches();
+    match->set_condition(ReferencedAttributes::EXACT);
+    match->set_name(9);  // target.service is used.
+  }
+
   Attributes request_;
   std::vector<Requirement> quotas_;
   std::unique_ptr<MixerClient> client_;
@@ -113,6 +136,184 @@ TEST_F(MixerClientImplTest, TestSuccessCheck) {
   EXPECT_EQ(stat.total_blocking_remote_quota_calls, 0);
 }
 
+TEST_F(MixerClientImplTest, TestBackgroundRefresh) {
+  MixerClientOptions options(CheckOptions(1 /* entries */),
+                             ReportOptions(1, 1000),
+                             QuotaOptions(1 /* entries */, 600000));
+  options.check_options.network_fail_open = false;
+  options.check_options.enable_background_refresh = true;
+  options.check_options.refresh_use_count = 1;
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  client_ = CreateMixerClient(options);
+
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillRepeatedly(Invoke([](const CheckRequest& request,
+                                CheckResponse* response, DoneFunc on_done) {
+        response->mutable_precondition()->set_valid_use_count(3);
+        on_done(Status::OK);
+      }));
+
+  // Not to test quota
+  std::vector<Requirement> empty_quotas;
+  for (int i = 0; i < 10; i++) {
+    CheckResponseInfo check_response_info;
+    client_->Check(request_, empty_quotas, empty_transport_,
+                   [&check_response_info](const CheckResponseInfo& info) {
+                     check_response_info.response_status =
+                         info.response_status;
+                   });
+    EXPECT_TRUE(check_response_info.response_status.ok());
+  }
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_check_calls, 10);
+  // Only the first check call is blocking. The entry is refreshed when it
+  // has one use left, at the 3rd, 5th, 7th and 9th calls.
+  EXPECT_EQ(stat.total_remote_check_calls, 5);
+  EXPECT_EQ(stat.total_blocking_remote_check_calls, 1);
+  EXPECT_EQ(stat.total_refresh_check_calls, 4);
+}
+
+TEST_F(MixerClientImplTest, TestCoalesceCheckCalls) {
+  CreateCoalescingClient();
+  utils::AttributesBuilder(&request_).AddString("target.service", "a");
+  std::vector<DoneFunc> pending;
+  int transport_calls = 0;
+  TransportCheckFunc transport = [&](const CheckRequest& request,
+                                     CheckResponse* response,
+                                     DoneFunc on_done) -> CancelFunc {
+    ++transport_calls;
+    SetReferencedResponse(response);
+    pending.push_back(on_done);
+    return nullptr;
+  };
+
+  // Not to test quota
+  std::vector<Requirement> empty_quotas;
+  int done_calls = 0;
+  CheckDoneFunc on_done = [&done_calls](const CheckResponseInfo& info) {
+    EXPECT_TRUE(info.response_status.ok());
+    ++done_calls;
+  };
+
+  for (int i = 0; i < 3; i++) {
+    client_->Check(request_, empty_quotas, transport, on_done);
+  }
+  // Different attributes are not coalesced.
+  Attributes other_request;
+  utils::AttributesBuilder(&other_request).AddString("target.service", "b");
+  client_->Check(other_request, empty_quotas, transport, on_done);
+  EXPECT_EQ(transport_calls, 2);
+  EXPECT_EQ(done_calls, 0);
+
+  for (const auto& done : pending) {
+    done(Status::OK);
+  }
+  EXPECT_EQ(done_calls, 4);
+
+  Statistics stat;
+  client_->GetStatistics(&stat);
+  EXPECT_EQ(stat.total_check_calls, 4);
+  EXPECT_EQ(stat.total_remote_check_calls, 2);
+  EXPECT_EQ(stat.total_blocking_remote_check_calls, 2);
+}
+
+TEST_F(MixerClientImplTest, TestNotCoalesceSameSignature) {
+  CreateCoalescingClient();
+  std::vector<DoneFunc> pending;
+  TransportCheckFunc transport = [&](const CheckRequest& request,
+                                     CheckResponse* response,
+                                     DoneFunc on_done) -> CancelFunc {
+    SetReferencedResponse(response);
+    pending.push_back(on_done);
+    return nullptr;
+  };
+
+  // Not to test quota
+  std::vector<Requirement> empty_quotas;
+  utils::AttributesBuilder(&request_).AddString("target.service", "a");
+  client_->Check(request_, empty_quotas, transport,
+                 [](const CheckResponseInfo& info) {});
+  ASSERT_EQ(pending.size(), 1);
+  pending[0](Status::OK);
+  pending.clear();
+
+  // Both requests match the learned referenced with the same signature,
+  // but Mixer denies the second one because of source.user.
+  Attributes allowed;
+  utils::AttributesBuilder allowed_builder(&allowed);
+  allowed_builder.AddString("target.service", "a");
+  allowed_builder.AddString("source.user", "alice");
+  Attributes denied;
+  utils::AttributesBuilder denied_builder(&denied);
+  denied_builder.AddString("target.service", "a");
+  denied_builder.AddString("source.user", "mallory");
+  Status allowed_status(Code::UNKNOWN, "");
+  Status denied_status(Code::UNKNOWN, "");
+  client_->Check(allowed, empty_quotas, transport,
+                 [&allowed_status](const CheckResponseInfo& info) {
+                   allowed_status = info.response_status;
+                 });
+  client_->Check(denied, empty_quotas, transport,
+                 [&denied_status](const CheckResponseInfo& info) {
+                   denied_status = info.response_status;
+                 });
+  ASSERT_EQ(pending.size(), 2);
+
+  pending[1](Status(Code::PERMISSION_DENIED, ""));
+  pending[0](Status::OK);
+  EXPECT_TRUE(allowed_status.ok());
+  EXPECT_EQ(denied_status.error_code(), Code::PERMISSION_DENIED);
+}
+
+TEST_F(MixerClientImplTest, TestCancelCoalescedCheckCalls) {
+  CreateCoalescingClient();
+  utils::AttributesBuilder(&request_).AddString("target.service", "a");
+  DoneFunc pending;
+  int cancel_calls = 0;
+  TransportCheckFunc transport = [&](const CheckRequest& request,
+                                     CheckResponse* response,
+                                     DoneFunc on_done) -> CancelFunc {
+    SetReferencedResponse(response);
+    pending = on_done;
+    return [&cancel_calls]() { ++cancel_calls; };
+  };
+
+  // Not to test quota
+  std::vector<Requirement> empty_quotas;
+  int done_calls = 0;
+  std::vector<CancelFunc> cancels;
+  for (int i = 0; i < 3; i++) {
+    cancels.push_back(
+        client_->Check(request_, empty_quotas, transport,
+                       [&done_calls](const CheckResponseInfo& info) {
+                         ++done_calls;
+                       }));
+  }
+
+  // The remote call is kept while other requests are waiting.
+  cancels[0]();
+  cancels[1]();
+  EXPECT_EQ(cancel_calls, 0);
+  pending(Status::OK);
+  EXPECT_EQ(done_calls, 1);
+
+  // Cancel all waiters cancels the remote call.
+  cancels.clear();
+  for (int i = 0; i < 2; i++) {
+    cancels.push_back(
+        client_->Check(request_, empty_quotas, transport,
+                       [&done_calls](const CheckResponseInfo& info) {
+                         ++done_calls;
+                       }));
+  }
+  cancels[0]();
+  cancels[1]();
+  EXPECT_EQ(cancel_calls, 1);
+  EXPECT_EQ(done_calls, 1);
+}
+
 TEST_F(MixerClientImplTest, TestPerRequestTransport) {
   // Global transport should not be called.
   EXPECT_CALL(mock_check_transport_, Check(_, _, _)).Times(0);
@@ -250,6 +451,37 @@ TEST_F(MixerClientImplTest, TestNoQuotaCache) {
   EXPECT_EQ(stat.total_blocking_remote_quota_calls, 11);
 }
 
+TEST_F(MixerClientImplTest, TestLatencyRecordFuncs) {
+  MixerClientOptions options(CheckOptions(0 /* entries */),
+                             ReportOptions(1, 1000),
+                             QuotaOptions(0 /* entries */, 600000));
+  int check_samples = 0;
+  int quota_samples = 0;
+  options.env.check_latency_func = [&check_samples](int64_t latency_us) {
+    EXPECT_GE(latency_us, 0);
+    ++check_samples;
+  };
+  options.env.quota_latency_func = [&quota_samples](int64_t latency_us) {
+    ++quota_samples;
+  };
+  options.env.check_transport = mock_check_transport_.GetFunc();
+  client_ = CreateMixerClient(options);
+  EXPECT_CALL(mock_check_transport_, Check(_, _, _))
+      .WillRepeatedly(Invoke([](const CheckRequest& request,
+                                CheckResponse* response, DoneFunc on_done) {
+        response->mutable_precondition()->set_valid_use_count(1000);
+        on_done(Status::OK);
+      }));
+
+  std::vector<Requirement> empty_quotas;
+  client_->Check(request_, empty_quotas, empty_transport_,
+                 [](const CheckResponseInfo& info) {});
+  client_->Check(request_, quotas_, empty_transport_,
+                 [](const CheckResponseInfo& info) {});
+  EXPECT_EQ(check_samples, 2);
+  EXPECT_EQ(quota_samples, 1);
+}
+
 TEST_F(MixerClientImplTest, TestSuccessCheckAndQuota) {
   int call_counts = 0;
   EXPECT_CALL(mock_check_transport_, Check(_, _, _))
@@ -293,6 +525,15 @@ TEST_F(MixerClientImplTest, TestSuccessCheckAndQuota) {
   EXPECT_EQ(stat.total_quota_calls, 11);
   EXPECT_LE(stat.total_remote_quota_calls, 3);
   EXPECT_EQ(stat.total_blocking_remote_quota_calls, 1);
+
+  EXPECT_EQ(stat.check_cache_entries, 1);
+  EXPECT_EQ(stat.quota_cache_entries, 1);
+  EXPECT_EQ(stat.total_check_cache_evictions, 0);
+  EXPECT_EQ(stat.total_quota_cache_evictions, 0);
+  EXPECT_GT(stat.check_latency_p50_us, 0);
+  EXPECT_GE(stat.check_latency_p99_us, stat.check_latency_p50_us);
+  EXPECT_GT(stat.quota_latency_p50_us, 0);
+  EXPECT_EQ(stat.report_latency_p50_us, 0);
 }
 
 TEST_F(MixerClientImplTest, TestFailedCheckAndQuota) {
@@ -33,6 +33,9 @@ TOP = r"""/* Copyright 2017 Istio Authors. All Rights Reserved.
 
 #include "src/istio/mixerclient/global_dictionary.h"
 
+#include <stdint.h>
+#include <string.h>
+
 namespace istio {
 namespace mixerclient {
 namespace {
@@ -49,21 +52,156 @@ namespace {
 const std::vector<std::string> kGlobalWords{
 """
 
-BOTTOM = r"""};
+MIDDLE = r"""};
+
+// A minimal perfect hash table of kGlobalWords. The low bits of a word hash
+// select a displacement, the high bits xor the displacement select a slot,
+// and kSlots maps the slot to the word index.
+"""
+
+BOTTOM = r"""
+// Read 8 bytes in little endian order.
+uint64_t Load64(const char* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  value = __builtin_bswap64(value);
+#endif
+  return value;
+}
+
+uint64_t HashChunk(uint64_t h, uint64_t chunk) {
+  h = (h ^ chunk) * 0x100000001b3ULL;
+  return h ^ (h >> 29);
+}
+
+// Hash 8 bytes at a time. The last chunk overlaps the previous one.
+uint64_t HashWord(const char* data, size_t size) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ size;
+  if (size >= 8) {
+    for (size_t i = 0; i + 8 < size; i += 8) {
+      h = HashChunk(h, Load64(data + i));
+    }
+    h = HashChunk(h, Load64(data + size - 8));
+  } else {
+    uint64_t chunk = 0;
+    for (size_t i = size; i > 0; --i) {
+      chunk = (chunk << 8) | static_cast<unsigned char>(data[i - 1]);
+    }
+    h = HashChunk(h, chunk);
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
 
 }  // namespace
 
 const std::vector<std::string>& GetGlobalWords() { return kGlobalWords; }
 
+int FindGlobalWord(const std::string& word) {
+  uint64_t h = HashWord(word.data(), word.size());
+  uint32_t d = kDisplacements[h % kHashTableSize];
+  int index = kSlots[(static_cast<uint32_t>(h >> 32) ^ d) % kHashTableSize];
+  return kGlobalWords[index] == word ? index : -1;
+}
+
 }  // namespace mixerclient
 }  // namespace istio"""
 
-all_words = ''
+MASK = (1 << 64) - 1
+
+
+def hash_chunk(h, data):
+    chunk = 0
+    for byte in reversed(data):
+        chunk = (chunk << 8) | byte
+    h = ((h ^ chunk) * 0x100000001b3) & MASK
+    return h ^ (h >> 29)
+
+
+def hash_word(word):
+    """The same as HashWord() in the generated code."""
+    data = bytearray(word if isinstance(word, bytes) else word.encode('utf-8'))
+    size = len(data)
+    h = 0xcbf29ce484222325 ^ size
+    if size >= 8:
+        i = 0
+        while i + 8 < size:
+            h = hash_chunk(h, data[i:i + 8])
+            i += 8
+        h = hash_chunk(h, data[size - 8:])
+    else:
+        h = hash_chunk(h, data)
+    h ^= h >> 33
+    h = (h * 0xff51afd7ed558ccd) & MASK
+    h ^= h >> 33
+    return h
+
+
+def perfect_hash(words):
+    """Return displacements and slots of a minimal perfect hash table."""
+    # Keep the last index of a duplicated word.
+    indices = {}
+    for index, word in enumerate(words):
+        indices[word] = index
+    hashes = {}
+    for word, index in indices.items():
+        h = hash_word(word)
+        if h in hashes:
+            sys.exit('Hash collision: %s %s' % (word, words[hashes[h]]))
+        hashes[h] = index
+
+    size = len(hashes)
+    buckets = [[] for _ in range(size)]
+    for h in hashes:
+        buckets[h % size].append(h)
+    displacements = [0] * size
+    slots = [-1] * size
+    # Place big buckets first, a single word takes a free slot directly.
+    for b in sorted(range(size), key=lambda b: (-len(buckets[b]), b)):
+        bucket = buckets[b]
+        if not bucket:
+            break
+        if len(bucket) == 1:
+            d = (bucket[0] >> 32) ^ slots.index(-1)
+        else:
+            d = 0
+            while True:
+                placed = set(((h >> 32) ^ d) % size for h in bucket)
+                if len(placed) == len(bucket) and all(
+                        slots[s] < 0 for s in placed):
+                    break
+                d += 1
+        displacements[b] = d
+        for h in bucket:
+            slots[((h >> 32) ^ d) % size] = hashes[h]
+    return displacements, slots
+
+
+def format_array(type_name, name, values):
+    lines = ''
+    for i in range(0, len(values), 8):
+        lines += '    ' + ', '.join(str(v) for v in values[i:i + 8]) + ',\n'
+    return 'constexpr %s %s[] = {\n%s};\n' % (type_name, name, lines)
+
+
+words = []
 with open(sys.argv[1]) as src_file:
     for line in src_file:
         if line.startswith("-"):
-            all_words += "    \"" + line[1:].strip() + "\",\n"
+            words.append(line[1:].strip())
+if not words:
+    sys.exit('No words in ' + sys.argv[1])
 
-print TOP + all_words + BOTTOM
+all_words = ''
+for word in words:
+    all_words += "    \"" + word + "\",\n"
 
+displacements, slots = perfect_hash(words)
+table = 'constexpr uint64_t kHashTableSize = %d;\n' % len(slots)
+table += format_array('uint32_t', 'kDisplacements', displacements)
+table += format_array('int32_t', 'kSlots', slots)
 
+print(TOP + all_words + MIDDLE + table + BOTTOM)
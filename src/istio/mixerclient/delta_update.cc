@@ -14,52 +14,139 @@
  */
 #include "src/istio/mixerclient/delta_update.h"
 
-#include "google/protobuf/util/message_differencer.h"
+#include <vector>
 
-#include <set>
-
-using ::google::protobuf::util::MessageDifferencer;
 using ::istio::mixer::v1::Attributes_AttributeValue;
 
 namespace istio {
 namespace mixerclient {
 namespace {
 
+// Compare two attribute values by their value types, much faster than the
+// reflection based MessageDifferencer.
+bool ValueEquals(const Attributes_AttributeValue& a,
+                 const Attributes_AttributeValue& b) {
+  if (a.value_case() != b.value_case()) {
+    return false;
+  }
+  switch (a.value_case()) {
+    case Attributes_AttributeValue::kStringValue:
+      return a.string_value() == b.string_value();
+    case Attributes_AttributeValue::kBytesValue:
+      return a.bytes_value() == b.bytes_value();
+    case Attributes_AttributeValue::kInt64Value:
+      return a.int64_value() == b.int64_value();
+    case Attributes_AttributeValue::kDoubleValue:
+      return a.double_value() == b.double_value();
+    case Attributes_AttributeValue::kBoolValue:
+      return a.bool_value() == b.bool_value();
+    case Attributes_AttributeValue::kTimestampValue:
+      return a.timestamp_value().seconds() == b.timestamp_value().seconds() &&
+             a.timestamp_value().nanos() == b.timestamp_value().nanos();
+    case Attributes_AttributeValue::kDurationValue:
+      return a.duration_value().seconds() == b.duration_value().seconds() &&
+             a.duration_value().nanos() == b.duration_value().nanos();
+    case Attributes_AttributeValue::kStringMapValue: {
+      const auto& a_entries = a.string_map_value().entries();
+      const auto& b_entries = b.string_map_value().entries();
+      if (a_entries.size() != b_entries.size()) {
+        return false;
+      }
+      for (const auto& it : a_entries) {
+        const auto& b_it = b_entries.find(it.first);
+        if (b_it == b_entries.end() || b_it->second != it.second) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case Attributes_AttributeValue::VALUE_NOT_SET:
+      return true;
+  }
+  return false;
+}
+
 class DeltaUpdateImpl : public DeltaUpdate {
  public:
   // Start a update for a request.
   void Start() override {
-    prev_set_.clear();
-    for (const auto& it : prev_map_) {
-      prev_set_.insert(it.first);
-    }
+    ++generation_;
+    start_count_ = count_;
+    checked_count_ = 0;
   }
 
   bool Check(int index, const Attributes_AttributeValue& value) override {
+    Entry& entry = GetEntry(index);
+    if (!entry.value) {
+      // A new attribute.
+      ++count_;
+      entry.value.reset(new Attributes_AttributeValue(value));
+      entry.generation = generation_;
+      return false;
+    }
     bool same = false;
-    const auto& it = prev_map_.find(index);
-    if (it != prev_map_.end()) {
-      if (MessageDifferencer::Equals(it->second, value)) {
-        same = true;
-      }
+    if (entry.generation != generation_) {
+      ++checked_count_;
+      same = ValueEquals(*entry.value, value);
     }
     if (!same) {
-      prev_map_[index] = value;
+      *entry.value = value;
     }
-    prev_set_.erase(index);
+    entry.generation = generation_;
     return same;
   }
 
   // "deleted" is not supported for now. If some attributes are missing,
   // return false to indicate delta update is not supported.
-  bool Finish() override { return prev_set_.empty(); }
+  bool Finish() override { return checked_count_ == start_count_; }
+
+  size_t size() const override { return count_; }
+
+  bool Contains(int index) const override {
+    size_t pos = Position(index);
+    return pos < entries_.size() && entries_[pos].value;
+  }
 
  private:
-  // The remaining attributes from previous.
-  std::set<int> prev_set_;
+  struct Entry {
+    // The generation of the last Check.
+    uint64_t generation = 0;
+    // The value from previous, nullptr if never checked. Allocated on
+    // demand to keep entries_ cheap to grow.
+    std::unique_ptr<Attributes_AttributeValue> value;
+  };
+
+  // Return the position of a dictionary index in entries_. Global word
+  // indices are positive, per message word indices are negative, interleave
+  // them.
+  static size_t Position(int index) {
+    return index >= 0 ? 2 * static_cast<size_t>(index)
+                      : 2 * static_cast<size_t>(-(index + 1)) + 1;
+  }
+
+  // Get the entry of a dictionary index.
+  Entry& GetEntry(int index) {
+    size_t pos = Position(index);
+    if (pos >= entries_.size()) {
+      entries_.resize(pos + 1);
+    }
+    return entries_[pos];
+  }
+
+  // The attributes from previous, addressed by dictionary index.
+  std::vector<Entry> entries_;
+
+  // The current generation, increased for each Start().
+  uint64_t generation_ = 0;
+
+  // The number of attributes in entries_.
+  size_t count_ = 0;
+
+  // The number of attributes at Start().
+  size_t start_count_ = 0;
 
-  // The attribute map from previous.
-  std::map<int, Attributes_AttributeValue> prev_map_;
+  // The number of attributes from previous checked after Start().
+  size_t checked_count_ = 0;
 };
 
 // An optimization for non-delta update case.
@@ -70,6 +157,8 @@ class DeltaUpdateNoOpImpl : public DeltaUpdate {
     return false;
   }
   bool Finish() override { return true; }
+  size_t size() const override { return 0; }
+  bool Contains(int index) const override { return false; }
 };
 
 }  // namespace
@@ -46,6 +46,12 @@ class DeltaUpdate {
   // missing, delta update will not be supported.
   virtual bool Finish() = 0;
 
+  // Return the number of attributes in the previous set.
+  virtual size_t size() const = 0;
+
+  // Return true if the attribute is in the previous set.
+  virtual bool Contains(int index) const = 0;
+
   // Create an instance.
   static std::unique_ptr<DeltaUpdate> Create();
 
@@ -16,6 +16,9 @@
 #include "src/istio/mixerclient/delta_update.h"
 #include "gtest/gtest.h"
 
+#include <chrono>
+#include <iostream>
+
 using ::istio::mixer::v1::Attributes_AttributeValue;
 
 namespace istio {
@@ -92,11 +95,120 @@ TEST_F(DeltaUpdateTest, TestUpdateWithDelete) {
   EXPECT_FALSE(update_->Finish());
 }
 
+TEST_F(DeltaUpdateTest, TestContains) {
+  EXPECT_EQ(update_->size(), 3u);
+  EXPECT_TRUE(update_->Contains(1));
+  EXPECT_TRUE(update_->Contains(3));
+  EXPECT_FALSE(update_->Contains(4));
+  EXPECT_FALSE(update_->Contains(-1));
+
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_TRUE(update_->Check(3, string_map_value_));
+  EXPECT_FALSE(update_->Check(-1, Int64Value(1)));
+  EXPECT_TRUE(update_->Finish());
+  EXPECT_EQ(update_->size(), 4u);
+  EXPECT_TRUE(update_->Contains(-1));
+}
+
 TEST_F(DeltaUpdateTest, TestDifferentType) {
   update_->Start();
   // 1 is differnt type.
   EXPECT_FALSE(update_->Check(1, StringValue("")));
 }
 
+TEST_F(DeltaUpdateTest, TestMessageIndex) {
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_TRUE(update_->Check(3, string_map_value_));
+  // Per message word indices are negative.
+  EXPECT_FALSE(update_->Check(-1, StringValue("foo")));
+  EXPECT_FALSE(update_->Check(-2, StringValue("bar")));
+  EXPECT_TRUE(update_->Finish());
+
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_TRUE(update_->Check(3, string_map_value_));
+  EXPECT_TRUE(update_->Check(-1, StringValue("foo")));
+  EXPECT_FALSE(update_->Check(-2, StringValue("foo")));
+  EXPECT_TRUE(update_->Finish());
+
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_TRUE(update_->Check(3, string_map_value_));
+  // -1 is missing
+  EXPECT_TRUE(update_->Check(-2, StringValue("foo")));
+  EXPECT_FALSE(update_->Finish());
+}
+
+TEST_F(DeltaUpdateTest, TestStringMap) {
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_FALSE(update_->Check(3, StringMapValue({{"foo", "baz"}})));
+  EXPECT_TRUE(update_->Finish());
+
+  update_->Start();
+  EXPECT_TRUE(update_->Check(1, Int64Value(1)));
+  EXPECT_TRUE(update_->Check(2, Int64Value(2)));
+  EXPECT_FALSE(update_->Check(3, StringMapValue({{"foo", "baz"}, {"a", "b"}})));
+  EXPECT_TRUE(update_->Finish());
+}
+
+// Check a batch of 1000 reports with typical HTTP attributes.
+TEST_F(DeltaUpdateTest, TestReportBatchPerf) {
+  const int kReports = 1000;
+  std::vector<std::vector<std::pair<int, Attributes_AttributeValue>>> reports;
+  for (int r = 0; r < kReports; ++r) {
+    std::vector<std::pair<int, Attributes_AttributeValue>> report;
+    for (int i = 0; i < 12; ++i) {
+      // Source and destination attributes are the same.
+      report.emplace_back(i, StringValue("service-" + std::to_string(i)));
+    }
+    report.emplace_back(12, Int64Value(8080));
+    report.emplace_back(13, StringValue("/books/" + std::to_string(r % 10)));
+    report.emplace_back(14, StringValue("request-" + std::to_string(r)));
+    report.emplace_back(15, Int64Value(r % 7 == 0 ? 503 : 200));
+    report.emplace_back(16, Int64Value(1000 + r % 100));
+    report.emplace_back(17, Int64Value(2000 + r % 300));
+    report.emplace_back(-1, StringValue("custom"));
+    report.emplace_back(20, StringMapValue({{":method", "GET"},
+                                            {":path", "/books"},
+                                            {":authority", "bookinfo"},
+                                            {"user-agent", "curl"},
+                                            {"accept", "*/*"},
+                                            {"x-request-id", "request"}}));
+    report.emplace_back(
+        21, StringMapValue({{":status", r % 7 == 0 ? "503" : "200"},
+                            {"content-type", "application/json"},
+                            {"server", "envoy"}}));
+    reports.push_back(std::move(report));
+  }
+
+  const int kLoops = 10;
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < kLoops; ++n) {
+    auto update = DeltaUpdate::Create();
+    for (const auto& report : reports) {
+      update->Start();
+      for (const auto& it : report) {
+        update->Check(it.first, it.second);
+      }
+      EXPECT_TRUE(update->Finish());
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cerr << "===DeltaUpdate of " << kReports << " reports: "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                       .count() /
+                   (kLoops * kReports)
+            << " ns per report" << std::endl;
+}
+
 }  // namespace mixerclient
 }  // namespace istio
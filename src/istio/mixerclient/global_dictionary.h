@@ -25,6 +25,10 @@ namespace mixerclient {
 // Get automatically generated global words.
 const std::vector<std::string>& GetGlobalWords();
 
+// Find a word in the global words with a generated perfect hash table.
+// Return its index, or -1 if it is not a global word.
+int FindGlobalWord(const std::string& word);
+
 }  // namespace mixerclient
 }  // namespace istio
 
@@ -0,0 +1,93 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/latency_histogram.h"
+
+namespace istio {
+namespace mixerclient {
+
+LatencyHistogram::LatencyHistogram(int64_t max_samples,
+                                   LatencyRecordFunc on_record)
+    : max_samples_(max_samples), on_record_(on_record), count_(0) {
+  for (auto& count : counts_) {
+    count = 0;
+  }
+}
+
+int LatencyHistogram::Bucket(int64_t latency_us) {
+  if (latency_us < 4) {
+    return latency_us < 0 ? 0 : static_cast<int>(latency_us);
+  }
+  int log = 63 - __builtin_clzll(static_cast<uint64_t>(latency_us));
+  int sub = static_cast<int>((latency_us >> (log - 2)) & 3);
+  int bucket = 4 + (log - 2) * 4 + sub;
+  return bucket < kNumBuckets ? bucket : kNumBuckets - 1;
+}
+
+int64_t LatencyHistogram::BucketUpperBound(int bucket) {
+  if (bucket < 4) {
+    return bucket + 1;
+  }
+  int log = (bucket - 4) / 4 + 2;
+  int sub = (bucket - 4) % 4;
+  return (1LL << log) + (sub + 1) * (1LL << (log - 2));
+}
+
+void LatencyHistogram::Record(int64_t latency_us) {
+  if (on_record_) {
+    on_record_(latency_us);
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++counts_[Bucket(latency_us)];
+  if (++count_ < max_samples_ || max_samples_ == 0) {
+    return;
+  }
+  count_ = 0;
+  for (auto& count : counts_) {
+    count /= 2;
+    count_ += count;
+  }
+}
+
+int64_t LatencyHistogram::Percentile(double percentile) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (count_ == 0) {
+    return 0;
+  }
+  // The rank of the sample at the percentile, from 1.
+  int64_t rank = static_cast<int64_t>(count_ * percentile / 100);
+  if (rank < count_ * percentile / 100) {
+    ++rank;
+  }
+  if (rank < 1) {
+    rank = 1;
+  }
+  int64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      return BucketUpperBound(i);
+    }
+  }
+  return BucketUpperBound(kNumBuckets - 1);
+}
+
+int64_t LatencyHistogram::count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return count_;
+}
+
+}  // namespace mixerclient
+}  // namespace istio
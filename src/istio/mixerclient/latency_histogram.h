@@ -0,0 +1,67 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_LATENCY_HISTOGRAM_H
+#define ISTIO_MIXERCLIENT_LATENCY_HISTOGRAM_H
+
+#include "include/istio/mixerclient/environment.h"
+
+#include <stdint.h>
+#include <mutex>
+
+namespace istio {
+namespace mixerclient {
+
+// A histogram of latencies in microseconds to estimate percentiles.
+// Buckets are log scale, each power of 2 is split into 4 buckets, so an
+// estimate is at most 25% above the real latency. Old samples are decayed
+// to follow latency changes. This class is thread safe.
+class LatencyHistogram {
+ public:
+  // When max_samples are recorded, all counts are halved. 0 to never decay.
+  // Each recorded latency is also passed to on_record if it is set.
+  explicit LatencyHistogram(int64_t max_samples = 0,
+                            LatencyRecordFunc on_record = nullptr);
+
+  // Record a latency.
+  void Record(int64_t latency_us);
+
+  // Return the estimated latency at the percentile in (0, 100], or 0 if
+  // there is no sample.
+  int64_t Percentile(double percentile) const;
+
+  // The number of samples after decay.
+  int64_t count() const;
+
+  // Return the bucket of a latency, and the upper bound of a bucket.
+  static int Bucket(int64_t latency_us);
+  static int64_t BucketUpperBound(int bucket);
+
+  // Up to 2^27 us, about two minutes.
+  static const int kNumBuckets = 4 + 25 * 4;
+
+ private:
+  const int64_t max_samples_;
+  LatencyRecordFunc on_record_;
+
+  mutable std::mutex mutex_;
+  int64_t counts_[kNumBuckets];
+  int64_t count_;
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_LATENCY_HISTOGRAM_H
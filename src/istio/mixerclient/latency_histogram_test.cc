@@ -0,0 +1,85 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/latency_histogram.h"
+#include "gtest/gtest.h"
+
+#include <vector>
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+TEST(LatencyHistogramTest, TestBucket) {
+  for (int64_t latency : {0, 1, 3, 4, 5, 7, 8, 9, 100, 1000, 123456}) {
+    int bucket = LatencyHistogram::Bucket(latency);
+    EXPECT_LT(latency, LatencyHistogram::BucketUpperBound(bucket));
+    if (bucket > 0) {
+      EXPECT_GE(latency, LatencyHistogram::BucketUpperBound(bucket - 1));
+    }
+  }
+  // The upper bound is at most 25% above.
+  EXPECT_EQ(LatencyHistogram::BucketUpperBound(
+                LatencyHistogram::Bucket(1024 * 1024)),
+            1024 * 1024 + 256 * 1024);
+  EXPECT_EQ(LatencyHistogram::Bucket(1LL << 40),
+            LatencyHistogram::kNumBuckets - 1);
+}
+
+TEST(LatencyHistogramTest, TestPercentile) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.Percentile(99), 0);
+
+  // 1000 samples of 1 ms to 1000 ms.
+  for (int i = 1; i <= 1000; ++i) {
+    histogram.Record(i * 1000);
+  }
+  EXPECT_EQ(histogram.count(), 1000);
+
+  for (double percentile : {50.0, 90.0, 99.0, 100.0}) {
+    int64_t expected = static_cast<int64_t>(percentile * 10) * 1000;
+    int64_t estimate = histogram.Percentile(percentile);
+    EXPECT_GE(estimate, expected);
+    EXPECT_LE(estimate, expected * 5 / 4);
+  }
+}
+
+TEST(LatencyHistogramTest, TestDecay) {
+  LatencyHistogram histogram(100);
+  for (int i = 0; i < 99; ++i) {
+    histogram.Record(1000000);
+  }
+  EXPECT_GE(histogram.Percentile(50), 1000000);
+
+  // Halved at 100 samples, then new latencies take over.
+  for (int i = 0; i < 99; ++i) {
+    histogram.Record(1000);
+  }
+  EXPECT_LT(histogram.Percentile(50), 2000);
+}
+
+TEST(LatencyHistogramTest, TestOnRecord) {
+  std::vector<int64_t> samples;
+  LatencyHistogram histogram(
+      0, [&samples](int64_t latency_us) { samples.push_back(latency_us); });
+  histogram.Record(10);
+  histogram.Record(2000);
+  EXPECT_EQ(samples, std::vector<int64_t>({10, 2000}));
+  EXPECT_EQ(histogram.count(), 2);
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
@@ -16,6 +16,8 @@
 #include "src/istio/mixerclient/quota_cache.h"
 #include "include/istio/utils/protobuf.h"
 
+#include <algorithm>
+
 using namespace std::chrono;
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
@@ -29,20 +31,27 @@ using ::istio::quota_config::Requirement;
 namespace istio {
 namespace mixerclient {
 
-QuotaCache::CacheElem::CacheElem(const std::string& name) : name_(name) {
-  prefetch_ = QuotaPrefetch::Create(
-      [this](int amount, QuotaPrefetch::DoneFunc fn, QuotaPrefetch::Tick t) {
-        Alloc(amount, fn);
-      },
-      QuotaPrefetch::Options(), system_clock::now());
+QuotaCache::CacheElem::CacheElem(const std::string& name,
+                                 const QuotaOptions& options)
+    : name_(name) {
+  QuotaPrefetch::Options prefetch_options;
+  prefetch_options.num_sub_pools = options.num_sub_pools;
+  prefetch_options.rate_weight = options.rate_weight;
+  prefetch_options.trend_weight = options.trend_weight;
+  // Prefetches are sent with the transport passed to each Check().
+  prefetch_ =
+      QuotaPrefetch::Create(nullptr, prefetch_options, system_clock::now());
 }
 
-void QuotaCache::CacheElem::Alloc(int amount, QuotaPrefetch::DoneFunc fn) {
-  quota_->amount = amount;
-  quota_->best_effort = true;
-  quota_->response_func =
-      [fn](const Attributes&,
-           const CheckResponse::QuotaResult* result) -> bool {
+void QuotaCache::CacheElem::Alloc(int amount, QuotaPrefetch::DoneFunc fn,
+                                  CheckResult::Quota* quota) {
+  quota->amount = amount;
+  quota->best_effort = true;
+  // The element may be removed from the cache before the response.
+  auto self = shared_from_this();
+  quota->response_func =
+      [self, fn](const Attributes&,
+                 const CheckResponse::QuotaResult* result) -> bool {
     int amount = -1;
     milliseconds expire = duration_cast<milliseconds>(minutes(1));
     if (result != nullptr) {
@@ -57,16 +66,14 @@ void QuotaCache::CacheElem::Alloc(int amount, QuotaPrefetch::DoneFunc fn) {
 }
 
 void QuotaCache::CacheElem::Quota(int amount, CheckResult::Quota* quota) {
-  quota_ = quota;
-  if (prefetch_->Check(amount, system_clock::now())) {
+  QuotaPrefetch::TransportFunc transport =
+      [this, quota](int amount, QuotaPrefetch::DoneFunc fn,
+                    QuotaPrefetch::Tick t) { Alloc(amount, fn, quota); };
+  if (prefetch_->Check(amount, transport, system_clock::now())) {
     quota->result = CheckResult::Quota::Passed;
   } else {
     quota->result = CheckResult::Quota::Rejected;
   }
-
-  // A hack that requires prefetch code to call transport Alloc() function
-  // within Check() call.
-  quota_ = nullptr;
 }
 
 QuotaCache::CheckResult::CheckResult() : status_(Code::UNAVAILABLE, "") {}
@@ -141,8 +148,14 @@ void QuotaCache::CheckResult::SetResponse(const Status& status,
 
 QuotaCache::QuotaCache(const QuotaOptions& options) : options_(options) {
   if (options.num_entries > 0) {
-    cache_.reset(new QuotaLRUCache(options.num_entries));
-    cache_->SetMaxIdleSeconds(options.expiration_ms / 1000.0);
+    int num_shards = std::max(options.num_shards, 1);
+    int shard_entries = (options.num_entries + num_shards - 1) / num_shards;
+    for (int i = 0; i < num_shards; ++i) {
+      quota_shards_.emplace_back(new QuotaShard);
+      cache_shards_.emplace_back(new CacheShard(shard_entries));
+      cache_shards_.back()->cache.SetMaxIdleSeconds(options.expiration_ms /
+                                                    1000.0);
+    }
   }
 }
 
@@ -151,13 +164,32 @@ QuotaCache::~QuotaCache() {
   FlushAll();
 }
 
+QuotaCache::QuotaShard* QuotaCache::GetQuotaShard(
+    const std::string& quota_name) const {
+  if (quota_shards_.size() == 1) {
+    return quota_shards_[0].get();
+  }
+  return quota_shards_[std::hash<std::string>()(quota_name) %
+                       quota_shards_.size()]
+      .get();
+}
+
+QuotaCache::CacheShard* QuotaCache::GetCacheShard(
+    const utils::Hash128& signature) const {
+  if (cache_shards_.size() == 1) {
+    return cache_shards_[0].get();
+  }
+  // The low half is used by the LRU hash table, pick shard by the high half.
+  return cache_shards_[signature.high % cache_shards_.size()].get();
+}
+
 void QuotaCache::CheckCache(const Attributes& request, bool check_use_cache,
                             CheckResult::Quota* quota) {
   // If check is not using cache, that check may be rejected.
   // If quota cache is used, quota amount is already substracted from the cache.
   // If the check is rejected, there is not easy way to add them back to cache.
   // The workaround is not to use quota cache if check is not in the cache.
-  if (!cache_ || !check_use_cache) {
+  if (cache_shards_.empty() || !check_use_cache) {
     quota->best_effort = false;
     quota->result = CheckResult::Quota::Pending;
     quota->response_func =
@@ -170,26 +202,49 @@ void QuotaCache::CheckCache(const Attributes& request, bool check_use_cache,
     return;
   }
 
-  std::lock_guard<std::mutex> lock(cache_mutex_);
-  PerQuotaReferenced& quota_ref = quota_referenced_map_[quota->name];
-  for (const auto& it : quota_ref.referenced_map) {
-    const Referenced& referenced = it.second;
-    std::string signature;
-    if (!referenced.Signature(request, quota->name, &signature)) {
-      continue;
-    }
-    QuotaLRUCache::ScopedLookup lookup(cache_.get(), signature);
-    if (lookup.Found()) {
-      CacheElem* cache_elem = lookup.value();
-      cache_elem->Quota(quota->amount, quota);
-      return;
+  QuotaShard* quota_shard = GetQuotaShard(quota->name);
+  std::shared_ptr<const SignaturePlan> plan;
+  {
+    std::lock_guard<std::mutex> lock(quota_shard->mutex);
+    plan = quota_shard->quota_referenced_map[quota->name].plan;
+  }
+  if (plan) {
+    // Signatures are calculated without holding any lock.
+    SignaturePlan::Context context(*plan, request);
+    for (size_t i = 0; i < plan->size(); ++i) {
+      utils::Hash128 signature;
+      if (!context.Signature(i, quota->name, &signature)) {
+        continue;
+      }
+      std::shared_ptr<CacheElem> cache_elem;
+      {
+        CacheShard* cache_shard = GetCacheShard(signature);
+        std::lock_guard<std::mutex> lock(cache_shard->mutex);
+        QuotaLRUCache::ScopedLookup lookup(&cache_shard->cache, signature);
+        if (lookup.Found()) {
+          cache_elem = *lookup.value();
+        }
+      }
+      // The quota is checked without holding the cache lock.
+      if (cache_elem) {
+        cache_elem->Quota(quota->amount, quota);
+        return;
+      }
     }
   }
 
-  if (!quota_ref.pending_item) {
-    quota_ref.pending_item.reset(new CacheElem(quota->name));
+  std::shared_ptr<CacheElem> pending_item;
+  {
+    std::lock_guard<std::mutex> lock(quota_shard->mutex);
+    PerQuotaReferenced& quota_ref =
+        quota_shard->quota_referenced_map[quota->name];
+    if (!quota_ref.pending_item) {
+      quota_ref.pending_item =
+          std::make_shared<CacheElem>(quota->name, options_);
+    }
+    pending_item = quota_ref.pending_item;
   }
-  quota_ref.pending_item->Quota(quota->amount, quota);
+  pending_item->Quota(quota->amount, quota);
 
   auto saved_func = quota->response_func;
   std::string quota_name = quota->name;
@@ -216,7 +271,7 @@ void QuotaCache::SetResponse(const Attributes& attributes,
     return;
   }
 
-  std::string signature;
+  utils::Hash128 signature;
   if (!referenced.Signature(attributes, quota_name, &signature)) {
     GOOGLE_LOG(ERROR) << "Quota response referenced mismatchs with request";
     GOOGLE_LOG(ERROR) << "Request attributes: " << attributes.DebugString();
@@ -224,22 +279,42 @@ void QuotaCache::SetResponse(const Attributes& attributes,
     return;
   }
 
-  std::lock_guard<std::mutex> lock(cache_mutex_);
-  QuotaLRUCache::ScopedLookup lookup(cache_.get(), signature);
+  // Lock order: a cache shard, then a quota shard.
+  CacheShard* cache_shard = GetCacheShard(signature);
+  std::lock_guard<std::mutex> lock(cache_shard->mutex);
+  QuotaLRUCache::ScopedLookup lookup(&cache_shard->cache, signature);
   if (lookup.Found()) {
     // Not to override the existing cache entry.
     return;
   }
 
-  PerQuotaReferenced& quota_ref = quota_referenced_map_[quota_name];
-  std::string hash = referenced.Hash();
-  if (quota_ref.referenced_map.find(hash) == quota_ref.referenced_map.end()) {
-    quota_ref.referenced_map[hash] = referenced;
-    GOOGLE_LOG(INFO) << "Add a new Referenced for quota cache: " << quota_name
-                     << ", reference: " << referenced.DebugString();
+  std::shared_ptr<CacheElem> cache_elem;
+  {
+    QuotaShard* quota_shard = GetQuotaShard(quota_name);
+    std::lock_guard<std::mutex> quota_lock(quota_shard->mutex);
+    PerQuotaReferenced& quota_ref =
+        quota_shard->quota_referenced_map[quota_name];
+    utils::Hash128 hash = referenced.Hash();
+    if (quota_ref.referenced_map.find(hash) ==
+        quota_ref.referenced_map.end()) {
+      quota_ref.referenced_map[hash] = referenced;
+      std::vector<const Referenced*> referenced_list;
+      for (const auto& it : quota_ref.referenced_map) {
+        referenced_list.push_back(&it.second);
+      }
+      quota_ref.plan = std::make_shared<const SignaturePlan>(referenced_list);
+      GOOGLE_LOG(INFO) << "Add a new Referenced for quota cache: "
+                       << quota_name
+                       << ", reference: " << referenced.DebugString();
+    }
+    // Another response may have cached the pending item already.
+    cache_elem.swap(quota_ref.pending_item);
   }
 
-  cache_->Insert(signature, quota_ref.pending_item.release(), 1);
+  if (cache_elem) {
+    cache_shard->cache.Insert(
+        signature, new std::shared_ptr<CacheElem>(std::move(cache_elem)), 1);
+  }
 }
 
 void QuotaCache::Check(const Attributes& request,
@@ -252,13 +327,19 @@ void QuotaCache::Check(const Attributes& request,
   }
 }
 
+void QuotaCache::GetStats(CacheStats* stats) const {
+  for (const auto& shard : cache_shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats->Add(shard->cache);
+  }
+}
+
 // TODO: hookup with a timer object to call Flush() periodically.
-// Be careful; some transport callback functions may be still using
-// expired items, need to add ref_count into these callback functions.
+// Transport callback functions keep the removed items they are using.
 Status QuotaCache::Flush() {
-  if (cache_) {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    cache_->RemoveExpiredEntries();
+  for (const auto& shard : cache_shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->cache.RemoveExpiredEntries();
   }
 
   return Status::OK;
@@ -267,9 +348,9 @@ Status QuotaCache::Flush() {
 // Flush out aggregated check requests, clear all cache items.
 // Usually called at destructor.
 Status QuotaCache::FlushAll() {
-  if (cache_) {
-    std::lock_guard<std::mutex> lock(cache_mutex_);
-    cache_->RemoveAll();
+  for (const auto& shard : cache_shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->cache.RemoveAll();
   }
 
   return Status::OK;
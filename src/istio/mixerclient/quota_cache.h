@@ -18,15 +18,19 @@
 #ifndef ISTIO_MIXERCLIENT_QUOTA_CACHE_H
 #define ISTIO_MIXERCLIENT_QUOTA_CACHE_H
 
+#include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "include/istio/mixerclient/client.h"
 #include "include/istio/prefetch/quota_prefetch.h"
 #include "include/istio/utils/simple_lru_cache.h"
 #include "include/istio/utils/simple_lru_cache_inl.h"
+#include "src/istio/mixerclient/cache_stats.h"
 #include "src/istio/mixerclient/referenced.h"
+#include "src/istio/mixerclient/signature_plan.h"
 
 namespace istio {
 namespace mixerclient {
@@ -96,6 +100,9 @@ class QuotaCache {
              const std::vector<::istio::quota_config::Requirement>& quotas,
              bool use_cache, CheckResult* result);
 
+  // Get the cache counters.
+  void GetStats(CacheStats* stats) const;
+
  private:
   // Check quota cache.
   void CheckCache(const ::istio::mixer::v1::Attributes& request, bool use_cache,
@@ -109,26 +116,26 @@ class QuotaCache {
   // Usually called at destructor.
   ::google::protobuf::util::Status FlushAll();
 
-  // The cache element for each quota metric.
-  class CacheElem {
+  // The cache element for each quota metric. It is shared so that it is
+  // checked without holding the cache lock, and kept until the responses
+  // of its prefetches.
+  class CacheElem : public std::enable_shared_from_this<CacheElem> {
    public:
-    CacheElem(const std::string& name);
+    CacheElem(const std::string& name, const QuotaOptions& options);
 
-    // Use the prefetch object to check the quota.
+    // Use the prefetch object to check the quota. Thread safe.
     void Quota(int amount, CheckResult::Quota* quota);
 
     // The quota name.
     const std::string& quota_name() const { return name_; }
 
    private:
-    // The quota allocation call.
-    void Alloc(int amount, prefetch::QuotaPrefetch::DoneFunc fn);
+    // The quota allocation call, sent with the pending quota.
+    void Alloc(int amount, prefetch::QuotaPrefetch::DoneFunc fn,
+               CheckResult::Quota* quota);
 
     std::string name_;
 
-    // A temporary pending quota result.
-    CheckResult::Quota* quota_;
-
     // The prefetch object.
     std::unique_ptr<prefetch::QuotaPrefetch> prefetch_;
   };
@@ -137,33 +144,64 @@ class QuotaCache {
   struct PerQuotaReferenced {
     // Pending CacheElem for all cache miss requests.
     // This item will be added to the cache after response.
-    std::unique_ptr<CacheElem> pending_item;
+    std::shared_ptr<CacheElem> pending_item;
 
     // Referenced map keyed with their hashes
-    std::unordered_map<std::string, Referenced> referenced_map;
+    std::unordered_map<utils::Hash128, Referenced, utils::Hash128Hasher>
+        referenced_map;
+
+    // The signature plan compiled from referenced_map.
+    // Rebuilt when a new Referenced is added. It is shared to calculate
+    // signatures without holding the lock.
+    std::shared_ptr<const SignaturePlan> plan;
+  };
+
+  // A shard of the per quota data, picked by quota name.
+  struct QuotaShard {
+    // Mutex guarding the access of quota_referenced_map and its items.
+    std::mutex mutex;
+
+    // A map from quota name to PerQuotaReferenced.
+    std::unordered_map<std::string, PerQuotaReferenced> quota_referenced_map;
   };
 
+  // Key is the signature of the Attributes. Value is the CacheElem.
+  // It is a LRU cache with MaxIdelTime as response_expiration_time.
+  using QuotaLRUCache =
+      utils::SimpleLRUCache<utils::Hash128, std::shared_ptr<CacheElem>,
+                            utils::Hash128Hasher>;
+
+  // A cache shard: an independent LRU cache guarded by its own mutex.
+  struct CacheShard {
+    CacheShard(int num_entries) : cache(num_entries) {}
+
+    // Mutex guarding the access of cache.
+    std::mutex mutex;
+
+    // The cache that maps from key to prefetch object
+    QuotaLRUCache cache;
+  };
+
+  // Get the shard owning the quota name.
+  QuotaShard* GetQuotaShard(const std::string& quota_name) const;
+
+  // Get the cache shard owning the signature.
+  CacheShard* GetCacheShard(const utils::Hash128& signature) const;
+
   // Set a quota response.
   void SetResponse(
       const ::istio::mixer::v1::Attributes& attributes,
       const std::string& quota_name,
       const ::istio::mixer::v1::CheckResponse::QuotaResult* result);
 
-  // A map from quota name to PerQuotaReferenced.
-  std::unordered_map<std::string, PerQuotaReferenced> quota_referenced_map_;
-
-  // Key is the signature of the Attributes. Value is the CacheElem.
-  // It is a LRU cache with MaxIdelTime as response_expiration_time.
-  using QuotaLRUCache = utils::SimpleLRUCache<std::string, CacheElem>;
-
   // The quota options.
   QuotaOptions options_;
 
-  // Mutex guarding the access of cache_ and quota_referenced_map_
-  std::mutex cache_mutex_;
+  // The per quota data shards, empty if cache is disabled.
+  std::vector<std::unique_ptr<QuotaShard>> quota_shards_;
 
-  // The cache that maps from key to prefetch object
-  std::unique_ptr<QuotaLRUCache> cache_;
+  // The cache shards, empty if cache is disabled.
+  std::vector<std::unique_ptr<CacheShard>> cache_shards_;
 
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(QuotaCache);
 };
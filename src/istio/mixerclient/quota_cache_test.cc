@@ -20,6 +20,12 @@
 #include "include/istio/utils/attributes_builder.h"
 #include "src/istio/mixerclient/status_test_util.h"
 
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+using namespace std::chrono;
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
 using ::istio::mixer::v1::Attributes;
@@ -64,6 +70,96 @@ class QuotaCacheTest : public ::testing::Test {
     result.SetResponse(Status::OK, request, response);
   }
 
+  // Check the quota of the attributes. If a prefetch request is sent,
+  // grant all the requested amounts.
+  bool CheckQuota(const Attributes& attributes,
+                  const std::vector<Requirement>& quotas,
+                  const CheckResponse& response) {
+    QuotaCache::CheckResult result;
+    cache_->Check(attributes, quotas, true, &result);
+    CheckRequest request;
+    if (result.BuildRequest(&request)) {
+      CheckResponse granted(response);
+      for (auto& it : *granted.mutable_quotas()) {
+        it.second.set_granted_amount(request.quotas().at(it.first).amount());
+      }
+      result.SetResponse(Status::OK, attributes, granted);
+    }
+    return result.status().ok();
+  }
+
+  // Run quota checks from multiple threads, each with its own quota and
+  // cache keys. Return the checks per second.
+  double RunConcurrentChecks(int num_threads, int checks_per_thread) {
+    const int kKeysPerThread = 16;
+    std::vector<std::vector<Requirement>> thread_quotas(num_threads);
+    std::vector<CheckResponse> thread_responses(num_threads);
+    std::vector<std::vector<Attributes>> thread_attributes(num_threads);
+    for (int i = 0; i < num_threads; ++i) {
+      std::string quota_name = "quota-" + std::to_string(i);
+      thread_quotas[i].push_back({quota_name, 1});
+
+      CheckResponse::QuotaResult quota_result;
+      auto match =
+          quota_result.mutable_referenced_attributes()->add_attribute_matches();
+      match->set_condition(ReferencedAttributes::EXACT);
+      match->set_name(2);  // "source.name"
+      (*thread_responses[i].mutable_quotas())[quota_name] = quota_result;
+
+      for (int k = 0; k < kKeysPerThread; ++k) {
+        Attributes attributes(request_);
+        utils::AttributesBuilder(&attributes)
+            .AddString("source.name",
+                       "user-" + std::to_string(i) + "-" + std::to_string(k));
+        thread_attributes[i].push_back(attributes);
+        // Fill the cache.
+        CheckQuota(attributes, thread_quotas[i], thread_responses[i]);
+      }
+    }
+
+    std::atomic<int> failures(0);
+    auto start = system_clock::now();
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) {
+      threads.emplace_back([&, i]() {
+        for (int n = 0; n < checks_per_thread; ++n) {
+          if (!CheckQuota(thread_attributes[i][n % kKeysPerThread],
+                          thread_quotas[i], thread_responses[i])) {
+            ++failures;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    auto elapsed = duration_cast<microseconds>(system_clock::now() - start);
+    EXPECT_EQ(failures, 0);
+    return num_threads * checks_per_thread * 1000000.0 /
+           std::max<int64_t>(elapsed.count(), 1);
+  }
+
+  // Check a burst of 10 quotas, then wait past one rate sample of 50 ms.
+  // Return the amount of the next prefetch.
+  int PrefetchAmountAfterBurst(const QuotaOptions& options) {
+    cache_ = std::unique_ptr<QuotaCache>(new QuotaCache(options));
+    CheckResponse response;
+    (*response.mutable_quotas())[kQuotaName] = CheckResponse::QuotaResult();
+    for (int i = 0; i < 10; ++i) {
+      CheckQuota(request_, quotas_, response);
+    }
+    std::this_thread::sleep_for(milliseconds(60));
+    for (int i = 0; i < 100; ++i) {
+      QuotaCache::CheckResult result;
+      cache_->Check(request_, quotas_, true, &result);
+      CheckRequest request;
+      if (result.BuildRequest(&request)) {
+        return request.quotas().at(kQuotaName).amount();
+      }
+    }
+    return 0;
+  }
+
   Attributes request_;
   std::vector<Requirement> quotas_;
   std::unique_ptr<QuotaCache> cache_;
@@ -308,6 +404,102 @@ TEST_F(QuotaCacheTest, TestTwoReferencedWith) {
   TestRequest(attr2, true, response2);
 }
 
+TEST_F(QuotaCacheTest, TestRateWeights) {
+  // By default, the prefetch amount is the amount passed in the last
+  // second.
+  int window_amount = PrefetchAmountAfterBurst(QuotaOptions());
+  EXPECT_GT(window_amount, 0);
+
+  // With rate weights, it is the demand in one second at the rate of the
+  // burst.
+  QuotaOptions options;
+  options.rate_weight = 0.5;
+  options.trend_weight = 0.5;
+  int trend_amount = PrefetchAmountAfterBurst(options);
+  EXPECT_GT(trend_amount, window_amount);
+}
+
+TEST_F(QuotaCacheTest, TestShardedCache) {
+  QuotaOptions options;
+  options.num_shards = 4;
+  cache_ = std::unique_ptr<QuotaCache>(new QuotaCache(options));
+
+  RunConcurrentChecks(4, 1000);
+  CacheStats stats;
+  cache_->GetStats(&stats);
+  EXPECT_EQ(stats.entries, 4 * 16);
+  EXPECT_EQ(stats.evictions, 0);
+}
+
+TEST_F(QuotaCacheTest, TestConcurrentChecksOfOneEntry) {
+  CheckResponse response;
+  CheckResponse::QuotaResult quota_result;
+  auto match =
+      quota_result.mutable_referenced_attributes()->add_attribute_matches();
+  match->set_condition(ReferencedAttributes::EXACT);
+  match->set_name(2);  // "source.name"
+  (*response.mutable_quotas())[kQuotaName] = quota_result;
+
+  utils::AttributesBuilder(&request_).AddString("source.name", "user1");
+  // Fill the cache.
+  EXPECT_TRUE(CheckQuota(request_, quotas_, response));
+
+  // All threads check the same cache entry, its prefetches are sent with
+  // the quota of the check making them.
+  const int kNumThreads = 4;
+  const int kChecksPerThread = 5000;
+  std::atomic<int> passed(0);
+  std::atomic<int> prefetched(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&]() {
+      for (int n = 0; n < kChecksPerThread; ++n) {
+        QuotaCache::CheckResult result;
+        cache_->Check(request_, quotas_, true, &result);
+        CheckRequest request;
+        if (result.BuildRequest(&request)) {
+          EXPECT_EQ(request.quotas().size(), 1);
+          int amount = request.quotas().at(kQuotaName).amount();
+          EXPECT_GT(amount, 0);
+          prefetched += amount;
+          CheckResponse granted(response);
+          (*granted.mutable_quotas())[kQuotaName].set_granted_amount(amount);
+          result.SetResponse(Status::OK, request_, granted);
+        }
+        if (result.status().ok()) {
+          ++passed;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(passed, kNumThreads * kChecksPerThread);
+  // Each passed check used a granted token.
+  EXPECT_GE(prefetched, passed);
+
+  CacheStats stats;
+  cache_->GetStats(&stats);
+  EXPECT_EQ(stats.entries, 1);
+}
+
+TEST_F(QuotaCacheTest, TestShardedCacheContention) {
+  const int kChecksPerThread = 20000;
+  for (int num_shards : {1, 16}) {
+    for (int num_threads : {1, 2, 4, 8}) {
+      QuotaOptions options;
+      options.num_shards = num_shards;
+      cache_ = std::unique_ptr<QuotaCache>(new QuotaCache(options));
+      double rate = RunConcurrentChecks(num_threads, kChecksPerThread);
+      std::cerr << "===Quota contention shards: " << num_shards
+                << ", threads: " << num_threads
+                << ", checks/second: " << static_cast<int64_t>(rate)
+                << std::endl;
+    }
+  }
+}
+
 }  // namespace
 }  // namespace mixerclient
 }  // namespace istio
@@ -16,14 +16,17 @@
 #include "src/istio/mixerclient/referenced.h"
 
 #include "global_dictionary.h"
+#include "src/istio/mixerclient/signature_hasher.h"
 
 #include <algorithm>
 #include <map>
 #include <set>
 #include <sstream>
+#include <unordered_map>
 
 using ::istio::mixer::v1::Attributes;
 using ::istio::mixer::v1::Attributes_AttributeValue;
+using ::istio::mixer::v1::CompressedAttributes;
 using ::istio::mixer::v1::ReferencedAttributes;
 
 namespace istio {
@@ -59,11 +62,29 @@ bool Decode(int idx, const std::vector<std::string> &global_words,
   return true;
 }
 
+// Decode a word of the compressed attributes, return nullptr if invalid.
+const std::string *DecodeCompressed(
+    int idx, const std::vector<std::string> &global_words,
+    const CompressedAttributes &compressed) {
+  if (idx >= 0) {
+    if ((unsigned int)idx >= global_words.size()) {
+      return nullptr;
+    }
+    return &global_words[idx];
+  }
+  idx = -idx - 1;
+  if (idx >= compressed.words_size()) {
+    return nullptr;
+  }
+  return &compressed.words(idx);
+}
+
 }  // namespace
 
 // Updates hasher with keys
+template <class Hasher>
 void Referenced::UpdateHash(const std::vector<AttributeRef> &keys,
-                            utils::MD5 *hasher) {
+                            Hasher *hasher) {
   // keys are already sorted during Fill
   for (const AttributeRef &key : keys) {
     hasher->Update(key.name);
@@ -114,122 +135,144 @@ bool Referenced::Fill(const Attributes &attributes,
   return true;
 }
 
-bool Referenced::Signature(const Attributes &attributes,
-                           const std::string &extra_key,
-                           std::string *signature) const {
-  const auto &attributes_map = attributes.attributes();
+bool Referenced::CheckAbsence(const Attributes_AttributeValue &value,
+                              KeyIterator begin, KeyIterator end) {
+  // if an "absence" key exists for a non stringMap attribute, return false
+  // for mis-match.
+  if (value.value_case() != Attributes_AttributeValue::kStringMapValue) {
+    return false;
+  }
+  const auto &smap = value.string_map_value().entries();
+  for (KeyIterator it = begin; it != end; ++it) {
+    // if subkey is found, it is a violation of "absence" constrain.
+    if (smap.find(it->map_key) != smap.end()) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  for (std::size_t i = 0; i < absence_keys_.size(); ++i) {
-    const auto &key = absence_keys_[i];
-    const auto it = attributes_map.find(key.name);
-    if (it == attributes_map.end()) {
-      continue;
+template <class Hasher>
+bool Referenced::UpdateExact(const std::string &name,
+                             const Attributes_AttributeValue &value,
+                             KeyIterator begin, KeyIterator end,
+                             Hasher *hasher) {
+  if (value.value_case() != Attributes_AttributeValue::kStringMapValue) {
+    // Keys with the same name only have map_key for stringMap, hash the
+    // value once for each of them.
+    for (KeyIterator it = begin; it != end; ++it) {
+      UpdateValue(name, value, hasher);
     }
+    return true;
+  }
 
-    const Attributes_AttributeValue &value = it->second;
-    // if an "absence" key exists for a non stringMap attribute, return false
-    // for mis-match.
-    if (value.value_case() != Attributes_AttributeValue::kStringMapValue) {
+  hasher->Update(name);
+  hasher->Update(kDelimiter, kDelimiterLength);
+  const auto &smap = value.string_map_value().entries();
+  for (KeyIterator it = begin; it != end; ++it) {
+    const auto sub_it = smap.find(it->map_key);
+    // exact match of map_key is missing
+    if (sub_it == smap.end()) {
       return false;
     }
 
-    std::string map_key = key.map_key;
-    const auto &smap = value.string_map_value().entries();
-    // Since absence_keys_ are sorted by key.name,
-    // continue processing stringMaps until a new name is found.
-    do {
-      // if subkey is found, it is a violation of "absence" constrain.
-      if (smap.find(map_key) != smap.end()) {
-        return false;
-      }
-      // break loop if at the end or keyname changes.
-      if (i + 1 == absence_keys_.size() ||
-          absence_keys_[i + 1].name != key.name) {
-        break;
-      }
+    hasher->Update(sub_it->first);
+    hasher->Update(kDelimiter, kDelimiterLength);
+    hasher->Update(sub_it->second);
+    hasher->Update(kDelimiter, kDelimiterLength);
+  }
+  hasher->Update(kDelimiter, kDelimiterLength);
+  return true;
+}
 
-      map_key = absence_keys_[++i].map_key;
+template <class Hasher>
+void Referenced::UpdateValue(const std::string &name,
+                             const Attributes_AttributeValue &value,
+                             Hasher *hasher) {
+  hasher->Update(name);
+  hasher->Update(kDelimiter, kDelimiterLength);
+
+  switch (value.value_case()) {
+    case Attributes_AttributeValue::kStringValue:
+      hasher->Update(value.string_value());
+      break;
+    case Attributes_AttributeValue::kBytesValue:
+      hasher->Update(value.bytes_value());
+      break;
+    case Attributes_AttributeValue::kInt64Value: {
+      auto data = value.int64_value();
+      hasher->Update(&data, sizeof(data));
+    } break;
+    case Attributes_AttributeValue::kDoubleValue: {
+      auto data = value.double_value();
+      hasher->Update(&data, sizeof(data));
+    } break;
+    case Attributes_AttributeValue::kBoolValue: {
+      auto data = value.bool_value();
+      hasher->Update(&data, sizeof(data));
+    } break;
+    case Attributes_AttributeValue::kTimestampValue: {
+      auto seconds = value.timestamp_value().seconds();
+      auto nanos = value.timestamp_value().nanos();
+      hasher->Update(&seconds, sizeof(seconds));
+      hasher->Update(kDelimiter, kDelimiterLength);
+      hasher->Update(&nanos, sizeof(nanos));
+    } break;
+    case Attributes_AttributeValue::kDurationValue: {
+      auto seconds = value.duration_value().seconds();
+      auto nanos = value.duration_value().nanos();
+      hasher->Update(&seconds, sizeof(seconds));
+      hasher->Update(kDelimiter, kDelimiterLength);
+      hasher->Update(&nanos, sizeof(nanos));
+    } break;
+    case Attributes_AttributeValue::kStringMapValue:
+      // Handled by UpdateExact.
+      break;
+    case Attributes_AttributeValue::VALUE_NOT_SET:
+      break;
+  }
+  hasher->Update(kDelimiter, kDelimiterLength);
+}
 
-    } while (true);
+Referenced::KeyIterator Referenced::NextName(KeyIterator begin,
+                                             KeyIterator end) {
+  KeyIterator it = begin;
+  while (it != end && it->name == begin->name) {
+    ++it;
   }
+  return it;
+}
 
-  utils::MD5 hasher;
+// SignaturePlan uses the same hasher.
+template bool Referenced::UpdateExact<SignatureHasher>(
+    const std::string &name, const Attributes_AttributeValue &value,
+    KeyIterator begin, KeyIterator end, SignatureHasher *hasher);
 
-  for (std::size_t i = 0; i < exact_keys_.size(); ++i) {
-    const auto &key = exact_keys_[i];
-    const auto it = attributes_map.find(key.name);
-    // if an "exact" attribute not present, return false for mismatch.
-    if (it == attributes_map.end()) {
+bool Referenced::Signature(const Attributes &attributes,
+                           const std::string &extra_key,
+                           utils::Hash128 *signature) const {
+  const auto &attributes_map = attributes.attributes();
+
+  // Keys are sorted by name, process keys with the same name together.
+  for (KeyIterator begin = absence_keys_.begin(), end;
+       begin != absence_keys_.end(); begin = end) {
+    end = NextName(begin, absence_keys_.end());
+    const auto it = attributes_map.find(begin->name);
+    if (it != attributes_map.end() && !CheckAbsence(it->second, begin, end)) {
       return false;
     }
+  }
 
-    hasher.Update(it->first);
-    hasher.Update(kDelimiter, kDelimiterLength);
-
-    const Attributes_AttributeValue &value = it->second;
-    switch (value.value_case()) {
-      case Attributes_AttributeValue::kStringValue:
-        hasher.Update(value.string_value());
-        break;
-      case Attributes_AttributeValue::kBytesValue:
-        hasher.Update(value.bytes_value());
-        break;
-      case Attributes_AttributeValue::kInt64Value: {
-        auto data = value.int64_value();
-        hasher.Update(&data, sizeof(data));
-      } break;
-      case Attributes_AttributeValue::kDoubleValue: {
-        auto data = value.double_value();
-        hasher.Update(&data, sizeof(data));
-      } break;
-      case Attributes_AttributeValue::kBoolValue: {
-        auto data = value.bool_value();
-        hasher.Update(&data, sizeof(data));
-      } break;
-      case Attributes_AttributeValue::kTimestampValue: {
-        auto seconds = value.timestamp_value().seconds();
-        auto nanos = value.timestamp_value().nanos();
-        hasher.Update(&seconds, sizeof(seconds));
-        hasher.Update(kDelimiter, kDelimiterLength);
-        hasher.Update(&nanos, sizeof(nanos));
-      } break;
-      case Attributes_AttributeValue::kDurationValue: {
-        auto seconds = value.duration_value().seconds();
-        auto nanos = value.duration_value().nanos();
-        hasher.Update(&seconds, sizeof(seconds));
-        hasher.Update(kDelimiter, kDelimiterLength);
-        hasher.Update(&nanos, sizeof(nanos));
-      } break;
-      case Attributes_AttributeValue::kStringMapValue: {
-        std::string map_key = key.map_key;
-        const auto &smap = value.string_map_value().entries();
-        // Since exact_keys_ are sorted by key.name,
-        // continue processing stringMaps until a new name is found.
-        do {
-          const auto sub_it = smap.find(map_key);
-          // exact match of map_key is missing
-          if (sub_it == smap.end()) {
-            return false;
-          }
-
-          hasher.Update(sub_it->first);
-          hasher.Update(kDelimiter, kDelimiterLength);
-          hasher.Update(sub_it->second);
-          hasher.Update(kDelimiter, kDelimiterLength);
-
-          // break loop if at the end or keyname changes.
-          if (i + 1 == exact_keys_.size() ||
-              exact_keys_[i + 1].name != key.name) {
-            break;
-          }
-
-          map_key = exact_keys_[++i].map_key;
-        } while (true);
-      } break;
-      case Attributes_AttributeValue::VALUE_NOT_SET:
-        break;
+  SignatureHasher hasher;
+  for (KeyIterator begin = exact_keys_.begin(), end;
+       begin != exact_keys_.end(); begin = end) {
+    end = NextName(begin, exact_keys_.end());
+    const auto it = attributes_map.find(begin->name);
+    // if an "exact" attribute not present, return false for mismatch.
+    if (it == attributes_map.end() ||
+        !UpdateExact(it->first, it->second, begin, end, &hasher)) {
+      return false;
     }
-    hasher.Update(kDelimiter, kDelimiterLength);
   }
   hasher.Update(extra_key);
 
@@ -237,8 +280,8 @@ bool Referenced::Signature(const Attributes &attributes,
   return true;
 }
 
-std::string Referenced::Hash() const {
-  utils::MD5 hasher;
+utils::Hash128 Referenced::Hash() const {
+  SignatureHasher hasher;
 
   // keys are sorted during Fill
   UpdateHash(absence_keys_, &hasher);
@@ -248,6 +291,104 @@ std::string Referenced::Hash() const {
   return hasher.Digest();
 }
 
+void Referenced::ExtractAttributes(const CompressedAttributes &compressed,
+                                   const ReferencedAttributes &reference,
+                                   Attributes *attributes) {
+  const std::vector<std::string> &global_words = GetGlobalWords();
+
+  // The referenced names with their map keys.
+  std::unordered_map<std::string, std::set<std::string>> names;
+  for (const auto &match : reference.attribute_matches()) {
+    std::string name;
+    if (!Decode(match.name(), global_words, reference, &name)) {
+      continue;
+    }
+    std::set<std::string> &map_keys = names[name];
+    // map_key is only meaningful for string maps. If it could not be
+    // decoded, Fill() fails the same way with the extracted attributes.
+    std::string map_key;
+    if (Decode(match.map_key(), global_words, reference, &map_key)) {
+      map_keys.insert(map_key);
+    }
+  }
+
+  auto *attributes_map = attributes->mutable_attributes();
+  // Return the value to fill if the compressed name is referenced.
+  auto find_value = [&](int idx) -> Attributes_AttributeValue * {
+    const std::string *name =
+        DecodeCompressed(idx, global_words, compressed);
+    if (name == nullptr || names.find(*name) == names.end()) {
+      return nullptr;
+    }
+    return &(*attributes_map)[*name];
+  };
+
+  for (const auto &it : compressed.strings()) {
+    Attributes_AttributeValue *value = find_value(it.first);
+    const std::string *str =
+        DecodeCompressed(it.second, global_words, compressed);
+    if (value != nullptr && str != nullptr) {
+      value->set_string_value(*str);
+    }
+  }
+  for (const auto &it : compressed.bytes()) {
+    Attributes_AttributeValue *value = find_value(it.first);
+    if (value != nullptr) {
+      value->set_bytes_value(it.second);
+    }
+  }
+  for (const auto &it : compressed.int64s()) {
+    Attributes_AttributeValue *value = find_value(it.first);
+    if (value != nullptr) {
+      value->set_int64_value(it.second);
+    }
+  }
+  for (const auto &it : compressed.doubles()) {
+    Attributes_AttributeValue *value = find_value(it.first);
+    if (value != nullptr) {
+      value->set_double_value(it.second);
+    }
+  }
+  for (const auto &it : compressed.bools()) {
+    Attributes_AttributeValue *value = find_value(it.first);
+    if (value != nullptr) {
+      value->set_bool_value(it.second);
+    }
+  }
+  for (const auto &it : compressed.timestamps()) {
+    Attributes_AttributeValue *value = find_value(it.first);
+    if (value != nullptr) {
+      *value->mutable_timestamp_value() = it.second;
+    }
+  }
+  for (const auto &it : compressed.durations()) {
+    Attributes_AttributeValue *value = find_value(it.first);
+    if (value != nullptr) {
+      *value->mutable_duration_value() = it.second;
+    }
+  }
+  for (const auto &it : compressed.string_maps()) {
+    Attributes_AttributeValue *value = find_value(it.first);
+    if (value == nullptr) {
+      continue;
+    }
+    const std::set<std::string> &map_keys =
+        names[*DecodeCompressed(it.first, global_words, compressed)];
+    // Keep it a string map even if no referenced key is present.
+    auto *entries = value->mutable_string_map_value()->mutable_entries();
+    for (const auto &entry : it.second.entries()) {
+      const std::string *key =
+          DecodeCompressed(entry.first, global_words, compressed);
+      const std::string *str =
+          DecodeCompressed(entry.second, global_words, compressed);
+      if (key != nullptr && str != nullptr &&
+          map_keys.find(*key) != map_keys.end()) {
+        (*entries)[*key] = *str;
+      }
+    }
+  }
+}
+
 std::string Referenced::DebugString() const {
   std::stringstream ss;
   ss << "Absence-keys: ";
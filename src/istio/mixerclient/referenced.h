@@ -18,7 +18,7 @@
 
 #include <vector>
 
-#include "include/istio/utils/md5.h"
+#include "include/istio/utils/hash128.h"
 #include "mixer/v1/check.pb.h"
 
 namespace istio {
@@ -40,10 +40,21 @@ class Referenced {
   // present
   // or "exact" match attributes don't present.
   bool Signature(const ::istio::mixer::v1::Attributes &attributes,
-                 const std::string &extra_key, std::string *signature) const;
+                 const std::string &extra_key,
+                 utils::Hash128 *signature) const;
 
   // A hash value to identify an instance.
-  std::string Hash() const;
+  utils::Hash128 Hash() const;
+
+  // Decode the attributes used by reference from the compressed attributes
+  // of the request, and add them to attributes. For a string map, only the
+  // used keys are decoded. The result is enough to Fill() and calculate the
+  // Signature() for the request, so the request attributes don't need to
+  // be kept until the response.
+  static void ExtractAttributes(
+      const ::istio::mixer::v1::CompressedAttributes &compressed,
+      const ::istio::mixer::v1::ReferencedAttributes &reference,
+      ::istio::mixer::v1::Attributes *attributes);
 
   // For debug logging only.
   std::string DebugString() const;
@@ -73,9 +84,39 @@ class Referenced {
   // The keys should match exactly.
   std::vector<AttributeRef> exact_keys_;
 
+  using KeyIterator = std::vector<AttributeRef>::const_iterator;
+
   // Updates hasher with keys
+  template <class Hasher>
   static void UpdateHash(const std::vector<AttributeRef> &keys,
-                         utils::MD5 *hasher);
+                         Hasher *hasher);
+
+  // Return the end of the keys with the same name as begin.
+  static KeyIterator NextName(KeyIterator begin, KeyIterator end);
+
+  // Check "absence" keys [begin, end) with the same name against the
+  // attribute value. Return false if any of them is present.
+  static bool CheckAbsence(
+      const ::istio::mixer::v1::Attributes_AttributeValue &value,
+      KeyIterator begin, KeyIterator end);
+
+  // Updates hasher with "exact" keys [begin, end) with the same name.
+  // Return false if any string map key is missing.
+  template <class Hasher>
+  static bool UpdateExact(
+      const std::string &name,
+      const ::istio::mixer::v1::Attributes_AttributeValue &value,
+      KeyIterator begin, KeyIterator end, Hasher *hasher);
+
+  // Updates hasher with a non stringMap attribute.
+  template <class Hasher>
+  static void UpdateValue(
+      const std::string &name,
+      const ::istio::mixer::v1::Attributes_AttributeValue &value,
+      Hasher *hasher);
+
+  // SignaturePlan calculates signatures with the same functions.
+  friend class SignaturePlan;
 };
 
 }  // namespace mixerclient
@@ -16,7 +16,7 @@
 #include "src/istio/mixerclient/referenced.h"
 
 #include "include/istio/utils/attributes_builder.h"
-#include "include/istio/utils/md5.h"
+#include "src/istio/mixerclient/attribute_compressor.h"
 
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
@@ -139,8 +139,12 @@ TEST(ReferencedTest, FillSuccessTest) {
             "duration-key, int-key, string-key, string-map-key[If-Match], "
             "time-key, ");
 
-  EXPECT_EQ(utils::MD5::DebugString(referenced.Hash()),
-            "602d5bbd45b623c3560d2bdb6104f3ab");
+  // The hash key is random per process, the same referenced attributes
+  // have the same hash in the process.
+  Referenced referenced2;
+  EXPECT_TRUE(referenced2.Fill(attrs, pb));
+  EXPECT_EQ(referenced.Hash(), referenced2.Hash());
+  EXPECT_NE(referenced.Hash(), Referenced().Hash());
 }
 
 TEST(ReferencedTest, FillFail1Test) {
@@ -169,7 +173,7 @@ TEST(ReferencedTest, NegativeSignature1Test) {
   Referenced referenced;
   EXPECT_TRUE(referenced.Fill(attrs, pb));
 
-  std::string signature;
+  utils::Hash128 signature;
 
   Attributes attributes1;
   // "target.service" should be absence.
@@ -208,11 +212,93 @@ TEST(ReferencedTest, OKSignature1Test) {
   Referenced referenced;
   EXPECT_TRUE(referenced.Fill(attributes, pb));
 
-  std::string signature;
+  utils::Hash128 signature;
   EXPECT_TRUE(referenced.Signature(attributes, "extra", &signature));
 
-  EXPECT_EQ(utils::MD5::DebugString(signature),
-            "751b028b2e2c230ef9c4e59ac556ca04");
+  utils::Hash128 signature2;
+  EXPECT_TRUE(referenced.Signature(attributes, "extra", &signature2));
+  EXPECT_EQ(signature, signature2);
+  EXPECT_TRUE(referenced.Signature(attributes, "extra2", &signature2));
+  EXPECT_NE(signature, signature2);
+}
+
+TEST(ReferencedTest, ExtractAttributesTest) {
+  ::istio::mixer::v1::ReferencedAttributes pb;
+  ASSERT_TRUE(TextFormat::ParseFromString(kReferencedText, &pb));
+
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("string-key", "this is a string value");
+  builder.AddBytes("bytes-key", "this is a bytes value");
+  builder.AddDouble("double-key", 99.9);
+  builder.AddInt64("int-key", 35);
+  builder.AddBool("bool-key", true);
+  builder.AddString("not-referenced-key", "not referenced");
+
+  std::chrono::time_point<std::chrono::system_clock> time0;
+  std::chrono::seconds secs(5);
+  builder.AddTimestamp("time-key", time0);
+  builder.AddDuration(
+      "duration-key",
+      std::chrono::duration_cast<std::chrono::nanoseconds>(secs));
+
+  std::map<std::string, std::string> string_map = {{"If-Match", "value1"},
+                                                   {"key2", "value2"}};
+  builder.AddStringMap("string-map-key", std::move(string_map));
+
+  AttributeCompressor compressor;
+  ::istio::mixer::v1::CompressedAttributes compressed;
+  compressor.Compress(attributes, &compressed);
+
+  Attributes extracted;
+  Referenced::ExtractAttributes(compressed, pb, &extracted);
+
+  const auto &extracted_map = extracted.attributes();
+  EXPECT_EQ(extracted_map.size(), 8);
+  EXPECT_TRUE(extracted_map.find("not-referenced-key") ==
+              extracted_map.end());
+  const auto &entries =
+      extracted_map.at("string-map-key").string_map_value().entries();
+  EXPECT_EQ(entries.size(), 1);
+  EXPECT_EQ(entries.at("If-Match"), "value1");
+
+  // The extracted attributes have the same signature.
+  Referenced referenced;
+  EXPECT_TRUE(referenced.Fill(extracted, pb));
+
+  utils::Hash128 signature;
+  EXPECT_TRUE(referenced.Signature(extracted, "extra", &signature));
+
+  utils::Hash128 expected;
+  EXPECT_TRUE(referenced.Signature(attributes, "extra", &expected));
+  EXPECT_EQ(signature, expected);
+}
+
+TEST(ReferencedTest, ExtractStringMapWithoutKeysTest) {
+  ::istio::mixer::v1::ReferencedAttributes pb;
+  ASSERT_TRUE(TextFormat::ParseFromString(kReferencedText, &pb));
+
+  Attributes attributes;
+  ASSERT_TRUE(TextFormat::ParseFromString(kAttributesText, &attributes));
+
+  AttributeCompressor compressor;
+  ::istio::mixer::v1::CompressedAttributes compressed;
+  compressor.Compress(attributes, &compressed);
+
+  Attributes extracted;
+  Referenced::ExtractAttributes(compressed, pb, &extracted);
+
+  // "User-Agent" is an absence key, it should be kept to reject the request.
+  const auto &entries = extracted.attributes()
+                            .at("string-map-key")
+                            .string_map_value()
+                            .entries();
+  EXPECT_EQ(entries.size(), 1);
+
+  Referenced referenced;
+  EXPECT_TRUE(referenced.Fill(extracted, pb));
+  utils::Hash128 signature;
+  EXPECT_FALSE(referenced.Signature(extracted, "", &signature));
 }
 
 }  // namespace
@@ -16,6 +16,9 @@
 #include "src/istio/mixerclient/report_batch.h"
 #include "include/istio/utils/protobuf.h"
 
+#include <algorithm>
+
+using namespace std::chrono;
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
 using ::istio::mixer::v1::Attributes;
@@ -24,72 +27,288 @@ using ::istio::mixer::v1::ReportResponse;
 
 namespace istio {
 namespace mixerclient {
+namespace {
+
+// Update an exponentially weighted moving average with a new sample.
+// An average of 0 has no samples yet.
+int64_t UpdateAverage(int64_t average, int64_t sample) {
+  if (average == 0) {
+    return sample;
+  }
+  return average + (sample - average) / 8;
+}
+
+// The latency histogram is decayed after this many samples.
+const int64_t kMaxLatencySamples = 10000;
+
+}  // namespace
 
 ReportBatch::ReportBatch(const ReportOptions& options,
                          TransportReportFunc transport,
                          TimerCreateFunc timer_create,
-                         AttributeCompressor& compressor)
+                         AttributeCompressor& compressor,
+                         LatencyRecordFunc on_latency)
     : options_(options),
       transport_(transport),
       timer_create_(timer_create),
       compressor_(compressor),
+      draining_(false),
+      inflight_reports_(0),
+      backlog_bytes_(0),
+      report_latency_us_(0),
+      report_interval_us_(0),
+      latency_(kMaxLatencySamples, on_latency),
       total_report_calls_(0),
-      total_remote_report_calls_(0) {}
+      total_remote_report_calls_(0),
+      total_dropped_reports_(0) {
+  if (options_.report_queue_size > 0) {
+    queue_.reset(new ReportQueue(options_.report_queue_size));
+  }
+  for (auto& count : batch_size_counts_) {
+    count = 0;
+  }
+}
 
 ReportBatch::~ReportBatch() { Flush(); }
 
+int ReportBatch::BatchSizeBucket(int size) {
+  int bucket = 0;
+  for (int bound = 1; size > bound && bucket < kNumBatchSizeBuckets - 1;
+       bound *= 10) {
+    ++bucket;
+  }
+  return bucket;
+}
+
+int ReportBatch::AdaptiveBatchTimeMs(const ReportOptions& options,
+                                     int64_t report_latency_us,
+                                     int64_t report_interval_us) {
+  if (options.report_latency_slo_ms <= 0) {
+    return options.max_batch_time_ms;
+  }
+  int64_t budget_us = options.report_latency_slo_ms * 1000LL -
+                      std::max<int64_t>(report_latency_us, 0);
+  if (budget_us < 1000 || budget_us < report_interval_us) {
+    return 0;
+  }
+  return std::min<int64_t>(budget_us / 1000, options.max_batch_time_ms);
+}
+
 void ReportBatch::Report(const Attributes& request) {
-  std::lock_guard<std::mutex> lock(mutex_);
   ++total_report_calls_;
-  if (!batch_compressor_) {
-    batch_compressor_ = compressor_.CreateBatchCompressor();
+  if (queue_) {
+    std::unique_ptr<Attributes> attributes(new Attributes(request));
+    if (queue_->Push(&attributes)) {
+      TryDrainQueue();
+      return;
+    }
+    // The queue is full, wait for the lock.
+    std::lock_guard<std::mutex> lock(mutex_);
+    DrainQueueWithLock();
+    AddWithLock(request);
+    return;
   }
 
-  if (!batch_compressor_->Add(request)) {
-    FlushWithLock();
+  std::lock_guard<std::mutex> lock(mutex_);
+  AddWithLock(request);
+}
 
-    batch_compressor_ = compressor_.CreateBatchCompressor();
-    batch_compressor_->Add(request);
+void ReportBatch::TryDrainQueue() {
+  do {
+    if (draining_.exchange(true)) {
+      // The draining thread will see the pushed report.
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      DrainQueueWithLock();
+    }
+    draining_.store(false);
+    // Re-check for reports pushed by threads failed to take draining_.
+  } while (!queue_->empty());
+}
+
+void ReportBatch::DrainQueueWithLock() {
+  if (!queue_) {
+    return;
   }
+  std::unique_ptr<Attributes> attributes;
+  while (queue_->Pop(&attributes)) {
+    AddWithLock(*attributes);
+  }
+}
+
+void ReportBatch::UpdateReportIntervalWithLock() {
+  steady_clock::time_point now = steady_clock::now();
+  if (last_report_time_ != steady_clock::time_point()) {
+    int64_t interval =
+        duration_cast<microseconds>(now - last_report_time_).count();
+    report_interval_us_ = UpdateAverage(report_interval_us_, interval);
+  }
+  last_report_time_ = now;
+}
 
-  if (batch_compressor_->size() >= options_.max_batch_entries) {
-    FlushWithLock();
+void ReportBatch::AddWithLock(const Attributes& request) {
+  // Add to the first open batch having all previous attributes.
+  size_t index = 0;
+  while (index < batch_compressors_.size() &&
+         !batch_compressors_[index]->CanAdd(request)) {
+    ++index;
+  }
+  if (index == batch_compressors_.size()) {
+    if (!batch_compressors_.empty() &&
+        batch_compressors_.size() >=
+            static_cast<size_t>(options_.max_open_batches)) {
+      FlushBatchWithLock(0);
+      --index;
+    }
+    batch_compressors_.push_back(compressor_.CreateBatchCompressor());
+  }
+
+  if (!batch_compressors_[index]->Add(request)) {
+    // Should not happen after CanAdd(), start a new batch anyway.
+    FlushBatchWithLock(index);
+    batch_compressors_.push_back(compressor_.CreateBatchCompressor());
+    index = batch_compressors_.size() - 1;
+    batch_compressors_[index]->Add(request);
+  }
+
+  BatchCompressor& batch_compressor = *batch_compressors_[index];
+  bool flush = batch_compressor.size() >= options_.max_batch_entries ||
+               (options_.max_batch_bytes > 0 &&
+                batch_compressor.byte_size() >=
+                    static_cast<size_t>(options_.max_batch_bytes));
+  int batch_time_ms = options_.max_batch_time_ms;
+  if (options_.report_latency_slo_ms > 0) {
+    UpdateReportIntervalWithLock();
+    batch_time_ms = AdaptiveBatchTimeMs(options_, report_latency_us_,
+                                        report_interval_us_);
+    flush = flush || batch_time_ms == 0;
+  }
+
+  if (flush) {
+    FlushBatchWithLock(index);
+    if (batch_compressors_.empty() && timer_) {
+      timer_->Stop();
+    }
   } else {
-    if (batch_compressor_->size() == 1 && timer_create_) {
+    if (batch_compressor.size() == 1 && batch_compressors_.size() == 1 &&
+        timer_create_) {
       if (!timer_) {
         timer_ = timer_create_([this]() { Flush(); });
       }
-      timer_->Start(options_.max_batch_time_ms);
+      timer_->Start(batch_time_ms);
     }
   }
 }
 
 void ReportBatch::FlushWithLock() {
-  if (!batch_compressor_) {
-    return;
+  while (!batch_compressors_.empty()) {
+    FlushBatchWithLock(0);
   }
-
-  ++total_remote_report_calls_;
-  std::unique_ptr<ReportRequest> request = batch_compressor_->Finish();
-  batch_compressor_.reset();
   if (timer_) {
     timer_->Stop();
   }
+}
+
+void ReportBatch::FlushBatchWithLock(size_t index) {
+  size_t byte_size = batch_compressors_[index]->byte_size();
+  std::unique_ptr<ReportRequest> request = batch_compressors_[index]->Finish();
+  batch_compressors_.erase(batch_compressors_.begin() + index);
+  ++batch_size_counts_[BatchSizeBucket(request->attributes_size())];
+
+  if (options_.max_inflight_reports > 0) {
+    std::lock_guard<std::mutex> lock(backlog_mutex_);
+    if (inflight_reports_ >= options_.max_inflight_reports) {
+      HoldReportWithLock({std::move(request), byte_size});
+      return;
+    }
+    ++inflight_reports_;
+  }
+  SendReport(std::move(request));
+}
 
+void ReportBatch::SendReport(std::unique_ptr<ReportRequest> request) {
+  ++total_remote_report_calls_;
   ReportResponse* response = new ReportResponse;
-  transport_(*request, response, [this, response](const Status& status) {
+  steady_clock::time_point start_time = steady_clock::now();
+  transport_(*request, response, [this, response,
+                                  start_time](const Status& status) {
     delete response;
+    int64_t latency =
+        duration_cast<microseconds>(steady_clock::now() - start_time).count();
+    report_latency_us_ = UpdateAverage(report_latency_us_, latency);
+    latency_.Record(latency);
     if (!status.ok()) {
       GOOGLE_LOG(ERROR) << "Mixer Report failed with: " << status.ToString();
       if (utils::InvalidDictionaryStatus(status)) {
         compressor_.ShrinkGlobalDictionary();
       }
     }
+    if (options_.max_inflight_reports > 0) {
+      OnReportDone();
+    }
   });
 }
 
+void ReportBatch::OnReportDone() {
+  std::unique_ptr<ReportRequest> request;
+  {
+    std::lock_guard<std::mutex> lock(backlog_mutex_);
+    if (backlog_.empty()) {
+      --inflight_reports_;
+      return;
+    }
+    // The next held batch takes over the in flight slot.
+    request = std::move(backlog_.front().request);
+    backlog_bytes_ -= backlog_.front().byte_size;
+    backlog_.pop_front();
+  }
+  SendReport(std::move(request));
+}
+
+void ReportBatch::HoldReportWithLock(HeldReport held) {
+  backlog_bytes_ += held.byte_size;
+  backlog_.push_back(std::move(held));
+  while (backlog_bytes_ > static_cast<size_t>(options_.max_backlog_bytes) &&
+         !backlog_.empty()) {
+    switch (options_.backlog_drop_policy) {
+      case ReportOptions::DROP_OLDEST:
+        DropReportWithLock(backlog_.front());
+        backlog_.pop_front();
+        break;
+      case ReportOptions::DROP_NEWEST:
+        DropReportWithLock(backlog_.back());
+        backlog_.pop_back();
+        break;
+      case ReportOptions::SAMPLE: {
+        if (backlog_.size() == 1) {
+          DropReportWithLock(backlog_.front());
+          backlog_.pop_front();
+          break;
+        }
+        std::deque<HeldReport> kept;
+        for (size_t i = 0; i < backlog_.size(); ++i) {
+          if (i % 2 == 0) {
+            kept.push_back(std::move(backlog_[i]));
+          } else {
+            DropReportWithLock(backlog_[i]);
+          }
+        }
+        backlog_.swap(kept);
+      } break;
+    }
+  }
+}
+
+void ReportBatch::DropReportWithLock(const HeldReport& held) {
+  backlog_bytes_ -= held.byte_size;
+  total_dropped_reports_ += held.request->attributes_size();
+}
+
 void ReportBatch::Flush() {
   std::lock_guard<std::mutex> lock(mutex_);
+  DrainQueueWithLock();
   FlushWithLock();
 }
 
@@ -18,9 +18,14 @@
 
 #include "include/istio/mixerclient/client.h"
 #include "src/istio/mixerclient/attribute_compressor.h"
+#include "src/istio/mixerclient/latency_histogram.h"
+#include "src/istio/mixerclient/report_queue.h"
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <mutex>
+#include <vector>
 
 namespace istio {
 namespace mixerclient {
@@ -28,8 +33,10 @@ namespace mixerclient {
 // Report batch, this interface is thread safe.
 class ReportBatch {
  public:
+  // on_latency is called with the latency of each Report call.
   ReportBatch(const ReportOptions& options, TransportReportFunc transport,
-              TimerCreateFunc timer_create, AttributeCompressor& compressor);
+              TimerCreateFunc timer_create, AttributeCompressor& compressor,
+              LatencyRecordFunc on_latency = nullptr);
 
   virtual ~ReportBatch();
 
@@ -43,10 +50,65 @@ class ReportBatch {
   uint64_t total_remote_report_calls() const {
     return total_remote_report_calls_;
   }
+  uint64_t total_dropped_reports() const { return total_dropped_reports_; }
+
+  // The latency of remote report calls.
+  const LatencyHistogram& latency() const { return latency_; }
+
+  // The number of flushed batches are counted in buckets by batch size:
+  // 1, 2-10, 11-100, 101-1000 and over 1000.
+  static const int kNumBatchSizeBuckets = 5;
+  uint64_t batch_size_count(int bucket) const {
+    return batch_size_counts_[bucket];
+  }
+
+  // Return the bucket of a batch size.
+  static int BatchSizeBucket(int size);
+
+  // Return the batch time for the options, given the average Mixer Report
+  // latency and the average interval between reports. 0 means sending the
+  // report right away.
+  static int AdaptiveBatchTimeMs(const ReportOptions& options,
+                                 int64_t report_latency_us,
+                                 int64_t report_interval_us);
 
  private:
+  // Add a report to the batches.
+  void AddWithLock(const ::istio::mixer::v1::Attributes& request);
+
+  // Update the average interval between reports.
+  void UpdateReportIntervalWithLock();
+
+  // Move the queued reports to the batches.
+  void DrainQueueWithLock();
+
+  // Drain the queue, unless another thread is draining it.
+  void TryDrainQueue();
+
+  // Flush all batches.
   void FlushWithLock();
 
+  // Flush a batch, and remove it from batch_compressors_.
+  void FlushBatchWithLock(size_t index);
+
+  // Send a report request to the transport.
+  void SendReport(std::unique_ptr<::istio::mixer::v1::ReportRequest> request);
+
+  // Called when a report call is done, send the next held batch if any.
+  void OnReportDone();
+
+  // A flushed batch held while too many report calls are in flight.
+  struct HeldReport {
+    std::unique_ptr<::istio::mixer::v1::ReportRequest> request;
+    size_t byte_size;
+  };
+
+  // Hold a batch in the backlog, drop batches if the backlog is full.
+  void HoldReportWithLock(HeldReport held);
+
+  // Count a held batch as dropped.
+  void DropReportWithLock(const HeldReport& held);
+
   // The quota options.
   ReportOptions options_;
 
@@ -65,11 +127,35 @@ class ReportBatch {
   // timer to flush out batched data.
   std::unique_ptr<Timer> timer_;
 
-  // batched report compressor
-  std::unique_ptr<BatchCompressor> batch_compressor_;
+  // The open batches, the oldest first.
+  std::vector<std::unique_ptr<BatchCompressor>> batch_compressors_;
+
+  // The queue of reports not added to the batches yet, if enabled.
+  std::unique_ptr<ReportQueue> queue_;
+
+  // True if a thread is draining queue_.
+  std::atomic<bool> draining_;
+
+  // Mutex guarding inflight_reports_ and the backlog. The transport is
+  // not called with it held, so a report callback can run synchronously.
+  std::mutex backlog_mutex_;
+  int inflight_reports_;
+  std::deque<HeldReport> backlog_;
+  size_t backlog_bytes_;
+
+  // Moving averages in microseconds for the adaptive batch time.
+  // The Mixer Report latency is updated by transport callbacks.
+  std::atomic<int64_t> report_latency_us_;
+  int64_t report_interval_us_;
+  std::chrono::steady_clock::time_point last_report_time_;
+
+  // The recent Mixer Report latencies for statistics.
+  LatencyHistogram latency_;
 
   std::atomic_int_fast64_t total_report_calls_;
   std::atomic_int_fast64_t total_remote_report_calls_;
+  std::atomic_int_fast64_t total_dropped_reports_;
+  std::atomic_int_fast64_t batch_size_counts_[kNumBatchSizeBuckets];
 
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ReportBatch);
 };
@@ -18,6 +18,9 @@
 #include "gtest/gtest.h"
 #include "include/istio/utils/attributes_builder.h"
 
+#include <deque>
+#include <thread>
+
 using ::google::protobuf::util::Status;
 using ::google::protobuf::util::error::Code;
 using ::istio::mixer::v1::Attributes;
@@ -45,8 +48,9 @@ class MockReportTransport {
 class MockTimer : public Timer {
  public:
   void Stop() override {}
-  void Start(int interval_ms) override {}
+  void Start(int interval_ms) override { interval_ms_ = interval_ms; }
   std::function<void()> cb_;
+  int interval_ms_ = -1;
 };
 
 class ReportBatchTest : public ::testing::Test {
@@ -107,6 +111,8 @@ TEST_F(ReportBatchTest, TestBatchReport) {
 }
 
 TEST_F(ReportBatchTest, TestNoDeltaUpdate) {
+  // By default one batch is open, it is flushed when a report can't be
+  // added.
   int report_call_count = 0;
   EXPECT_CALL(mock_report_transport_, Report(_, _, _))
       .WillRepeatedly(Invoke([&](const ReportRequest& request,
@@ -129,6 +135,326 @@ TEST_F(ReportBatchTest, TestNoDeltaUpdate) {
   EXPECT_EQ(report_call_count, 2);
 }
 
+TEST_F(ReportBatchTest, TestMultipleOpenBatches) {
+  ReportOptions options(3, 1000);
+  options.max_open_batches = 2;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  std::vector<int> batch_sizes;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batch_sizes.push_back(request.attributes_size());
+        on_done(Status::OK);
+      }));
+
+  Attributes with_key;
+  utils::AttributesBuilder(&with_key).AddString("key", "value");
+  Attributes without_key;
+
+  // Reports without "key" go to a second batch, none is flushed.
+  batch_->Report(with_key);
+  batch_->Report(without_key);
+  batch_->Report(with_key);
+  EXPECT_TRUE(batch_sizes.empty());
+
+  batch_->Report(without_key);
+  EXPECT_TRUE(batch_sizes.empty());
+
+  batch_->Flush();
+  EXPECT_EQ(batch_sizes, std::vector<int>({2, 2}));
+  EXPECT_EQ(batch_->total_remote_report_calls(), 2);
+  EXPECT_EQ(batch_->batch_size_count(1), 2);
+}
+
+TEST_F(ReportBatchTest, TestMaxOpenBatches) {
+  ReportOptions options(100, 1000);
+  options.max_open_batches = 2;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  std::vector<int> batch_sizes;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batch_sizes.push_back(request.attributes_size());
+        on_done(Status::OK);
+      }));
+
+  Attributes report1;
+  utils::AttributesBuilder(&report1).AddString("key1", "value");
+  Attributes report2;
+  utils::AttributesBuilder(&report2).AddString("key2", "value");
+  Attributes report3;
+  utils::AttributesBuilder(&report3).AddString("key3", "value");
+
+  batch_->Report(report1);
+  batch_->Report(report1);
+  batch_->Report(report2);
+  EXPECT_TRUE(batch_sizes.empty());
+
+  // The third batch flushes the oldest one.
+  batch_->Report(report3);
+  EXPECT_EQ(batch_sizes, std::vector<int>({2}));
+
+  batch_->Flush();
+  EXPECT_EQ(batch_sizes, std::vector<int>({2, 1, 1}));
+  EXPECT_EQ(batch_->batch_size_count(0), 2);
+  EXPECT_EQ(batch_->batch_size_count(1), 1);
+}
+
+TEST_F(ReportBatchTest, TestReportQueue) {
+  ReportOptions options(3, 1000);
+  options.report_queue_size = 16;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  int report_call_count = 0;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        report_call_count++;
+        on_done(Status::OK);
+      }));
+
+  Attributes report;
+  utils::AttributesBuilder(&report).AddString("key", "value");
+  for (int i = 0; i < 10; ++i) {
+    batch_->Report(report);
+  }
+  EXPECT_EQ(report_call_count, 3);
+
+  batch_->Flush();
+  EXPECT_EQ(report_call_count, 4);
+}
+
+TEST_F(ReportBatchTest, TestReportQueueMultipleThreads) {
+  const int kThreads = 4;
+  const int kReports = 1000;
+  ReportOptions options(100, 1000);
+  // A small queue to also test reporting when it is full.
+  options.report_queue_size = 4;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  // The transport is called with the batch lock held.
+  int batched_reports = 0;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        batched_reports += request.attributes_size();
+        on_done(Status::OK);
+      }));
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([this, t]() {
+      Attributes report;
+      utils::AttributesBuilder(&report).AddInt64("thread", t);
+      for (int i = 0; i < kReports; ++i) {
+        utils::AttributesBuilder(&report).AddInt64("id", i);
+        batch_->Report(report);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  batch_->Flush();
+  EXPECT_EQ(batched_reports, kThreads * kReports);
+  EXPECT_EQ(batch_->total_report_calls(), kThreads * kReports);
+}
+
+TEST_F(ReportBatchTest, TestMaxBatchBytes) {
+  ReportOptions options(100, 1000);
+  options.max_batch_bytes = 100;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  std::vector<int> batch_sizes;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        EXPECT_GE(request.ByteSize(), options.max_batch_bytes);
+        batch_sizes.push_back(request.attributes_size());
+        on_done(Status::OK);
+      }));
+
+  // Each report adds about 40 bytes.
+  Attributes report;
+  for (int i = 0; i < 6; ++i) {
+    utils::AttributesBuilder(&report).AddString("key",
+                                                std::string(30, 'a' + i));
+    batch_->Report(report);
+  }
+  EXPECT_EQ(batch_sizes, std::vector<int>({3, 3}));
+}
+
+TEST(ReportBatchTimeTest, TestAdaptiveBatchTime) {
+  // Not enabled.
+  ReportOptions options(100, 1000);
+  EXPECT_EQ(ReportBatch::AdaptiveBatchTimeMs(options, 5000000, 0), 1000);
+
+  // Limited by max_batch_time_ms.
+  options.report_latency_slo_ms = 2000;
+  EXPECT_EQ(ReportBatch::AdaptiveBatchTimeMs(options, 0, 0), 1000);
+
+  // The Mixer latency is taken from the budget.
+  options.report_latency_slo_ms = 200;
+  EXPECT_EQ(ReportBatch::AdaptiveBatchTimeMs(options, 50000, 1000), 150);
+
+  // No other report is expected in the budget.
+  EXPECT_EQ(ReportBatch::AdaptiveBatchTimeMs(options, 50000, 200000), 0);
+
+  // Mixer is too slow for the budget.
+  EXPECT_EQ(ReportBatch::AdaptiveBatchTimeMs(options, 300000, 0), 0);
+}
+
+TEST_F(ReportBatchTest, TestAdaptiveBatchReport) {
+  ReportOptions options(100, 1000);
+  options.report_latency_slo_ms = 5;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  int report_call_count = 0;
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response, DoneFunc on_done) {
+        report_call_count++;
+        on_done(Status::OK);
+      }));
+
+  // The batch time is limited by the latency budget.
+  Attributes report;
+  batch_->Report(report);
+  EXPECT_EQ(report_call_count, 0);
+  ASSERT_TRUE(mock_timer_ != nullptr);
+  EXPECT_GT(mock_timer_->interval_ms_, 0);
+  EXPECT_LE(mock_timer_->interval_ms_, 5);
+  mock_timer_->cb_();
+  EXPECT_EQ(report_call_count, 1);
+
+  // Reports slower than the budget are sent right away.
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  batch_->Report(report);
+  EXPECT_EQ(report_call_count, 2);
+}
+
+class ReportBacklogTest : public ReportBatchTest {
+ public:
+  // Report the ids with at most one report call in flight, and a backlog
+  // of two batches. Return the ids sent.
+  std::vector<int64_t> ReportIds(ReportOptions::BacklogDropPolicy policy,
+                                 int count) {
+    // Batching is disabled, each report is a batch of the same size.
+    ReportOptions options(1, 1000);
+    options.max_inflight_reports = 1;
+    options.max_backlog_bytes = 2 * ReportSize(0);
+    options.backlog_drop_policy = policy;
+    batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                                 GetTimerFunc(), compressor_));
+
+    std::vector<int64_t> sent_ids;
+    std::deque<DoneFunc> pending;
+    EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+        .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                   ReportResponse* response,
+                                   DoneFunc on_done) {
+          sent_ids.push_back(request.attributes(0).int64s().begin()->second);
+          pending.push_back(on_done);
+        }));
+
+    for (int i = 0; i < count; ++i) {
+      batch_->Report(CreateReport(i));
+      EXPECT_EQ(pending.size(), 1u);
+    }
+    while (!pending.empty()) {
+      DoneFunc on_done = pending.front();
+      pending.pop_front();
+      on_done(Status::OK);
+    }
+    return sent_ids;
+  }
+
+  Attributes CreateReport(int64_t id) {
+    Attributes report;
+    utils::AttributesBuilder(&report).AddInt64("id", id);
+    return report;
+  }
+
+  size_t ReportSize(int64_t id) {
+    auto batch_compressor = compressor_.CreateBatchCompressor();
+    batch_compressor->Add(CreateReport(id));
+    return batch_compressor->byte_size();
+  }
+};
+
+TEST_F(ReportBacklogTest, TestInflightLimit) {
+  ReportOptions options(1, 1000);
+  options.max_inflight_reports = 2;
+  batch_.reset(new ReportBatch(options, mock_report_transport_.GetFunc(),
+                               GetTimerFunc(), compressor_));
+
+  // Calls are added while calling on_done, don't reallocate.
+  std::vector<DoneFunc> pending;
+  pending.reserve(5);
+  EXPECT_CALL(mock_report_transport_, Report(_, _, _))
+      .WillRepeatedly(Invoke([&](const ReportRequest& request,
+                                 ReportResponse* response,
+                                 DoneFunc on_done) {
+        pending.push_back(on_done);
+      }));
+
+  for (int i = 0; i < 5; ++i) {
+    batch_->Report(CreateReport(i));
+  }
+  EXPECT_EQ(pending.size(), 2u);
+
+  // Each completed call sends a held batch.
+  pending[0](Status::OK);
+  EXPECT_EQ(pending.size(), 3u);
+  pending[1](Status(Code::UNAVAILABLE, ""));
+  pending[2](Status::OK);
+  EXPECT_EQ(pending.size(), 5u);
+  EXPECT_EQ(batch_->total_remote_report_calls(), 5);
+  EXPECT_EQ(batch_->total_dropped_reports(), 0);
+  for (size_t i = 3; i < pending.size(); ++i) {
+    pending[i](Status::OK);
+  }
+}
+
+TEST_F(ReportBacklogTest, TestDropOldest) {
+  EXPECT_EQ(ReportIds(ReportOptions::DROP_OLDEST, 5),
+            std::vector<int64_t>({0, 3, 4}));
+  EXPECT_EQ(batch_->total_dropped_reports(), 2);
+}
+
+TEST_F(ReportBacklogTest, TestDropNewest) {
+  EXPECT_EQ(ReportIds(ReportOptions::DROP_NEWEST, 5),
+            std::vector<int64_t>({0, 1, 2}));
+  EXPECT_EQ(batch_->total_dropped_reports(), 2);
+}
+
+TEST_F(ReportBacklogTest, TestSample) {
+  EXPECT_EQ(ReportIds(ReportOptions::SAMPLE, 5),
+            std::vector<int64_t>({0, 1, 4}));
+  EXPECT_EQ(batch_->total_dropped_reports(), 2);
+}
+
+TEST(ReportBatchSizeTest, TestBatchSizeBucket) {
+  EXPECT_EQ(ReportBatch::BatchSizeBucket(1), 0);
+  EXPECT_EQ(ReportBatch::BatchSizeBucket(2), 1);
+  EXPECT_EQ(ReportBatch::BatchSizeBucket(10), 1);
+  EXPECT_EQ(ReportBatch::BatchSizeBucket(11), 2);
+  EXPECT_EQ(ReportBatch::BatchSizeBucket(100), 2);
+  EXPECT_EQ(ReportBatch::BatchSizeBucket(101), 3);
+  EXPECT_EQ(ReportBatch::BatchSizeBucket(1000), 3);
+  EXPECT_EQ(ReportBatch::BatchSizeBucket(1001), 4);
+  EXPECT_EQ(ReportBatch::BatchSizeBucket(100000), 4);
+}
+
 TEST_F(ReportBatchTest, TestBatchReportWithTimeout) {
   int report_call_count = 0;
   EXPECT_CALL(mock_report_transport_, Report(_, _, _))
@@ -0,0 +1,90 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/report_queue.h"
+
+using ::istio::mixer::v1::Attributes;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+size_t RoundUpToPowerOf2(size_t n) {
+  size_t size = 2;
+  while (size < n) {
+    size *= 2;
+  }
+  return size;
+}
+
+}  // namespace
+
+// It is the bounded queue by Dmitry Vyukov. Each cell has a sequence
+// number, a producer claims a position with CAS and publishes the cell by
+// storing its sequence. The store and the load in empty() are sequentially
+// consistent, so the caller can use empty() to re-check for reports pushed
+// while it was popping.
+ReportQueue::ReportQueue(size_t capacity)
+    : cells_(RoundUpToPowerOf2(capacity)),
+      mask_(cells_.size() - 1),
+      push_pos_(0),
+      pop_pos_(0) {
+  for (size_t i = 0; i < cells_.size(); ++i) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool ReportQueue::Push(std::unique_ptr<Attributes>* attributes) {
+  size_t pos = push_pos_.load(std::memory_order_relaxed);
+  Cell* cell;
+  for (;;) {
+    cell = &cells_[pos & mask_];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    if (sequence == pos) {
+      if (push_pos_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < pos) {
+      // The cell is not popped yet, the queue is full.
+      return false;
+    } else {
+      pos = push_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  cell->attributes = std::move(*attributes);
+  cell->sequence.store(pos + 1);
+  return true;
+}
+
+bool ReportQueue::Pop(std::unique_ptr<Attributes>* attributes) {
+  size_t pos = pop_pos_.load(std::memory_order_relaxed);
+  Cell& cell = cells_[pos & mask_];
+  if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+    return false;
+  }
+  *attributes = std::move(cell.attributes);
+  cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+  pop_pos_.store(pos + 1, std::memory_order_relaxed);
+  return true;
+}
+
+bool ReportQueue::empty() const {
+  size_t pos = pop_pos_.load(std::memory_order_relaxed);
+  return cells_[pos & mask_].sequence.load() != pos + 1;
+}
+
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,70 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_REPORT_QUEUE_H
+#define ISTIO_MIXERCLIENT_REPORT_QUEUE_H
+
+#include "google/protobuf/stubs/common.h"
+#include "mixer/v1/attributes.pb.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace istio {
+namespace mixerclient {
+
+// A bounded lock free queue of report attributes, with multiple producers
+// and a single consumer. Push() can be called from any thread. Pop() and
+// empty() must be called by one thread at a time, the caller has to
+// serialize them.
+class ReportQueue {
+ public:
+  // The capacity is rounded up to a power of 2.
+  explicit ReportQueue(size_t capacity);
+
+  // Push the attributes to the queue, take its ownership.
+  // Return false if the queue is full, attributes is not changed.
+  bool Push(std::unique_ptr<::istio::mixer::v1::Attributes>* attributes);
+
+  // Pop the oldest attributes. Return false if the queue is empty.
+  bool Pop(std::unique_ptr<::istio::mixer::v1::Attributes>* attributes);
+
+  // Return true if there is no attributes ready to pop.
+  bool empty() const;
+
+ private:
+  struct Cell {
+    // The position the cell is ready for. Equal to the position to push,
+    // or position + 1 to pop.
+    std::atomic<size_t> sequence;
+    std::unique_ptr<::istio::mixer::v1::Attributes> attributes;
+  };
+
+  std::vector<Cell> cells_;
+  const size_t mask_;
+
+  // The producer and consumer positions, padded to different cache lines.
+  std::atomic<size_t> push_pos_;
+  char padding_[64];
+  std::atomic<size_t> pop_pos_;
+
+  GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(ReportQueue);
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_REPORT_QUEUE_H
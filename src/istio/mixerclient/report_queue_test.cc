@@ -0,0 +1,106 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/report_queue.h"
+#include "gtest/gtest.h"
+#include "include/istio/utils/attributes_builder.h"
+
+#include <set>
+#include <thread>
+
+using ::istio::mixer::v1::Attributes;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+std::unique_ptr<Attributes> CreateAttributes(int64_t id) {
+  std::unique_ptr<Attributes> attributes(new Attributes);
+  utils::AttributesBuilder(attributes.get()).AddInt64("id", id);
+  return attributes;
+}
+
+int64_t GetId(const Attributes& attributes) {
+  return attributes.attributes().at("id").int64_value();
+}
+
+TEST(ReportQueueTest, TestPushPop) {
+  ReportQueue queue(3);
+  EXPECT_TRUE(queue.empty());
+
+  // The capacity is rounded up to 4.
+  for (int i = 0; i < 4; ++i) {
+    auto attributes = CreateAttributes(i);
+    EXPECT_TRUE(queue.Push(&attributes));
+    EXPECT_FALSE(attributes);
+  }
+  auto attributes = CreateAttributes(4);
+  EXPECT_FALSE(queue.Push(&attributes));
+  EXPECT_TRUE(attributes);
+  EXPECT_FALSE(queue.empty());
+
+  std::unique_ptr<Attributes> popped;
+  EXPECT_TRUE(queue.Pop(&popped));
+  EXPECT_EQ(GetId(*popped), 0);
+  EXPECT_TRUE(queue.Push(&attributes));
+
+  for (int i = 1; i <= 4; ++i) {
+    EXPECT_TRUE(queue.Pop(&popped));
+    EXPECT_EQ(GetId(*popped), i);
+  }
+  EXPECT_TRUE(queue.empty());
+  EXPECT_FALSE(queue.Pop(&popped));
+}
+
+TEST(ReportQueueTest, TestMultipleProducers) {
+  const int kThreads = 4;
+  const int kReports = 10000;
+  ReportQueue queue(64);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&queue, t]() {
+      for (int i = 0; i < kReports; ++i) {
+        auto attributes = CreateAttributes(t * kReports + i);
+        while (!queue.Push(&attributes)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  // Reports from the same producer are popped in order.
+  std::vector<int64_t> last(kThreads, -1);
+  std::set<int64_t> ids;
+  std::unique_ptr<Attributes> popped;
+  while (ids.size() < static_cast<size_t>(kThreads * kReports)) {
+    if (!queue.Pop(&popped)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int64_t id = GetId(*popped);
+    EXPECT_GT(id, last[id / kReports]);
+    last[id / kReports] = id;
+    ids.insert(id);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_TRUE(queue.empty());
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,62 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_SIGNATURE_HASHER_H_
+#define ISTIO_MIXERCLIENT_SIGNATURE_HASHER_H_
+
+#include <string.h>
+#include <string>
+
+#include "include/istio/utils/hash128.h"
+#include "include/istio/utils/md5.h"
+
+namespace istio {
+namespace mixerclient {
+
+// The hasher to calculate cache signatures.
+// Signatures are calculated with the keyed SipHash128.
+// Build with MIXERCLIENT_MD5_SIGNATURE defined to use MD5 instead.
+// A hasher is copyable, so a partially updated state can be shared.
+#ifdef MIXERCLIENT_MD5_SIGNATURE
+// An adapter to produce utils::Hash128 from MD5 digest.
+class SignatureHasher {
+ public:
+  SignatureHasher &Update(const void *data, size_t size) {
+    md5_.Update(data, size);
+    return *this;
+  }
+  SignatureHasher &Update(const std::string &str) {
+    md5_.Update(str);
+    return *this;
+  }
+  utils::Hash128 Digest() {
+    std::string digest = md5_.Digest();
+    utils::Hash128 hash;
+    memcpy(&hash.low, digest.data(), sizeof(hash.low));
+    memcpy(&hash.high, digest.data() + sizeof(hash.low), sizeof(hash.high));
+    return hash;
+  }
+
+ private:
+  utils::MD5 md5_;
+};
+#else
+using SignatureHasher = utils::SipHash128;
+#endif
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_SIGNATURE_HASHER_H_
@@ -0,0 +1,208 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/signature_plan.h"
+
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::Attributes_AttributeValue;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// Number of bits in a KeyMask word.
+const size_t kMaskBits = 64;
+
+bool IsPresent(const Attributes_AttributeValue *value,
+               const std::string &map_key) {
+  if (value == nullptr) {
+    return false;
+  }
+  if (value->value_case() != Attributes_AttributeValue::kStringMapValue) {
+    return true;
+  }
+  const auto &smap = value->string_map_value().entries();
+  return smap.find(map_key) != smap.end();
+}
+
+}  // namespace
+
+SignaturePlan::SignaturePlan(
+    const std::vector<const Referenced *> &referenced) {
+  // Collect all keys first so all masks have the same size.
+  for (const Referenced *ref : referenced) {
+    for (const auto &key : ref->absence_keys_) {
+      AddKey(AddName(key.name), key.map_key);
+    }
+    for (const auto &key : ref->exact_keys_) {
+      AddKey(AddName(key.name), key.map_key);
+    }
+  }
+
+  for (const Referenced *ref : referenced) {
+    Pattern pattern;
+    pattern.absence_mask = BuildMask(ref->absence_keys_);
+    pattern.exact_mask = BuildMask(ref->exact_keys_);
+    pattern.leaf = -1;
+    for (const KeyGroup &group : BuildGroups(ref->exact_keys_)) {
+      pattern.leaf = AddNode(pattern.leaf, group);
+    }
+    patterns_.push_back(std::move(pattern));
+  }
+}
+
+int SignaturePlan::AddName(const std::string &name) {
+  for (size_t i = 0; i < names_.size(); ++i) {
+    if (names_[i] == name) {
+      return i;
+    }
+  }
+  names_.push_back(name);
+  return names_.size() - 1;
+}
+
+int SignaturePlan::AddKey(int name_index, const std::string &map_key) {
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    if (keys_[i].name_index == name_index && keys_[i].map_key == map_key) {
+      return i;
+    }
+  }
+  keys_.push_back(Key{name_index, map_key});
+  return keys_.size() - 1;
+}
+
+SignaturePlan::KeyMask SignaturePlan::BuildMask(
+    const std::vector<Referenced::AttributeRef> &keys) {
+  KeyMask mask((keys_.size() + kMaskBits - 1) / kMaskBits, 0);
+  for (const auto &key : keys) {
+    size_t id = AddKey(AddName(key.name), key.map_key);
+    mask[id / kMaskBits] |= uint64_t(1) << (id % kMaskBits);
+  }
+  return mask;
+}
+
+std::vector<SignaturePlan::KeyGroup> SignaturePlan::BuildGroups(
+    const std::vector<Referenced::AttributeRef> &keys) {
+  std::vector<KeyGroup> groups;
+  for (Referenced::KeyIterator begin = keys.begin(), end; begin != keys.end();
+       begin = end) {
+    end = Referenced::NextName(begin, keys.end());
+    KeyGroup group;
+    group.name_index = AddName(begin->name);
+    group.keys.assign(begin, end);
+    groups.push_back(std::move(group));
+  }
+  return groups;
+}
+
+int SignaturePlan::AddNode(int parent, const KeyGroup &group) {
+  auto same_keys = [&group](const KeyGroup &other) -> bool {
+    if (other.keys.size() != group.keys.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < group.keys.size(); ++i) {
+      if (other.keys[i].name != group.keys[i].name ||
+          other.keys[i].map_key != group.keys[i].map_key) {
+        return false;
+      }
+    }
+    return true;
+  };
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    const Node &node = nodes_[i];
+    if (node.parent == parent && node.group.name_index == group.name_index &&
+        same_keys(node.group)) {
+      return i;
+    }
+  }
+  nodes_.push_back(Node{parent, group});
+  return nodes_.size() - 1;
+}
+
+SignaturePlan::Context::Context(const SignaturePlan &plan,
+                                const Attributes &attributes)
+    : plan_(plan),
+      values_(plan.names_.size(), nullptr),
+      present_((plan.keys_.size() + kMaskBits - 1) / kMaskBits, 0),
+      node_states_(plan.nodes_.size(), UNKNOWN),
+      node_hashers_(plan.nodes_.size()) {
+  const auto &attributes_map = attributes.attributes();
+  for (size_t i = 0; i < plan.names_.size(); ++i) {
+    const auto it = attributes_map.find(plan.names_[i]);
+    if (it != attributes_map.end()) {
+      values_[i] = &it->second;
+    }
+  }
+  for (size_t id = 0; id < plan.keys_.size(); ++id) {
+    const Key &key = plan.keys_[id];
+    if (IsPresent(values_[key.name_index], key.map_key)) {
+      present_[id / kMaskBits] |= uint64_t(1) << (id % kMaskBits);
+    }
+  }
+}
+
+bool SignaturePlan::Context::ComputeNode(int node) {
+  if (node_states_[node] != UNKNOWN) {
+    return node_states_[node] == MATCHED;
+  }
+
+  const Node &n = plan_.nodes_[node];
+  bool matched = n.parent < 0 || ComputeNode(n.parent);
+  if (matched) {
+    SignatureHasher hasher;
+    if (n.parent >= 0) {
+      hasher = node_hashers_[n.parent];
+    }
+    const Attributes_AttributeValue *value = values_[n.group.name_index];
+    // if an "exact" attribute not present, it is a mismatch.
+    matched = value != nullptr &&
+              Referenced::UpdateExact(plan_.names_[n.group.name_index], *value,
+                                      n.group.keys.begin(),
+                                      n.group.keys.end(), &hasher);
+    if (matched) {
+      node_hashers_[node] = hasher;
+    }
+  }
+  node_states_[node] = matched ? MATCHED : MISMATCHED;
+  return matched;
+}
+
+bool SignaturePlan::Context::Signature(size_t index,
+                                       const std::string &extra_key,
+                                       utils::Hash128 *signature) {
+  const Pattern &pattern = plan_.patterns_[index];
+  // Reject without hashing if any "absence" key is present or any "exact"
+  // key is missing.
+  for (size_t i = 0; i < present_.size(); ++i) {
+    if ((present_[i] & pattern.absence_mask[i]) != 0 ||
+        (present_[i] & pattern.exact_mask[i]) != pattern.exact_mask[i]) {
+      return false;
+    }
+  }
+
+  SignatureHasher hasher;
+  if (pattern.leaf >= 0) {
+    if (!ComputeNode(pattern.leaf)) {
+      return false;
+    }
+    hasher = node_hashers_[pattern.leaf];
+  }
+  hasher.Update(extra_key);
+  *signature = hasher.Digest();
+  return true;
+}
+
+}  // namespace mixerclient
+}  // namespace istio
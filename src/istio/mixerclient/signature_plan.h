@@ -0,0 +1,154 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_SIGNATURE_PLAN_H_
+#define ISTIO_MIXERCLIENT_SIGNATURE_PLAN_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "include/istio/utils/hash128.h"
+#include "src/istio/mixerclient/referenced.h"
+#include "src/istio/mixerclient/signature_hasher.h"
+
+namespace istio {
+namespace mixerclient {
+
+// A compiled plan to calculate signatures of multiple Referenced for the
+// same attributes. It produces the same signatures as
+// Referenced::Signature(), but:
+// * each referenced attribute and string map key is looked up only once per
+//   request for all Referenced. The results are kept in a bitmap, so the
+//   "absence" keys and the presence of "exact" keys of a Referenced are
+//   checked with a few bitwise operations before any hashing,
+// * the "exact" keys of all Referenced are merged into a trie, Referenced
+//   sharing leading "exact" keys share their partial hash.
+// A plan is immutable after it is built, it can be used by multiple threads.
+class SignaturePlan {
+ public:
+  // Build a plan for the Referenced list. The list order is kept; the
+  // index of a Referenced in the list is used to get its signature.
+  explicit SignaturePlan(const std::vector<const Referenced *> &referenced);
+
+  // Number of Referenced in the plan.
+  size_t size() const { return patterns_.size(); }
+
+  // A bitmap indexed by key id.
+  using KeyMask = std::vector<uint64_t>;
+
+  // The per request state to calculate signatures. Signatures are calculated
+  // lazily, so the cost is only paid for the Referenced actually probed.
+  // Its usage:
+  //   SignaturePlan::Context context(plan, attributes);
+  //   for (size_t i = 0; i < plan.size(); ++i) {
+  //     if (context.Signature(i, extra_key, &signature)) ...
+  //   }
+  class Context {
+   public:
+    Context(const SignaturePlan &plan,
+            const ::istio::mixer::v1::Attributes &attributes);
+
+    // Calculate the signature of the index-th Referenced.
+    // Return false if attributes are mismatched.
+    bool Signature(size_t index, const std::string &extra_key,
+                   utils::Hash128 *signature);
+
+   private:
+    // The state of a trie node.
+    enum NodeState {
+      UNKNOWN = 0,
+      MATCHED,
+      MISMATCHED,
+    };
+
+    // Calculate the partial hash of a node, return false if mismatched.
+    bool ComputeNode(int node);
+
+    const SignaturePlan &plan_;
+    // The attribute value for each name of the plan, nullptr if missing.
+    std::vector<const ::istio::mixer::v1::Attributes_AttributeValue *>
+        values_;
+    // The bitmap of present keys, indexed by key id.
+    KeyMask present_;
+    // Per trie node state and partial hash.
+    std::vector<NodeState> node_states_;
+    std::vector<SignatureHasher> node_hashers_;
+  };
+
+ private:
+  // A group of keys with the same name.
+  struct KeyGroup {
+    // Index to names_.
+    int name_index;
+    // The keys, all with the same name.
+    std::vector<Referenced::AttributeRef> keys;
+  };
+
+  // A key to check for presence. A key is present if the attribute is
+  // present and, for a string map attribute, its map_key is present.
+  struct Key {
+    // Index to names_.
+    int name_index;
+    std::string map_key;
+  };
+
+  // A trie node for a group of "exact" keys.
+  struct Node {
+    // The parent node, -1 for the root.
+    int parent;
+    KeyGroup group;
+  };
+
+  // The compiled form of a Referenced.
+  struct Pattern {
+    // The "absence" keys, all of them should not be present.
+    KeyMask absence_mask;
+    // The "exact" keys, all of them should be present.
+    KeyMask exact_mask;
+    // The trie node of the last "exact" key group, -1 if none.
+    int leaf;
+  };
+
+  // Return the index of the name in names_, add it if not found.
+  int AddName(const std::string &name);
+
+  // Return the id of the key, add it if not found.
+  int AddKey(int name_index, const std::string &map_key);
+
+  // Build a key mask for the keys.
+  KeyMask BuildMask(const std::vector<Referenced::AttributeRef> &keys);
+
+  // Build key groups from sorted keys.
+  std::vector<KeyGroup> BuildGroups(
+      const std::vector<Referenced::AttributeRef> &keys);
+
+  // Return the child node of parent for the group, add it if not found.
+  int AddNode(int parent, const KeyGroup &group);
+
+  // All attribute names used by the Referenced.
+  std::vector<std::string> names_;
+  // All keys used by the Referenced, the index is the key id.
+  std::vector<Key> keys_;
+  // The trie nodes, a parent is always before its children.
+  std::vector<Node> nodes_;
+  // The compiled Referenced.
+  std::vector<Pattern> patterns_;
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_SIGNATURE_PLAN_H_
@@ -0,0 +1,289 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/signature_plan.h"
+
+#include "include/istio/utils/attributes_builder.h"
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <iostream>
+
+using ::google::protobuf::TextFormat;
+using ::istio::mixer::v1::Attributes;
+using ::istio::mixer::v1::ReferencedAttributes;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// Names: -1: "a", -2: "b", -3: "c", -4: "d", -5: "map", -6: "k1", -7: "k2"
+const char kWords[] = R"(
+words: "a"
+words: "b"
+words: "c"
+words: "d"
+words: "map"
+words: "k1"
+words: "k2"
+)";
+
+// Referenced patterns sharing leading "exact" keys.
+const char* kReferencedTexts[] = {
+    // exact: a, b
+    R"(
+attribute_matches { name: -1, condition: EXACT }
+attribute_matches { name: -2, condition: EXACT }
+)",
+    // exact: a, c
+    R"(
+attribute_matches { name: -1, condition: EXACT }
+attribute_matches { name: -3, condition: EXACT }
+)",
+    // exact: a, b; absence: d
+    R"(
+attribute_matches { name: -1, condition: EXACT }
+attribute_matches { name: -2, condition: EXACT }
+attribute_matches { name: -4, condition: ABSENCE }
+)",
+    // no keys
+    "",
+    // exact: a, map[k1]; absence: map[k2]
+    R"(
+attribute_matches { name: -1, condition: EXACT }
+attribute_matches { name: -5, map_key: -6, condition: EXACT }
+attribute_matches { name: -5, map_key: -7, condition: ABSENCE }
+)",
+    // exact: map[k1], map[k2]
+    R"(
+attribute_matches { name: -5, map_key: -6, condition: EXACT }
+attribute_matches { name: -5, map_key: -7, condition: EXACT }
+)",
+};
+
+class SignaturePlanTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    // map_key is only decoded if the attribute is a string map.
+    Attributes attributes;
+    utils::AttributesBuilder(&attributes).AddStringMap("map", {{"k1", "v1"}});
+    for (const char* text : kReferencedTexts) {
+      ReferencedAttributes pb;
+      ASSERT_TRUE(TextFormat::ParseFromString(std::string(kWords) + text, &pb));
+      Referenced referenced;
+      ASSERT_TRUE(referenced.Fill(attributes, pb));
+      referenced_.push_back(referenced);
+    }
+    std::vector<const Referenced*> list;
+    for (const auto& referenced : referenced_) {
+      list.push_back(&referenced);
+    }
+    plan_.reset(new SignaturePlan(list));
+  }
+
+  // Verify the plan produces the same signatures as Referenced.
+  void VerifySignatures(const Attributes& attributes,
+                        const std::string& extra_key) {
+    ASSERT_EQ(plan_->size(), referenced_.size());
+    SignaturePlan::Context context(*plan_, attributes);
+    // Probe in reverse order to check lazily computed nodes.
+    for (size_t i = referenced_.size(); i-- > 0;) {
+      utils::Hash128 expected;
+      bool expected_ok =
+          referenced_[i].Signature(attributes, extra_key, &expected);
+      utils::Hash128 signature;
+      EXPECT_EQ(context.Signature(i, extra_key, &signature), expected_ok)
+          << "referenced: " << referenced_[i].DebugString();
+      if (expected_ok) {
+        EXPECT_EQ(signature, expected)
+            << "referenced: " << referenced_[i].DebugString();
+      }
+    }
+  }
+
+  void VerifySignatures(const Attributes& attributes) {
+    VerifySignatures(attributes, "");
+    VerifySignatures(attributes, "quota");
+  }
+
+  std::vector<Referenced> referenced_;
+  std::unique_ptr<SignaturePlan> plan_;
+};
+
+TEST_F(SignaturePlanTest, TestEmptyAttributes) {
+  VerifySignatures(Attributes());
+}
+
+TEST_F(SignaturePlanTest, TestSharedPrefix) {
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("a", "value-a");
+  builder.AddInt64("b", 10);
+  builder.AddBool("c", true);
+  VerifySignatures(attributes);
+
+  // Absence "d" is present.
+  builder.AddDouble("d", 1.5);
+  VerifySignatures(attributes);
+}
+
+TEST_F(SignaturePlanTest, TestPartialMatch) {
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("a", "value-a");
+  builder.AddBytes("c", "value-c");
+  VerifySignatures(attributes);
+}
+
+TEST_F(SignaturePlanTest, TestStringMap) {
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("a", "value-a");
+  builder.AddStringMap("map", {{"k1", "v1"}});
+  VerifySignatures(attributes);
+
+  builder.AddStringMap("map", {{"k1", "v1"}, {"k2", "v2"}});
+  VerifySignatures(attributes);
+
+  builder.AddStringMap("map", {{"k2", "v2"}});
+  VerifySignatures(attributes);
+}
+
+TEST_F(SignaturePlanTest, TestDifferentSignatures) {
+  Attributes attributes1;
+  utils::AttributesBuilder(&attributes1).AddString("a", "value-1");
+  Attributes attributes2;
+  utils::AttributesBuilder(&attributes2).AddString("a", "value-2");
+
+  SignaturePlan::Context context1(*plan_, attributes1);
+  SignaturePlan::Context context2(*plan_, attributes2);
+  utils::Hash128 signature1, signature2;
+  // The referenced without keys matches both.
+  EXPECT_TRUE(context1.Signature(3, "", &signature1));
+  EXPECT_TRUE(context2.Signature(3, "", &signature2));
+  EXPECT_EQ(signature1, signature2);
+  EXPECT_TRUE(context1.Signature(3, "quota", &signature2));
+  EXPECT_NE(signature1, signature2);
+}
+
+TEST_F(SignaturePlanTest, TestRejectByPresenceIndex) {
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("a", "value-a");
+  builder.AddInt64("b", 1);
+  builder.AddDouble("d", 1.0);
+  builder.AddStringMap("map", {{"k1", "v1"}, {"k2", "v2"}});
+
+  SignaturePlan::Context context(*plan_, attributes);
+  utils::Hash128 signature;
+  EXPECT_TRUE(context.Signature(0, "", &signature));
+  // "c" is missing.
+  EXPECT_FALSE(context.Signature(1, "", &signature));
+  // "d" is present.
+  EXPECT_FALSE(context.Signature(2, "", &signature));
+  // "map[k2]" is present.
+  EXPECT_FALSE(context.Signature(4, "", &signature));
+  EXPECT_TRUE(context.Signature(5, "", &signature));
+
+  builder.AddStringMap("map", {{"k1", "v1"}});
+  SignaturePlan::Context context1(*plan_, attributes);
+  EXPECT_TRUE(context1.Signature(4, "", &signature));
+  // "map[k2]" is missing.
+  EXPECT_FALSE(context1.Signature(5, "", &signature));
+}
+
+// Many patterns sharing "absence" header keys against a large header map, as
+// seen for services with many referenced shapes.
+TEST(SignaturePlanPerfTest, TestLargeHeaderMap) {
+  const int kHeaders = 100;
+  const int kPatterns = 20;
+  std::map<std::string, std::string> headers;
+  for (int i = 0; i < kHeaders; ++i) {
+    headers["header-" + std::to_string(i)] = "value-" + std::to_string(i);
+  }
+  Attributes attributes;
+  utils::AttributesBuilder builder(&attributes);
+  builder.AddString("target.service", "svc");
+  builder.AddStringMap("request.headers", headers);
+
+  std::vector<Referenced> referenced(kPatterns);
+  std::vector<const Referenced*> list;
+  for (int p = 0; p < kPatterns; ++p) {
+    ReferencedAttributes pb;
+    pb.add_words("target.service");
+    pb.add_words("request.headers");
+    auto match = pb.add_attribute_matches();
+    match->set_name(-1);
+    match->set_condition(ReferencedAttributes::EXACT);
+    for (int k = 0; k < 10; ++k) {
+      pb.add_words("x-absent-" + std::to_string(k));
+      match = pb.add_attribute_matches();
+      match->set_name(-2);
+      match->set_map_key(-pb.words_size());
+      match->set_condition(ReferencedAttributes::ABSENCE);
+    }
+    // Only the last pattern matches, others require a missing header.
+    pb.add_words(p < kPatterns - 1 ? "x-missing-" + std::to_string(p)
+                                   : "header-0");
+    match = pb.add_attribute_matches();
+    match->set_name(-2);
+    match->set_map_key(-pb.words_size());
+    match->set_condition(ReferencedAttributes::EXACT);
+    ASSERT_TRUE(referenced[p].Fill(attributes, pb));
+    list.push_back(&referenced[p]);
+  }
+  SignaturePlan plan(list);
+
+  const int kLoops = 10000;
+  utils::Hash128 expected, signature;
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < kLoops; ++n) {
+    for (int p = 0; p < kPatterns; ++p) {
+      if (referenced[p].Signature(attributes, "", &expected)) {
+        break;
+      }
+    }
+  }
+  auto referenced_time = std::chrono::steady_clock::now() - start;
+
+  start = std::chrono::steady_clock::now();
+  for (int n = 0; n < kLoops; ++n) {
+    SignaturePlan::Context context(plan, attributes);
+    for (int p = 0; p < kPatterns; ++p) {
+      if (context.Signature(p, "", &signature)) {
+        break;
+      }
+    }
+  }
+  auto plan_time = std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(signature, expected);
+
+  std::cerr << "===Signature of " << kPatterns << " patterns, Referenced: "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   referenced_time)
+                       .count() /
+                   kLoops
+            << " ns, SignaturePlan: "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(plan_time)
+                       .count() /
+                   kLoops
+            << " ns" << std::endl;
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
@@ -0,0 +1,287 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/timed_check_transport.h"
+
+#include <algorithm>
+
+using namespace std::chrono;
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::error::Code;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+// Latency percentiles are used after this many samples.
+const int64_t kMinLatencySamples = 100;
+
+// The latency histogram is decayed after this many samples.
+const int64_t kMaxLatencySamples = 10000;
+
+}  // namespace
+
+struct TimedCheckTransport::CallState {
+  TransportCheckFunc transport;
+  const CheckRequest* request;
+  CheckResponse* response;
+  // The response of the hedged call.
+  CheckResponse hedge_response;
+  // Cleared when the call is finished.
+  DoneFunc on_done;
+
+  // The original call and the hedged call.
+  bool pending[2] = {false, false};
+  CancelFunc cancel[2];
+  steady_clock::time_point start_time[2];
+
+  PooledTimer* timeout_timer = nullptr;
+  PooledTimer* hedge_timer = nullptr;
+};
+
+TimedCheckTransport::TimedCheckTransport(const CheckOptions& options,
+                                         TimerCreateFunc timer_create,
+                                         LatencyRecordFunc on_latency)
+    : options_(options),
+      timer_create_(timer_create),
+      latency_(kMaxLatencySamples, on_latency),
+      total_hedged_calls_(0),
+      total_timeouts_(0) {}
+
+int TimedCheckTransport::TimeoutMs() const {
+  int timeout_ms = options_.check_timeout_ms;
+  if (timeout_ms <= 0 || !options_.adaptive_check_timeout ||
+      latency_.count() < kMinLatencySamples) {
+    return std::max(timeout_ms, 0);
+  }
+  int64_t adaptive_ms = static_cast<int64_t>(
+      latency_.Percentile(99) * options_.adaptive_timeout_multiplier / 1000);
+  adaptive_ms = std::max<int64_t>(adaptive_ms, options_.min_check_timeout_ms);
+  return static_cast<int>(std::min<int64_t>(adaptive_ms, timeout_ms));
+}
+
+int TimedCheckTransport::HedgeDelayMs() const {
+  if (options_.hedge_check_percentile <= 0 ||
+      latency_.count() < kMinLatencySamples) {
+    return 0;
+  }
+  int64_t delay_us = latency_.Percentile(options_.hedge_check_percentile);
+  // Round up to the timer resolution.
+  return static_cast<int>(std::max<int64_t>((delay_us + 999) / 1000, 1));
+}
+
+CancelFunc TimedCheckTransport::Call(TransportCheckFunc transport,
+                                     const CheckRequest& request,
+                                     CheckResponse* response, bool hedge,
+                                     DoneFunc on_done) {
+  int timeout_ms = TimeoutMs();
+  int hedge_delay_ms = hedge ? HedgeDelayMs() : 0;
+  if (timeout_ms > 0 && hedge_delay_ms >= timeout_ms) {
+    hedge_delay_ms = 0;
+  }
+  if (!timer_create_ || (timeout_ms == 0 && hedge_delay_ms == 0)) {
+    // Only record the latency.
+    steady_clock::time_point start_time = steady_clock::now();
+    return transport(request, response,
+                     [this, start_time, on_done](const Status& status) {
+                       if (status.ok()) {
+                         latency_.Record(duration_cast<microseconds>(
+                                             steady_clock::now() - start_time)
+                                             .count());
+                       }
+                       on_done(status);
+                     });
+  }
+
+  CallStatePtr call = std::make_shared<CallState>();
+  call->transport = transport;
+  call->request = &request;
+  call->response = response;
+  call->on_done = on_done;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    call->pending[0] = true;
+    call->start_time[0] = steady_clock::now();
+    if (timeout_ms > 0) {
+      call->timeout_timer =
+          StartTimerWithLock(timeout_ms, [this, call]() { OnTimeout(call); });
+    }
+    if (hedge_delay_ms > 0) {
+      call->hedge_timer =
+          StartTimerWithLock(hedge_delay_ms, [this, call]() { OnHedge(call); });
+    }
+  }
+
+  CancelFunc cancel =
+      transport(request, response, [this, call](const Status& status) {
+        OnDone(call, 0, status);
+      });
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The call may be done already.
+    if (call->pending[0]) {
+      call->cancel[0] = cancel;
+    }
+  }
+  return [this, call]() { Cancel(call); };
+}
+
+void TimedCheckTransport::OnDone(const CallStatePtr& call, int index,
+                                 const Status& status) {
+  DoneFunc on_done;
+  std::vector<CancelFunc> cancels;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!call->pending[index]) {
+      return;
+    }
+    call->pending[index] = false;
+    call->cancel[index] = nullptr;
+    if (status.ok()) {
+      latency_.Record(duration_cast<microseconds>(steady_clock::now() -
+                                                  call->start_time[index])
+                          .count());
+    }
+    // Wait for the other call if this one failed.
+    if (!call->on_done || (!status.ok() && call->pending[1 - index])) {
+      return;
+    }
+    if (index == 1) {
+      call->response->Swap(&call->hedge_response);
+    }
+    on_done = FinishWithLock(call.get(), &cancels);
+  }
+  for (const auto& cancel : cancels) {
+    cancel();
+  }
+  on_done(status);
+}
+
+void TimedCheckTransport::OnHedge(const CallStatePtr& call) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ReleaseTimerWithLock(call->hedge_timer);
+    call->hedge_timer = nullptr;
+    if (!call->on_done || !call->pending[0]) {
+      return;
+    }
+    call->pending[1] = true;
+    call->start_time[1] = steady_clock::now();
+  }
+  ++total_hedged_calls_;
+
+  // Same request with the same deduplication id, so Mixer doesn't
+  // allocate quota twice.
+  CancelFunc cancel = call->transport(
+      *call->request, &call->hedge_response,
+      [this, call](const Status& status) { OnDone(call, 1, status); });
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (call->pending[1]) {
+    call->cancel[1] = cancel;
+  }
+}
+
+void TimedCheckTransport::OnTimeout(const CallStatePtr& call) {
+  DoneFunc on_done;
+  std::vector<CancelFunc> cancels;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!call->on_done) {
+      return;
+    }
+    on_done = FinishWithLock(call.get(), &cancels);
+  }
+  ++total_timeouts_;
+  for (const auto& cancel : cancels) {
+    cancel();
+  }
+  on_done(Status(Code::DEADLINE_EXCEEDED, "Mixer Check call timed out"));
+}
+
+void TimedCheckTransport::Cancel(const CallStatePtr& call) {
+  std::vector<CancelFunc> cancels;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!call->on_done) {
+      return;
+    }
+    FinishWithLock(call.get(), &cancels);
+  }
+  for (const auto& cancel : cancels) {
+    cancel();
+  }
+}
+
+DoneFunc TimedCheckTransport::FinishWithLock(
+    CallState* call, std::vector<CancelFunc>* cancels) {
+  for (int i = 0; i < 2; ++i) {
+    if (call->pending[i]) {
+      call->pending[i] = false;
+      if (call->cancel[i]) {
+        cancels->push_back(std::move(call->cancel[i]));
+      }
+      call->cancel[i] = nullptr;
+    }
+  }
+  if (call->timeout_timer != nullptr) {
+    ReleaseTimerWithLock(call->timeout_timer);
+    call->timeout_timer = nullptr;
+  }
+  if (call->hedge_timer != nullptr) {
+    ReleaseTimerWithLock(call->hedge_timer);
+    call->hedge_timer = nullptr;
+  }
+  DoneFunc on_done = std::move(call->on_done);
+  call->on_done = nullptr;
+  return on_done;
+}
+
+TimedCheckTransport::PooledTimer* TimedCheckTransport::StartTimerWithLock(
+    int interval_ms, std::function<void()> callback) {
+  PooledTimer* timer;
+  if (free_timers_.empty()) {
+    timers_.emplace_back(new PooledTimer);
+    timer = timers_.back().get();
+    timer->timer = timer_create_([this, timer]() {
+      // Copy the callback, the timer may be released by it.
+      std::function<void()> callback;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callback = timer->callback;
+      }
+      if (callback) {
+        callback();
+      }
+    });
+  } else {
+    timer = free_timers_.back();
+    free_timers_.pop_back();
+  }
+  timer->callback = std::move(callback);
+  timer->timer->Start(interval_ms);
+  return timer;
+}
+
+void TimedCheckTransport::ReleaseTimerWithLock(PooledTimer* timer) {
+  timer->timer->Stop();
+  // Release the call state held by the callback.
+  timer->callback = nullptr;
+  free_timers_.push_back(timer);
+}
+
+}  // namespace mixerclient
+}  // namespace istio
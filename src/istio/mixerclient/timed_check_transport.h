@@ -0,0 +1,114 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_MIXERCLIENT_TIMED_CHECK_TRANSPORT_H
+#define ISTIO_MIXERCLIENT_TIMED_CHECK_TRANSPORT_H
+
+#include "include/istio/mixerclient/environment.h"
+#include "include/istio/mixerclient/options.h"
+#include "src/istio/mixerclient/latency_histogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace istio {
+namespace mixerclient {
+
+// Adds a timeout and hedging to remote Check calls, see CheckOptions.
+// This class is thread safe.
+class TimedCheckTransport {
+ public:
+  // on_latency is called with the latency of each successful call.
+  TimedCheckTransport(const CheckOptions& options,
+                      TimerCreateFunc timer_create,
+                      LatencyRecordFunc on_latency = nullptr);
+
+  // Make a Check call with transport. If hedge is true, the call may be
+  // sent twice, and the first response is used. The request has to be
+  // valid until on_done is called or the call is cancelled.
+  CancelFunc Call(TransportCheckFunc transport,
+                  const ::istio::mixer::v1::CheckRequest& request,
+                  ::istio::mixer::v1::CheckResponse* response, bool hedge,
+                  DoneFunc on_done);
+
+  // The timeout of a new call in milliseconds, 0 if no timeout.
+  int TimeoutMs() const;
+
+  // The delay to hedge a new call in milliseconds, 0 if not hedging.
+  int HedgeDelayMs() const;
+
+  uint64_t total_hedged_calls() const { return total_hedged_calls_; }
+  uint64_t total_timeouts() const { return total_timeouts_; }
+
+  // Latencies of successful calls.
+  const LatencyHistogram& latency() const { return latency_; }
+
+ private:
+  // A pooled timer. Its callback is set while it is used by a call.
+  struct PooledTimer {
+    std::unique_ptr<Timer> timer;
+    std::function<void()> callback;
+  };
+
+  // The state of a call.
+  struct CallState;
+  using CallStatePtr = std::shared_ptr<CallState>;
+
+  // Called when the original call (index 0) or the hedged call (index 1)
+  // is done.
+  void OnDone(const CallStatePtr& call, int index,
+              const ::google::protobuf::util::Status& status);
+
+  // Send the hedged call.
+  void OnHedge(const CallStatePtr& call);
+
+  // Fail the call.
+  void OnTimeout(const CallStatePtr& call);
+
+  // Cancel the call.
+  void Cancel(const CallStatePtr& call);
+
+  // Finish the call, collect the cancel functions of pending transport
+  // calls, and return the on_done function.
+  DoneFunc FinishWithLock(CallState* call, std::vector<CancelFunc>* cancels);
+
+  // Start a pooled timer calling callback.
+  PooledTimer* StartTimerWithLock(int interval_ms,
+                                  std::function<void()> callback);
+
+  // Stop a timer and return it to the pool.
+  void ReleaseTimerWithLock(PooledTimer* timer);
+
+  const CheckOptions options_;
+  TimerCreateFunc timer_create_;
+
+  LatencyHistogram latency_;
+
+  // Mutex guarding call states and timers.
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<PooledTimer>> timers_;
+  std::vector<PooledTimer*> free_timers_;
+
+  std::atomic_int_fast64_t total_hedged_calls_;
+  std::atomic_int_fast64_t total_timeouts_;
+};
+
+}  // namespace mixerclient
+}  // namespace istio
+
+#endif  // ISTIO_MIXERCLIENT_TIMED_CHECK_TRANSPORT_H
@@ -0,0 +1,219 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/mixerclient/timed_check_transport.h"
+#include "gtest/gtest.h"
+
+#include <deque>
+
+using ::google::protobuf::util::Status;
+using ::google::protobuf::util::error::Code;
+using ::istio::mixer::v1::CheckRequest;
+using ::istio::mixer::v1::CheckResponse;
+
+namespace istio {
+namespace mixerclient {
+namespace {
+
+class MockTimer : public Timer {
+ public:
+  void Stop() override { interval_ms = 0; }
+  void Start(int interval_ms) override { this->interval_ms = interval_ms; }
+  // The interval of the started timer, 0 if stopped.
+  int interval_ms = 0;
+  std::function<void()> cb;
+};
+
+class TimedCheckTransportTest : public ::testing::Test {
+ public:
+  void CreateTransport(const CheckOptions& options) {
+    transport_.reset(
+        new TimedCheckTransport(options, [this](std::function<void()> cb) {
+          MockTimer* timer = new MockTimer;
+          timer->cb = cb;
+          timers_.push_back(timer);
+          return std::unique_ptr<Timer>(timer);
+        }));
+  }
+
+  // A transport storing the calls.
+  TransportCheckFunc GetTransportFunc() {
+    return [this](const CheckRequest& request, CheckResponse* response,
+                  DoneFunc on_done) -> CancelFunc {
+      int index = calls_.size();
+      calls_.push_back({response, on_done, false});
+      return [this, index]() { calls_[index].cancelled = true; };
+    };
+  }
+
+  // Complete a call with a response of the valid use count.
+  void Respond(int index, int valid_use_count) {
+    calls_[index].response->mutable_precondition()->set_valid_use_count(
+        valid_use_count);
+    calls_[index].on_done(Status::OK);
+  }
+
+  // Make a call, return its cancel function.
+  CancelFunc Call(bool hedge) {
+    return transport_->Call(GetTransportFunc(), request_, &response_, hedge,
+                            [this](const Status& status) {
+                              ++done_count_;
+                              status_ = status;
+                            });
+  }
+
+  // Record the latency samples needed for percentiles.
+  void WarmUp() {
+    for (int i = 0; i < 100; ++i) {
+      Call(false);
+      calls_.back().on_done(Status::OK);
+    }
+    calls_.clear();
+    done_count_ = 0;
+  }
+
+  // Fire the started timers, the oldest first.
+  void FireTimer(int interval_ms) {
+    for (MockTimer* timer : timers_) {
+      if (timer->interval_ms == interval_ms) {
+        timer->interval_ms = 0;
+        timer->cb();
+        return;
+      }
+    }
+    ADD_FAILURE() << "No timer with interval " << interval_ms;
+  }
+
+  struct TransportCall {
+    CheckResponse* response;
+    DoneFunc on_done;
+    bool cancelled;
+  };
+  std::deque<TransportCall> calls_;
+  std::vector<MockTimer*> timers_;
+  std::unique_ptr<TimedCheckTransport> transport_;
+
+  CheckRequest request_;
+  CheckResponse response_;
+  int done_count_ = 0;
+  Status status_;
+};
+
+TEST_F(TimedCheckTransportTest, TestNoTimeout) {
+  CreateTransport(CheckOptions());
+  Call(true);
+  EXPECT_TRUE(timers_.empty());
+  Respond(0, 5);
+  EXPECT_EQ(done_count_, 1);
+  EXPECT_TRUE(status_.ok());
+  EXPECT_EQ(response_.precondition().valid_use_count(), 5);
+  EXPECT_EQ(transport_->latency().count(), 1);
+}
+
+TEST_F(TimedCheckTransportTest, TestTimeout) {
+  CheckOptions options;
+  options.check_timeout_ms = 100;
+  CreateTransport(options);
+
+  Call(false);
+  FireTimer(100);
+  EXPECT_EQ(done_count_, 1);
+  EXPECT_EQ(status_.error_code(), Code::DEADLINE_EXCEEDED);
+  EXPECT_TRUE(calls_[0].cancelled);
+  EXPECT_EQ(transport_->total_timeouts(), 1);
+
+  // The timer is reused, and stopped when the call is done.
+  Call(false);
+  EXPECT_EQ(timers_.size(), 1);
+  Respond(1, 5);
+  EXPECT_EQ(done_count_, 2);
+  EXPECT_TRUE(status_.ok());
+  EXPECT_EQ(timers_[0]->interval_ms, 0);
+}
+
+TEST_F(TimedCheckTransportTest, TestCancel) {
+  CheckOptions options;
+  options.check_timeout_ms = 100;
+  CreateTransport(options);
+
+  CancelFunc cancel = Call(false);
+  cancel();
+  EXPECT_TRUE(calls_[0].cancelled);
+  EXPECT_EQ(timers_[0]->interval_ms, 0);
+  EXPECT_EQ(done_count_, 0);
+}
+
+TEST_F(TimedCheckTransportTest, TestAdaptiveTimeout) {
+  CheckOptions options;
+  options.check_timeout_ms = 1000;
+  options.adaptive_check_timeout = true;
+  options.min_check_timeout_ms = 20;
+  CreateTransport(options);
+  EXPECT_EQ(transport_->TimeoutMs(), 1000);
+
+  // The calls are done right away, the timeout is the minimum.
+  WarmUp();
+  EXPECT_EQ(transport_->TimeoutMs(), 20);
+}
+
+TEST_F(TimedCheckTransportTest, TestHedge) {
+  CheckOptions options;
+  options.check_timeout_ms = 100;
+  options.hedge_check_percentile = 90;
+  CreateTransport(options);
+
+  // Not hedged before enough latency samples.
+  EXPECT_EQ(transport_->HedgeDelayMs(), 0);
+  WarmUp();
+  EXPECT_EQ(transport_->HedgeDelayMs(), 1);
+
+  // Not hedged for non blocking calls.
+  Call(false);
+  Respond(0, 1);
+  EXPECT_EQ(calls_.size(), 1);
+
+  // The hedged call responds first.
+  Call(true);
+  FireTimer(1);
+  ASSERT_EQ(calls_.size(), 3);
+  EXPECT_EQ(transport_->total_hedged_calls(), 1);
+  Respond(2, 7);
+  EXPECT_EQ(done_count_, 2);
+  EXPECT_EQ(response_.precondition().valid_use_count(), 7);
+  EXPECT_TRUE(calls_[1].cancelled);
+  EXPECT_FALSE(calls_[2].cancelled);
+}
+
+TEST_F(TimedCheckTransportTest, TestHedgeFailure) {
+  CheckOptions options;
+  options.check_timeout_ms = 100;
+  options.hedge_check_percentile = 90;
+  CreateTransport(options);
+  WarmUp();
+
+  // The original call fails, wait for the hedged call.
+  Call(true);
+  FireTimer(1);
+  calls_[0].on_done(Status(Code::UNAVAILABLE, ""));
+  EXPECT_EQ(done_count_, 0);
+  Respond(1, 3);
+  EXPECT_EQ(done_count_, 1);
+  EXPECT_TRUE(status_.ok());
+  EXPECT_EQ(response_.precondition().valid_use_count(), 3);
+}
+
+}  // namespace
+}  // namespace mixerclient
+}  // namespace istio
@@ -16,7 +16,6 @@
 #ifndef ISTIO_PREFETCH_CIRCULAR_QUEUE_H_
 #define ISTIO_PREFETCH_CIRCULAR_QUEUE_H_
 
-#include <functional>
 #include <vector>
 
 namespace istio {
@@ -38,8 +37,18 @@ class CircularQueue {
   // Allow modifying the head item.
   T* Head();
 
-  // Calls the fn function for each element from head to tail.
-  void Iterate(std::function<bool(T&)> fn);
+  // Allow modifying the index-th item from the head. Return nullptr if
+  // index is out of range.
+  T* At(int index);
+
+  // The number of items.
+  int size() const { return count_; }
+
+  // Calls the fn function for each element from head to tail, stops if it
+  // returns false. fn is called as bool fn(T&), it is a template parameter
+  // so it can be inlined.
+  template <class Fn>
+  void Iterate(Fn fn);
 
  private:
   std::vector<T> nodes_;
@@ -82,12 +91,19 @@ T* CircularQueue<T>::Head() {
 }
 
 template <class T>
-void CircularQueue<T>::Iterate(std::function<bool(T&)> fn) {
-  if (count_ == 0) return;
+T* CircularQueue<T>::At(int index) {
+  if (index < 0 || index >= count_) return nullptr;
+  return &nodes_[(head_ + index) % nodes_.size()];
+}
+
+template <class T>
+template <class Fn>
+void CircularQueue<T>::Iterate(Fn fn) {
   int i = head_;
-  while (i != tail_) {
+  // Count the items, head_ == tail_ if the queue is full.
+  for (int n = 0; n < count_; ++n) {
     if (!fn(nodes_[i])) return;
-    i = (i + 1) % nodes_.size();
+    if (++i == static_cast<int>(nodes_.size())) i = 0;
   }
 }
 
@@ -68,6 +68,34 @@ TEST(CircularQueueTest, TestResize2) {
   ASSERT_RESULT(q, {3, 4, 5, 6, 7, 8, 9});
 }
 
+TEST(CircularQueueTest, TestFull) {
+  CircularQueue<int> q(3);
+  q.Push(1);
+  q.Push(2);
+  q.Pop();
+  q.Push(3);
+  q.Push(4);
+  ASSERT_RESULT(q, {2, 3, 4});
+}
+
+TEST(CircularQueueTest, TestAt) {
+  CircularQueue<int> q(3);
+  q.Push(1);
+  q.Push(2);
+  q.Pop();
+  q.Push(3);
+  q.Push(4);
+  ASSERT_EQ(q.size(), 3);
+  ASSERT_EQ(*q.At(0), 2);
+  ASSERT_EQ(*q.At(1), 3);
+  ASSERT_EQ(*q.At(2), 4);
+  ASSERT_EQ(q.At(3), nullptr);
+  ASSERT_EQ(q.At(-1), nullptr);
+
+  *q.At(1) = 5;
+  ASSERT_RESULT(q, {2, 5, 4});
+}
+
 }  // namespace
 }  // namespace prefetch
 }  // namespace istio
@@ -15,9 +15,14 @@
 
 #include "include/istio/prefetch/quota_prefetch.h"
 #include "src/istio/prefetch/circular_queue.h"
+#include "src/istio/prefetch/rate_predictor.h"
 #include "src/istio/prefetch/time_based_counter.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 using namespace std::chrono;
 
@@ -30,12 +35,11 @@ using namespace std::chrono;
             << duration_cast<milliseconds>(t.time_since_epoch()).count() \
             << "):"
 #else
-// Pipe to stringstream to disable logging.
-#include <sstream>
-std::ostringstream os;
+// Disable logging, the statements are never evaluated. A shared stream
+// would be written by prefetch objects in different threads.
+#include <iostream>
 #define LOG(t) \
-  os.clear();  \
-  os
+  while (false) std::cerr
 #endif
 
 namespace istio {
@@ -62,6 +66,38 @@ const int kTimeBasedWindowSize = 20;
 // before it is granted. Usually is 1 minute.
 const int kMaxExpirationInMs = 60000;
 
+// The weight of the newest prefetch round trip in its moving average.
+const double kRoundTripWeight = 0.25;
+
+// The size of a cache line, sub-pools are aligned to it.
+const int kCacheLineSize = 64;
+
+// A small index for the calling thread, assigned on its first call.
+int ThreadIndex() {
+  static std::atomic<int> next_index(0);
+  thread_local int index = next_index++;
+  return index;
+}
+
+// A sub-pool word has the available tokens in the low 32 bits and the
+// amount passed in the high 32 bits, so both change in one CAS.
+const int kPassShift = 32;
+const uint64_t kAvailableMask = 0xffffffffULL;
+
+// Take the amount from the tokens of the word and count it as passed,
+// without a lock. Return false if there are not enough tokens.
+bool TakeTokens(std::atomic<uint64_t>* word, int amount) {
+  uint64_t value = word->load();
+  while (static_cast<int64_t>(value & kAvailableMask) >= amount) {
+    uint64_t taken = value - amount +
+                     (static_cast<uint64_t>(amount) << kPassShift);
+    if (word->compare_exchange_weak(value, taken)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 // The implementation class to hide internal implementation detail.
 class QuotaPrefetchImpl : public QuotaPrefetch {
  public:
@@ -78,6 +114,14 @@ class QuotaPrefetchImpl : public QuotaPrefetch {
     SlotId id;
   };
 
+  // A per worker share of the leased tokens. Each one takes a whole cache
+  // line so workers using their own sub-pool don't share cache lines.
+  struct alignas(kCacheLineSize) SubPool {
+    // The leased tokens left in the sub-pool and the amount passed with
+    // its tokens, see TakeTokens().
+    std::atomic<uint64_t> word;
+  };
+
   // The mode.
   enum Mode {
     OPEN = 0,
@@ -87,23 +131,45 @@ class QuotaPrefetchImpl : public QuotaPrefetch {
   QuotaPrefetchImpl(TransportFunc transport, const Options& options, Tick t)
       : queue_(kInitQueueSize),
         counter_(kTimeBasedWindowSize, options.predict_window, t),
+        round_trip_ms_(0),
         mode_(OPEN),
         inflight_count_(0),
         transport_(transport),
         options_(options),
-        next_slot_id_(0) {}
+        next_slot_id_(0),
+        available_(0),
+        next_expire_time_(Tick::max()),
+        sub_pools_(std::max(options.num_sub_pools, 1)),
+        lease_expire_time_(0),
+        lease_amount_(0),
+        lease_slot_id_(0) {
+    if (options.rate_weight > 0) {
+      predictor_.reset(new RatePredictor(
+          options.predict_window / kTimeBasedWindowSize, options.rate_weight,
+          options.trend_weight, t));
+    }
+    for (auto& pool : sub_pools_) {
+      pool.word = 0;
+    }
+  }
 
   bool Check(int amount, Tick t) override;
+  bool Check(int amount, const TransportFunc& transport, Tick t) override;
 
  private:
   // Count available token
   int CountAvailable(Tick t);
-  // Check available count is bigger than minimum
-  int CheckMinAvailable(int min, Tick t);
+  // Remove the available amounts of expired slots.
+  void Expire(Tick t);
+  // The desired amount to prefetch.
+  int DesiredAmount(Tick t);
+  // Count the passed amount.
+  void CountPassed(int amount, Tick t);
   // Check to see if need to do a prefetch.
-  void AttemptPrefetch(int amount, Tick t);
+  void AttemptPrefetch(int amount, const TransportFunc& transport, Tick t);
   // Make a prefetch call.
-  void Prefetch(int req_amount, bool use_not_granted, Tick t);
+  void Prefetch(int req_amount, bool use_not_granted,
+                const TransportFunc& transport, Tick t);
   // Add the amount to the queue, and return slot id.
   SlotId Add(int amount, Tick expiration);
   // Substract the amount from the queue.
@@ -111,9 +177,15 @@ class QuotaPrefetchImpl : public QuotaPrefetch {
   int Substract(int delta, Tick t);
   // On quota allocation response.
   void OnResponse(SlotId slot_id, int req_amount, int resp_amount,
-                  milliseconds expiration, Tick t);
-  // Find the slot by id.
+                  milliseconds expiration, Tick send_time, Tick t);
+  // Find the slot by id, nullptr if it is not in the queue.
   Slot* FindSlotById(SlotId id);
+  // Take the amount from the leased tokens without the lock.
+  bool CheckLease(int amount, Tick t);
+  // Lease tokens of the head slot to CheckLease(), split among sub-pools.
+  void Lease(Tick t);
+  // End the lease, substract the used tokens from the leased slot.
+  void EndLease();
 
   // The mutex guarding all member variables.
   std::mutex mutex_;
@@ -121,6 +193,10 @@ class QuotaPrefetchImpl : public QuotaPrefetch {
   CircularQueue<Slot> queue_;
   // The counter to count number of requests in the pass window.
   TimeBasedCounter counter_;
+  // The predictor of the passed amount, nullptr if disabled.
+  std::unique_ptr<RatePredictor> predictor_;
+  // The moving average of the prefetch round trips.
+  double round_trip_ms_;
   // The current mode.
   Mode mode_;
   // Last prefetch time.
@@ -133,32 +209,72 @@ class QuotaPrefetchImpl : public QuotaPrefetch {
   Options options_;
   // next slot id
   SlotId next_slot_id_;
+  // The sum of available amounts in the queue, expired amounts are
+  // removed by Expire().
+  int available_;
+  // No available amount in the queue expires before this time.
+  Tick next_expire_time_;
+
+  // The tokens leased to the lock free path in Check(), in per worker
+  // sub-pools. They are still counted in their slot and available_ until
+  // EndLease().
+  std::vector<SubPool> sub_pools_;
+  // The leased tokens can be used before this time, as Tick count.
+  std::atomic<Tick::rep> lease_expire_time_;
+  // The leased amount, the id of its slot and the lease time, guarded by
+  // mutex_.
+  int lease_amount_;
+  SlotId lease_slot_id_;
+  Tick lease_time_;
 };
 
 int QuotaPrefetchImpl::CountAvailable(Tick t) {
-  int avail = 0;
-  queue_.Iterate([&](Slot& slot) -> bool {
-    if (t < slot.expire_time) {
-      avail += slot.available;
-    }
-    return true;
-  });
-  return avail;
+  Expire(t);
+  return available_;
 }
 
-int QuotaPrefetchImpl::CheckMinAvailable(int min, Tick t) {
-  int avail = 0;
+void QuotaPrefetchImpl::Expire(Tick t) {
+  if (t < next_expire_time_) {
+    return;
+  }
+  // Only scan the queue when an amount may be expired.
+  next_expire_time_ = Tick::max();
   queue_.Iterate([&](Slot& slot) -> bool {
-    if (t < slot.expire_time) {
-      avail += slot.available;
-      if (avail >= min) return false;
+    if (slot.available > 0) {
+      if (t < slot.expire_time) {
+        next_expire_time_ = std::min(next_expire_time_, slot.expire_time);
+      } else {
+        LOG(t) << "Expired:" << slot.available << std::endl;
+        available_ -= slot.available;
+        slot.available = 0;
+      }
     }
     return true;
   });
-  return avail >= min;
 }
 
-void QuotaPrefetchImpl::AttemptPrefetch(int amount, Tick t) {
+int QuotaPrefetchImpl::DesiredAmount(Tick t) {
+  int desired = std::max(counter_.Count(t), options_.min_prefetch_amount);
+  if (predictor_) {
+    // The demand in the predict window, at the rate forecast for when a
+    // prefetch made now is granted.
+    milliseconds round_trip(static_cast<int64_t>(round_trip_ms_));
+    desired = std::max(
+        desired, predictor_->Predict(round_trip, options_.predict_window, t));
+  }
+  return desired;
+}
+
+void QuotaPrefetchImpl::CountPassed(int amount, Tick t) {
+  counter_.Inc(amount, t);
+  if (predictor_) {
+    predictor_->Inc(amount, t);
+  }
+}
+
+void QuotaPrefetchImpl::AttemptPrefetch(int amount,
+                                        const TransportFunc& transport,
+                                        Tick t) {
   if (mode_ == CLOSE && (inflight_count_ > 0 ||
                          (duration_cast<milliseconds>(t - last_prefetch_time_) <
                           options_.close_wait_window))) {
@@ -166,15 +282,15 @@ void QuotaPrefetchImpl::AttemptPrefetch(int amount, Tick t) {
   }
 
   int avail = CountAvailable(t);
-  int pass_count = counter_.Count(t);
-  int desired = std::max(pass_count, options_.min_prefetch_amount);
+  int desired = DesiredAmount(t);
   if ((avail < desired / 2 && inflight_count_ == 0) || avail < amount) {
     bool use_not_granted = (avail == 0 && mode_ == OPEN);
-    Prefetch(std::max(amount, desired), use_not_granted, t);
+    Prefetch(std::max(amount, desired), use_not_granted, transport, t);
   }
 }
 
-void QuotaPrefetchImpl::Prefetch(int req_amount, bool use_not_granted, Tick t) {
+void QuotaPrefetchImpl::Prefetch(int req_amount, bool use_not_granted,
+                                 const TransportFunc& transport, Tick t) {
   SlotId slot_id = 0;
   if (use_not_granted) {
     // add the prefetch amount to available queue before it is granted.
@@ -185,48 +301,44 @@ void QuotaPrefetchImpl::Prefetch(int req_amount, bool use_not_granted, Tick t) {
 
   last_prefetch_time_ = t;
   ++inflight_count_;
-  transport_(req_amount,
-             [this, slot_id, req_amount](int resp_amount,
-                                         milliseconds expiration, Tick t1) {
-               OnResponse(slot_id, req_amount, resp_amount, expiration, t1);
-             },
-             t);
+  transport(req_amount,
+            [this, slot_id, req_amount, t](int resp_amount,
+                                           milliseconds expiration, Tick t1) {
+              OnResponse(slot_id, req_amount, resp_amount, expiration, t, t1);
+            },
+            t);
 }
 
 QuotaPrefetchImpl::Slot* QuotaPrefetchImpl::FindSlotById(SlotId id) {
-  Slot* found = nullptr;
-  queue_.Iterate([&](Slot& slot) -> bool {
-    if (slot.id == id) {
-      found = &slot;
-      return false;
-    }
-    return true;
-  });
-  return found;
+  // Slots are pushed with increasing ids and popped from the head, so the
+  // ids in the queue are consecutive.
+  Slot* head = queue_.Head();
+  if (head == nullptr || id < head->id) {
+    return nullptr;
+  }
+  return queue_.At(static_cast<int>(id - head->id));
 }
 
 QuotaPrefetchImpl::SlotId QuotaPrefetchImpl::Add(int amount, Tick expire_time) {
   SlotId id = ++next_slot_id_;
   queue_.Push(Slot{amount, expire_time, id});
+  available_ += amount;
+  next_expire_time_ = std::min(next_expire_time_, expire_time);
   return id;
 }
 
 int QuotaPrefetchImpl::Substract(int delta, Tick t) {
+  Expire(t);
   Slot* n = queue_.Head();
   while (n != nullptr && delta > 0) {
-    if (t < n->expire_time) {
-      if (n->available > 0) {
-        int d = std::min(n->available, delta);
-        n->available -= d;
-        delta -= d;
-      }
+    if (n->available > 0) {
+      int d = std::min(n->available, delta);
+      n->available -= d;
+      available_ -= d;
+      delta -= d;
       if (n->available > 0) {
         return 0;
       }
-    } else {
-      if (n->available > 0) {
-        LOG(t) << "Expired:" << n->available << std::endl;
-      }
     }
     queue_.Pop();
     n = queue_.Head();
@@ -234,12 +346,92 @@ int QuotaPrefetchImpl::Substract(int delta, Tick t) {
   return delta;
 }
 
+bool QuotaPrefetchImpl::CheckLease(int amount, Tick t) {
+  if (t.time_since_epoch().count() >= lease_expire_time_.load()) {
+    return false;
+  }
+  int size = sub_pools_.size();
+  int index = ThreadIndex() % size;
+  // Use the own sub-pool, steal from the others if it is empty.
+  for (int i = 0; i < size; ++i) {
+    if (TakeTokens(&sub_pools_[(index + i) % size].word, amount)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void QuotaPrefetchImpl::Lease(Tick t) {
+  Expire(t);
+  Slot* head = queue_.Head();
+  if (head == nullptr || head->available <= 0) {
+    return;
+  }
+  // A prefetch is made if the available amount drops below half of the
+  // desired amount, which grows with the passed amount. Lease no more
+  // than what keeps available_ - lease >= (desired + lease) / 2, so
+  // using the lease never skips a prefetch.
+  int desired = DesiredAmount(t);
+  int amount = std::min(head->available, (2 * available_ - desired) / 3);
+  if (amount <= 0) {
+    return;
+  }
+  lease_amount_ = amount;
+  lease_slot_id_ = head->id;
+  lease_time_ = t;
+  // The lease ends before any amount expires, and within the current
+  // counter slot so the passed amount is counted as if added at t.
+  Tick expire_time = std::min(next_expire_time_, counter_.SlotEndTime());
+  if (predictor_) {
+    expire_time = std::min(expire_time, predictor_->SampleEndTime());
+  }
+  lease_expire_time_ = expire_time.time_since_epoch().count();
+  int size = sub_pools_.size();
+  for (int i = 0; i < size; ++i) {
+    sub_pools_[i].word = amount / size + (i < amount % size ? 1 : 0);
+  }
+}
+
+void QuotaPrefetchImpl::EndLease() {
+  if (lease_amount_ == 0) {
+    return;
+  }
+  int passed = 0;
+  int used = lease_amount_;
+  for (auto& pool : sub_pools_) {
+    // Read and reset the tokens and the passed amount at once, a check
+    // can't pass between them.
+    uint64_t word = pool.word.exchange(0);
+    passed += static_cast<int>(word >> kPassShift);
+    used -= static_cast<int>(word & kAvailableMask);
+  }
+  if (passed > 0) {
+    CountPassed(passed, lease_time_);
+  }
+  lease_amount_ = 0;
+  // The leased slot is not changed or popped during the lease.
+  Slot* slot = FindSlotById(lease_slot_id_);
+  if (slot != nullptr && used > 0) {
+    slot->available -= used;
+    available_ -= used;
+  }
+}
+
 void QuotaPrefetchImpl::OnResponse(SlotId slot_id, int req_amount,
                                    int resp_amount, milliseconds expiration,
-                                   Tick t) {
+                                   Tick send_time, Tick t) {
   std::lock_guard<std::mutex> lock(mutex_);
+  EndLease();
   --inflight_count_;
 
+  if (resp_amount != -1) {
+    double round_trip = duration_cast<milliseconds>(t - send_time).count();
+    round_trip_ms_ = round_trip_ms_ == 0
+                         ? round_trip
+                         : kRoundTripWeight * round_trip +
+                               (1 - kRoundTripWeight) * round_trip_ms_;
+  }
+
   LOG(t) << "OnResponse: req:" << req_amount << ", resp: " << resp_amount
          << ", expire: " << expiration.count() << ", id: " << slot_id
          << std::endl;
@@ -261,6 +453,7 @@ void QuotaPrefetchImpl::OnResponse(SlotId slot_id, int req_amount,
       if (slot != nullptr) {
         int d = std::min(slot->available, delta);
         slot->available -= d;
+        available_ -= d;
         delta -= d;
       }
       if (delta > 0) {
@@ -271,6 +464,7 @@ void QuotaPrefetchImpl::OnResponse(SlotId slot_id, int req_amount,
     // Adjust the expiration
     if (slot != nullptr && slot->available > 0) {
       slot->expire_time = t + expiration;
+      next_expire_time_ = std::min(next_expire_time_, slot->expire_time);
     }
   } else {
     // prefetched amount was NOT added to the pool yet.
@@ -284,18 +478,30 @@ void QuotaPrefetchImpl::OnResponse(SlotId slot_id, int req_amount,
   } else {
     mode_ = CLOSE;
   }
+  Lease(t);
 }
 
 bool QuotaPrefetchImpl::Check(int amount, Tick t) {
+  return Check(amount, transport_, t);
+}
+
+bool QuotaPrefetchImpl::Check(int amount, const TransportFunc& transport,
+                              Tick t) {
+  // The fast path, no prefetch is needed while leased tokens remain.
+  if (CheckLease(amount, t)) {
+    return true;
+  }
+
   std::lock_guard<std::mutex> lock(mutex_);
+  EndLease();
 
-  AttemptPrefetch(amount, t);
-  counter_.Inc(amount, t);
+  AttemptPrefetch(amount, transport, t);
+  CountPassed(amount, t);
   bool ret;
   if (amount == 1) {
     ret = Substract(amount, t) == 0;
   } else {
-    ret = CheckMinAvailable(amount, t);
+    ret = CountAvailable(t) >= amount;
     if (ret) {
       Substract(amount, t);
     }
@@ -303,6 +509,7 @@ bool QuotaPrefetchImpl::Check(int amount, Tick t) {
   if (!ret) {
     LOG(t) << "Rejected amount: " << amount << std::endl;
   }
+  Lease(t);
   return ret;
 }
 
@@ -312,7 +519,10 @@ bool QuotaPrefetchImpl::Check(int amount, Tick t) {
 QuotaPrefetch::Options::Options()
     : predict_window(kPredictWindowInMs),
       min_prefetch_amount(kMinPrefetchAmount),
-      close_wait_window(kCloseWaitWindowInMs) {}
+      close_wait_window(kCloseWaitWindowInMs),
+      num_sub_pools(1),
+      rate_weight(0),
+      trend_weight(0) {}
 
 std::unique_ptr<QuotaPrefetch> QuotaPrefetch::Create(TransportFunc transport,
                                                      const Options& options,
@@ -16,8 +16,12 @@
 #include "include/istio/prefetch/quota_prefetch.h"
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <list>
+#include <string>
+#include <thread>
 #include <utility>
+#include <vector>
 
 using namespace std::chrono;
 using Tick = ::istio::prefetch::QuotaPrefetch::Tick;
@@ -310,6 +314,42 @@ class QuotaPrefetchTest : public ::testing::Test {
     RunTwoClientTest(*client1, *client2, data, traffic, result.margin5, t);
   }
 
+  // Replay the trace of requests per second with a client, the rate limit
+  // is kTraceRateLimit. Return the rejected count and the prefetch calls.
+  void RunTrace(const std::vector<int>& trace,
+                const QuotaPrefetch::Options& options, int* rejected,
+                int* calls) {
+    Tick t;
+    *rejected = *calls = 0;
+    auto transport = GetTransportFunc();
+    auto client = QuotaPrefetch::Create(
+        [&transport, calls](int amount, DoneFunc fn, Tick t) {
+          ++*calls;
+          transport(amount, fn, t);
+        },
+        options, t);
+    rate_server_ = std::unique_ptr<RateServer>(
+        new TimeBased(kTraceRateLimit, milliseconds(1000), t));
+    delay_.set_delay(kResponseDelay);
+
+    for (int rate : trace) {
+      Tick end = t + milliseconds(1000);
+      for (int i = 0; i < rate; ++i) {
+        Tick t1 = t + milliseconds(1000) * i / rate;
+        if (!client->Check(1, t1)) {
+          ++*rejected;
+        }
+        delay_.OnTimer(t1);
+      }
+      t = end;
+    }
+    // Deliver the pending responses before the client is deleted.
+    delay_.OnTimer(t + kResponseDelay);
+  }
+
+  // The rate limit per second used by RunTrace().
+  static const int kTraceRateLimit = 1000;
+
   std::unique_ptr<RateServer> rate_server_;
   Delay delay_;
 };
@@ -417,6 +457,170 @@ TEST_F(QuotaPrefetchTest, TestNotEnoughAmount) {
   delay_.OnTimer(t);
 }
 
+TEST_F(QuotaPrefetchTest, TestExpiredAmount) {
+  Tick t;
+  std::vector<DoneFunc> calls;
+  auto client = QuotaPrefetch::Create(
+      [&calls](int amount, DoneFunc fn, Tick t) { calls.push_back(fn); },
+      QuotaPrefetch::Options(), t);
+
+  // First one is always true, the prefetch amount 10 is added before it is
+  // granted. Only 5 are granted for one second, 4 tokens remain.
+  EXPECT_TRUE(client->Check(1, t));
+  ASSERT_EQ(calls.size(), 1);
+  calls[0](5, milliseconds(1000), t);
+
+  // The 4 tokens are expired.
+  t += milliseconds(1001);
+  EXPECT_FALSE(client->Check(4, t));
+  ASSERT_EQ(calls.size(), 2);
+
+  // The new granted amount is available.
+  calls[1](10, milliseconds(1000), t);
+  t += milliseconds(1);
+  EXPECT_TRUE(client->Check(10, t));
+}
+
+TEST_F(QuotaPrefetchTest, TestPerCheckTransport) {
+  Tick t;
+  auto client = QuotaPrefetch::Create(nullptr, QuotaPrefetch::Options(), t);
+
+  // The prefetch is sent with the transport of the check making it.
+  std::vector<DoneFunc> calls;
+  QuotaPrefetch::TransportFunc transport =
+      [&calls](int amount, DoneFunc fn, Tick t) { calls.push_back(fn); };
+  EXPECT_TRUE(client->Check(1, transport, t));
+  ASSERT_EQ(calls.size(), 1);
+  calls[0](10, milliseconds(1000), t);
+
+  // No prefetch is needed while tokens remain.
+  t += milliseconds(1);
+  EXPECT_TRUE(client->Check(1, transport, t));
+  EXPECT_EQ(calls.size(), 1);
+}
+
+// Grant 1000 tokens, then make 800 checks from the threads. Most checks
+// take the lock free path with leased tokens, none of the 999 tokens
+// should be lost or used twice.
+void RunConcurrentChecks(int num_sub_pools, int num_threads) {
+  Tick t;
+  std::vector<DoneFunc> calls;
+  QuotaPrefetch::Options options;
+  options.min_prefetch_amount = 1000;
+  options.num_sub_pools = num_sub_pools;
+  auto client = QuotaPrefetch::Create(
+      [&calls](int amount, DoneFunc fn, Tick t) { calls.push_back(fn); },
+      options, t);
+
+  EXPECT_TRUE(client->Check(1, t));
+  ASSERT_EQ(calls.size(), 1);
+  calls[0](1000, milliseconds(60000), t);
+
+  std::atomic<int> passed(0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&client, &passed, num_threads, t]() {
+      for (int j = 0; j < 800 / num_threads; ++j) {
+        if (client->Check(1, t)) {
+          ++passed;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(passed, 800);
+
+  EXPECT_FALSE(client->Check(200, t));
+  EXPECT_TRUE(client->Check(199, t));
+}
+
+TEST_F(QuotaPrefetchTest, TestConcurrentChecks) { RunConcurrentChecks(1, 4); }
+
+TEST_F(QuotaPrefetchTest, TestConcurrentChecksWithSubPools) {
+  RunConcurrentChecks(4, 4);
+}
+
+TEST_F(QuotaPrefetchTest, TestSubPoolsStealing) {
+  // One thread uses the tokens of all sub-pools.
+  RunConcurrentChecks(4, 1);
+}
+
+// Grant 900 of 1000 requested tokens, then make more checks than that
+// from the threads. Leases are used up and renewed while other threads
+// check with them. Exactly the granted tokens should pass.
+void RunContendedChecks(int num_sub_pools, int num_threads) {
+  Tick t;
+  std::vector<DoneFunc> calls;
+  QuotaPrefetch::Options options;
+  options.min_prefetch_amount = 1000;
+  options.num_sub_pools = num_sub_pools;
+  auto client = QuotaPrefetch::Create(
+      [&calls](int amount, DoneFunc fn, Tick t) { calls.push_back(fn); },
+      options, t);
+
+  // The first check uses a token of the pending prefetch. Later prefetches
+  // are not granted.
+  EXPECT_TRUE(client->Check(1, t));
+  ASSERT_EQ(calls.size(), 1);
+  calls[0](900, milliseconds(60000), t);
+
+  std::atomic<int> passed(1);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([&client, &passed, t]() {
+      for (int j = 0; j < 1000; ++j) {
+        if (client->Check(1, t)) {
+          ++passed;
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(passed, 900);
+}
+
+TEST_F(QuotaPrefetchTest, TestContendedChecks) { RunContendedChecks(1, 8); }
+
+TEST_F(QuotaPrefetchTest, TestContendedChecksWithSubPools) {
+  RunContendedChecks(4, 8);
+}
+
+// Compare the window count and the rate trend prefetch sizing with
+// deterministic traffic traces in requests per second.
+TEST_F(QuotaPrefetchTest, TestPredictivePrefetchTraces) {
+  std::vector<std::pair<std::string, std::vector<int>>> traces;
+  std::vector<int> ramp, step, spikes;
+  for (int i = 0; i < 30; ++i) {
+    ramp.push_back(20 + i * 30);
+    step.push_back(i < 10 ? 50 : 800);
+    spikes.push_back(i % 5 == 0 ? 900 : 100);
+  }
+  traces.emplace_back("ramp", ramp);
+  traces.emplace_back("step", step);
+  traces.emplace_back("spikes", spikes);
+
+  QuotaPrefetch::Options window_options;
+  QuotaPrefetch::Options trend_options;
+  trend_options.rate_weight = 0.5;
+  trend_options.trend_weight = 0.2;
+  for (const auto& trace : traces) {
+    int window_rejected, window_calls, trend_rejected, trend_calls;
+    RunTrace(trace.second, window_options, &window_rejected, &window_calls);
+    RunTrace(trace.second, trend_options, &trend_rejected, &trend_calls);
+    std::cerr << "===RunTrace " << trace.first
+              << " window: rejected: " << window_rejected
+              << ", calls: " << window_calls
+              << "; trend: rejected: " << trend_rejected
+              << ", calls: " << trend_calls << std::endl;
+    EXPECT_LE(trend_rejected, window_rejected);
+    EXPECT_LE(trend_calls, window_calls);
+  }
+}
+
 }  // namespace
 }  // namespace prefetch
 }  // namespace istio
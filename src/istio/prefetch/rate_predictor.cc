@@ -0,0 +1,83 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/prefetch/rate_predictor.h"
+
+#include <algorithm>
+
+using namespace std::chrono;
+
+namespace istio {
+namespace prefetch {
+namespace {
+
+// After this many idle samples, the averages are reset.
+const int kMaxIdleSamples = 100;
+
+}  // namespace
+
+RatePredictor::RatePredictor(milliseconds sample_duration, double rate_weight,
+                             double trend_weight, Tick t)
+    : sample_duration_(std::max(sample_duration, milliseconds(1))),
+      rate_weight_(rate_weight),
+      trend_weight_(trend_weight),
+      count_(0),
+      level_(0),
+      trend_(0),
+      last_time_(t) {}
+
+void RatePredictor::AddSample(double count) {
+  double level = rate_weight_ * count + (1 - rate_weight_) * (level_ + trend_);
+  trend_ = trend_weight_ * (level - level_) + (1 - trend_weight_) * trend_;
+  level_ = level;
+}
+
+void RatePredictor::Roll(Tick t) {
+  if (t < SampleEndTime()) {
+    return;
+  }
+  auto n = duration_cast<milliseconds>(t - last_time_).count() /
+           sample_duration_.count();
+  if (n > kMaxIdleSamples) {
+    level_ = trend_ = 0;
+    count_ = 0;
+    last_time_ = t;
+    return;
+  }
+
+  for (int i = 0; i < n; i++) {
+    AddSample(count_);
+    count_ = 0;
+    last_time_ += sample_duration_;
+  }
+}
+
+void RatePredictor::Inc(int n, Tick t) {
+  Roll(t);
+  count_ += n;
+}
+
+int RatePredictor::Predict(milliseconds lead_time, milliseconds duration,
+                           Tick t) {
+  Roll(t);
+  // The forecast count per sample after lead_time, for the duration.
+  double count = (level_ + trend_ * lead_time.count() /
+                               sample_duration_.count()) *
+                 duration.count() / sample_duration_.count();
+  return count > 0 ? int(count) : 0;
+}
+
+}  // namespace prefetch
+}  // namespace istio
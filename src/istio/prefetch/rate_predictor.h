@@ -0,0 +1,72 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ISTIO_PREFETCH_RATE_PREDICTOR_H_
+#define ISTIO_PREFETCH_RATE_PREDICTOR_H_
+
+#include <chrono>
+
+namespace istio {
+namespace prefetch {
+
+// Predict the request count with the exponentially weighted moving
+// averages of the count per sample and of its trend (double exponential
+// smoothing). The count is sampled every sample duration.
+class RatePredictor {
+ public:
+  // Define a time stamp type.
+  // The input time should be always increasing.
+  typedef std::chrono::time_point<std::chrono::system_clock> Tick;
+
+  // rate_weight and trend_weight are the weights of the newest sample in
+  // the averages of the count and its trend, in (0, 1].
+  RatePredictor(std::chrono::milliseconds sample_duration, double rate_weight,
+                double trend_weight, Tick t);
+
+  // Add n count to the current sample.
+  void Inc(int n, Tick t);
+
+  // Predict the count in a duration at the rate forecast after lead_time,
+  // from the finished samples. The trend is not extended into the
+  // duration, so a short spike doesn't inflate the prediction.
+  int Predict(std::chrono::milliseconds lead_time,
+              std::chrono::milliseconds duration, Tick t);
+
+  // The end time of the current sample. Counts added before this time go
+  // to the current sample.
+  Tick SampleEndTime() const { return last_time_ + sample_duration_; }
+
+ private:
+  // Finish the samples ended before t.
+  void Roll(Tick t);
+  // Update the averages with a finished sample.
+  void AddSample(double count);
+
+  std::chrono::milliseconds sample_duration_;
+  double rate_weight_;
+  double trend_weight_;
+  // The count of the current sample.
+  int count_;
+  // The smoothed count per sample and its trend.
+  double level_;
+  double trend_;
+  // The start time of the current sample.
+  Tick last_time_;
+};
+
+}  // namespace prefetch
+}  // namespace istio
+
+#endif  // ISTIO_PREFETCH_RATE_PREDICTOR_H_
@@ -0,0 +1,71 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/istio/prefetch/rate_predictor.h"
+#include "gtest/gtest.h"
+
+using namespace std::chrono;
+
+namespace istio {
+namespace prefetch {
+namespace {
+
+time_point<system_clock> FakeTime(int t) {
+  return time_point<system_clock>(milliseconds(t));
+}
+
+TEST(RatePredictorTest, TestSteadyRate) {
+  RatePredictor p(milliseconds(10), 0.5, 0.5, FakeTime(0));
+  for (int t = 0; t < 1000; t += 10) {
+    p.Inc(5, FakeTime(t));
+  }
+  // 5 per 10ms, the trend is near 0.
+  EXPECT_EQ(p.Predict(milliseconds(50), milliseconds(100), FakeTime(1000)),
+            49);
+}
+
+TEST(RatePredictorTest, TestRisingRate) {
+  RatePredictor p(milliseconds(10), 0.5, 0.5, FakeTime(0));
+  // The count per sample rises by 1 in every sample.
+  for (int i = 0; i < 100; ++i) {
+    p.Inc(i, FakeTime(i * 10));
+  }
+  // The sample after 50ms is about 105.
+  int count = p.Predict(milliseconds(50), milliseconds(100), FakeTime(1000));
+  EXPECT_GT(count, 1000);
+  EXPECT_LT(count, 1100);
+  // The trend is not used without the lead time.
+  EXPECT_LT(p.Predict(milliseconds(0), milliseconds(100), FakeTime(1000)),
+            count);
+}
+
+TEST(RatePredictorTest, TestIdle) {
+  RatePredictor p(milliseconds(10), 0.5, 0.5, FakeTime(0));
+  for (int t = 0; t < 100; t += 10) {
+    p.Inc(5, FakeTime(t));
+  }
+  // The current sample is not predicted.
+  EXPECT_GT(p.Predict(milliseconds(0), milliseconds(100), FakeTime(100)), 0);
+  EXPECT_EQ(p.SampleEndTime(), FakeTime(110));
+
+  // Reset after a long idle time.
+  EXPECT_EQ(p.Predict(milliseconds(0), milliseconds(100), FakeTime(10000)),
+            0);
+  EXPECT_EQ(p.SampleEndTime(), FakeTime(10010));
+}
+
+}  // namespace
+}  // namespace prefetch
+}  // namespace istio
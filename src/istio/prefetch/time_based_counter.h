@@ -41,6 +41,10 @@ class TimeBasedCounter {
   // Get the count.
   int Count(Tick t);
 
+  // The end time of the current slot. Counts added before this time go to
+  // the current slot.
+  Tick SlotEndTime() const { return last_time_ + slot_duration_; }
+
  private:
   // Clear the whole window
   void Clear(Tick t);
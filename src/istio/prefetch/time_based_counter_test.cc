@@ -35,6 +35,17 @@ TEST(TimeBasedCounterTest, Test1) {
   ASSERT_EQ(c.Count(FakeTime(8)), 1);
 }
 
+TEST(TimeBasedCounterTest, TestSlotEndTime) {
+  TimeBasedCounter c(3, std::chrono::milliseconds(3), FakeTime(0));
+  ASSERT_EQ(c.SlotEndTime(), FakeTime(1));
+
+  // Counts before the slot end time go to the current slot.
+  c.Inc(1, FakeTime(4));
+  ASSERT_EQ(c.SlotEndTime(), FakeTime(5));
+  c.Inc(1, FakeTime(4));
+  ASSERT_EQ(c.Count(FakeTime(4)), 2);
+}
+
 }  // namespace
 }  // namespace prefetch
 }  // namespace istio
@@ -0,0 +1,162 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/utils/hash128.h"
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <random>
+
+namespace istio {
+namespace utils {
+namespace {
+
+inline uint64_t Rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+// Reads a little-endian 64 bits word from the (maybe unaligned) data.
+inline uint64_t Load64(const unsigned char* p) {
+  return static_cast<uint64_t>(p[0]) | static_cast<uint64_t>(p[1]) << 8 |
+         static_cast<uint64_t>(p[2]) << 16 | static_cast<uint64_t>(p[3]) << 24 |
+         static_cast<uint64_t>(p[4]) << 32 | static_cast<uint64_t>(p[5]) << 40 |
+         static_cast<uint64_t>(p[6]) << 48 | static_cast<uint64_t>(p[7]) << 56;
+}
+
+inline void SipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2,
+                     uint64_t& v3) {
+  v0 += v1;
+  v1 = Rotl64(v1, 13);
+  v1 ^= v0;
+  v0 = Rotl64(v0, 32);
+  v2 += v3;
+  v3 = Rotl64(v3, 16);
+  v3 ^= v2;
+  v0 += v3;
+  v3 = Rotl64(v3, 21);
+  v3 ^= v0;
+  v2 += v1;
+  v1 = Rotl64(v1, 17);
+  v1 ^= v2;
+  v2 = Rotl64(v2, 32);
+}
+
+// The random key of the process.
+struct ProcessKey {
+  ProcessKey() {
+    std::random_device random;
+    k0 = static_cast<uint64_t>(random()) << 32 | random();
+    k1 = static_cast<uint64_t>(random()) << 32 | random();
+  }
+  uint64_t k0;
+  uint64_t k1;
+};
+
+const ProcessKey& GetProcessKey() {
+  static const ProcessKey key;
+  return key;
+}
+
+}  // namespace
+
+std::string Hash128::DebugString() const {
+  char buf[33];
+  snprintf(buf, sizeof(buf), "%016llx%016llx",
+           static_cast<unsigned long long>(high),
+           static_cast<unsigned long long>(low));
+  return std::string(buf, 32);
+}
+
+SipHash128::SipHash128()
+    : SipHash128(GetProcessKey().k0, GetProcessKey().k1) {}
+
+SipHash128::SipHash128(uint64_t k0, uint64_t k1)
+    : v0_(k0 ^ 0x736f6d6570736575ULL),
+      v1_(k1 ^ 0x646f72616e646f6dULL ^ 0xee),
+      v2_(k0 ^ 0x6c7967656e657261ULL),
+      v3_(k1 ^ 0x7465646279746573ULL),
+      length_(0),
+      tail_size_(0),
+      finalized_(false) {}
+
+void SipHash128::ProcessBlock(uint64_t m) {
+  v3_ ^= m;
+  SipRound(v0_, v1_, v2_, v3_);
+  SipRound(v0_, v1_, v2_, v3_);
+  v0_ ^= m;
+}
+
+SipHash128& SipHash128::Update(const void* data, size_t size) {
+  // Not update after finalized.
+  assert(!finalized_);
+  const unsigned char* p = static_cast<const unsigned char*>(data);
+  length_ += size;
+
+  // Fill the partial block first.
+  if (tail_size_ > 0) {
+    size_t n = std::min(size, static_cast<size_t>(kBlockSize - tail_size_));
+    memcpy(tail_ + tail_size_, p, n);
+    tail_size_ += n;
+    p += n;
+    size -= n;
+    if (tail_size_ < kBlockSize) {
+      return *this;
+    }
+    ProcessBlock(Load64(tail_));
+    tail_size_ = 0;
+  }
+
+  for (; size >= kBlockSize; p += kBlockSize, size -= kBlockSize) {
+    ProcessBlock(Load64(p));
+  }
+
+  if (size > 0) {
+    memcpy(tail_, p, size);
+    tail_size_ = size;
+  }
+  return *this;
+}
+
+Hash128 SipHash128::Digest() {
+  if (finalized_) {
+    return digest_;
+  }
+  finalized_ = true;
+
+  // The last block has the remaining bytes and the length in the top byte.
+  uint64_t b = length_ << 56;
+  for (int i = 0; i < tail_size_; ++i) {
+    b |= static_cast<uint64_t>(tail_[i]) << (i * 8);
+  }
+  ProcessBlock(b);
+
+  v2_ ^= 0xee;
+  for (int i = 0; i < 4; ++i) {
+    SipRound(v0_, v1_, v2_, v3_);
+  }
+  digest_.low = v0_ ^ v1_ ^ v2_ ^ v3_;
+
+  v1_ ^= 0xdd;
+  for (int i = 0; i < 4; ++i) {
+    SipRound(v0_, v1_, v2_, v3_);
+  }
+  digest_.high = v0_ ^ v1_ ^ v2_ ^ v3_;
+  return digest_;
+}
+
+Hash128 SipHash128::operator()(const void* data, size_t size) {
+  return Update(data, size).Digest();
+}
+
+}  // namespace utils
+}  // namespace istio
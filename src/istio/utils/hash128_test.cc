@@ -0,0 +1,130 @@
+/* Copyright 2018 Istio Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "include/istio/utils/hash128.h"
+#include "gtest/gtest.h"
+#include "include/istio/utils/md5.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace istio {
+namespace utils {
+namespace {
+
+TEST(SipHash128Test, TestKnownDigest) {
+  static const char data[] = "The quick brown fox jumps over the lazy dog";
+  // The reference SipHash-2-4 128 bits output with the key 00 01 .. 0f,
+  // high word first.
+  const uint64_t k0 = 0x0706050403020100ULL;
+  const uint64_t k1 = 0x0f0e0d0c0b0a0908ULL;
+  EXPECT_EQ("4e9631cd2752e6552541a41a30c92876",
+            SipHash128(k0, k1)(data, strlen(data)).DebugString());
+  EXPECT_EQ("930255c71472f66de6a825ba047f81a3",
+            SipHash128(k0, k1)("", 0).DebugString());
+}
+
+TEST(SipHash128Test, TestProcessKey) {
+  static const char data[] = "Test Data";
+  // All hashers of the process share the random key.
+  auto d1 = SipHash128()(data, sizeof(data));
+  EXPECT_EQ(d1, SipHash128()(data, sizeof(data)));
+  EXPECT_NE(d1, SipHash128(0, 0)(data, sizeof(data)));
+}
+
+TEST(SipHash128Test, TestDigestEqual) {
+  static const char data1[] = "Test Data1";
+  static const char data2[] = "Test Data2";
+  auto d1 = SipHash128()(data1, sizeof(data1));
+  auto d11 = SipHash128()(data1, sizeof(data1));
+  auto d2 = SipHash128()(data2, sizeof(data2));
+  EXPECT_EQ(d11, d1);
+  EXPECT_NE(d1, d2);
+  EXPECT_EQ(Hash128Hasher()(d1), Hash128Hasher()(d11));
+}
+
+TEST(SipHash128Test, TestStreaming) {
+  std::string data;
+  for (int i = 0; i < 100; ++i) {
+    data += static_cast<char>('a' + i % 26);
+  }
+  Hash128 expected = SipHash128()(data.data(), data.size());
+
+  // Any split of the data should produce the same digest.
+  for (size_t chunk = 1; chunk <= 33; ++chunk) {
+    SipHash128 hasher;
+    for (size_t i = 0; i < data.size(); i += chunk) {
+      hasher.Update(data.substr(i, chunk));
+    }
+    EXPECT_EQ(expected, hasher.Digest()) << "chunk size: " << chunk;
+  }
+}
+
+// Hash attribute-like data the same way Referenced::Signature does:
+// many short names and values separated by delimiters.
+template <class Hasher>
+double MeasureSignatureTime(const std::vector<std::string>& words,
+                            int loops) {
+  static const char kDelimiter[] = "\0";
+  auto start = std::chrono::steady_clock::now();
+  size_t sink = 0;
+  for (int n = 0; n < loops; ++n) {
+    Hasher hasher;
+    for (const auto& word : words) {
+      hasher.Update(word);
+      hasher.Update(kDelimiter, 1);
+    }
+    sink += hasher.Digest().size();
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start);
+  EXPECT_GT(sink, 0);
+  return static_cast<double>(elapsed.count()) / loops;
+}
+
+// An adapter to give SipHash128 digest a size() like MD5 digest string.
+class SipHashAdapter {
+ public:
+  void Update(const std::string& str) { hasher_.Update(str); }
+  void Update(const void* data, size_t size) { hasher_.Update(data, size); }
+  std::string Digest() {
+    Hash128 h = hasher_.Digest();
+    return std::string(reinterpret_cast<const char*>(&h), sizeof(h));
+  }
+
+ private:
+  SipHash128 hasher_;
+};
+
+TEST(SipHash128Test, TestCompareWithMD5) {
+  std::vector<std::string> words = {
+      "source.uid",       "kubernetes://productpage-v1-5d9b9c5c5c-abcde",
+      "target.service",   "reviews.default.svc.cluster.local",
+      "request.headers",  ":authority",
+      "reviews:9080",     ":path",
+      "/reviews/0",       "user-agent",
+      "Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36",
+      "request.method",   "GET"};
+  const int kLoops = 100000;
+  double md5_ns = MeasureSignatureTime<MD5>(words, kLoops);
+  double siphash_ns = MeasureSignatureTime<SipHashAdapter>(words, kLoops);
+  std::cerr << "===Signature MD5: " << md5_ns << " ns, SipHash128: "
+            << siphash_ns << " ns" << std::endl;
+}
+
+}  // namespace
+}  // namespace utils
+}  // namespace istio
@@ -183,6 +183,7 @@ TEST_F(SimpleLRUCacheTest, StdCopy) {
 }
 
 void SimpleLRUCacheTest::TestInOrderEvictions(int cache_size) {
+  int64_t evictions = cache_->Evictions();
   for (int i = 0; i < kElems; i++) {
     ASSERT_TRUE(!cache_->Lookup(i));
     TestValue* v = new TestValue(i);
@@ -193,6 +194,7 @@ void SimpleLRUCacheTest::TestInOrderEvictions(int cache_size) {
       ASSERT_TRUE(!in_cache[i - cache_size]);
     }
   }
+  ASSERT_EQ(cache_->Evictions() - evictions, kElems - cache_size);
 }
 
 TEST_F(SimpleLRUCacheTest, InOrderEvictions) {
@@ -609,6 +611,8 @@ void SimpleLRUCacheTest::TestExpiration(bool lru, bool release_quickly) {
 
   // In either case all the other elements should now be gone.
   for (int i = 1; i < kCacheSize; i++) ASSERT_TRUE(!in_cache[i]);
+  ASSERT_GE(cache_->Expirations(), kCacheSize - 1);
+  ASSERT_EQ(cache_->Evictions(), 0);
 
   // Clean up
   bool cleaned_up = false;